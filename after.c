@@ -0,0 +1,282 @@
+#define _GNU_SOURCE
+
+#include "after.h"
+#include "tsh.h"
+#include "job.h"
+#include "feed.h"
+#include "helper.h"
+#include "fastpath.h"
+#include "builtin.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+
+struct after_t {            /* a job waiting for others */
+    pid_t pgid;             /* 0: free slot */
+    int gate;               /* write end of its gate */
+    bool ok_only;           /* after-ok */
+    int dep_num;
+    pid_t dep_pgid[AFTER_MAXDEPS];  /* 0 once it is done */
+    int dep_jid[AFTER_MAXDEPS];
+    int dep_status[AFTER_MAXDEPS];  /* -1 while running */
+};
+
+static struct after_t afters[MAXJOBS];
+
+static struct {             /* the last job that had each jid, to name it once it's gone */
+    bool done;
+    int status;
+} finished[MAXJOBS + 1];
+
+/*
+ * open_gate - Let the processes of a waiting job go on (c = 'g'), or exit
+ *     (c = 'x'). The gate is a socket, so that a job killed while waiting
+ *     doesn't get the shell a SIGPIPE.
+ */
+static void open_gate(struct after_t * a, char c) {
+    struct job_t * job = getjobpgid(jobs, a->pgid);
+    int n = job != NULL ? job->proc_num : 0;
+    char buf[256];
+
+    memset(buf, c, sizeof(buf));
+    while(n > 0) {
+        ssize_t w = send(a->gate, buf, n < (int)sizeof(buf) ? n : (int)sizeof(buf), MSG_NOSIGNAL);
+        if(w < 0 && errno == EINTR)
+            continue;
+        if(w <= 0)
+            break;
+        n -= w;
+    }
+    close(a->gate);
+    a->pgid = 0;
+
+    if(job != NULL && job->state == WT) {
+        publish_job(job, WT, BG);
+        job->state = BG;
+    }
+}
+
+/* ready - Open the gate of a if it isn't waiting for anything any more */
+static void ready(struct after_t * a) {
+    for(int i = 0; i < a->dep_num; i++) {
+        if(a->dep_pgid[i] != 0)
+            return;
+        if(a->ok_only && a->dep_status[i] != 0) {
+            open_gate(a, 'x');
+            return;
+        }
+    }
+    open_gate(a, 'g');
+}
+
+/*
+ * after_job_done - job is being deleted: the jobs that wait for it may go.
+ *     Called from the SIGCHLD handler, or with signals blocked.
+ */
+void after_job_done(struct job_t * job) {
+    if(job->jid >= 1 && job->jid <= MAXJOBS) {
+        finished[job->jid].done = true;
+        finished[job->jid].status = job->status;
+    }
+
+    for(int i = 0; i < MAXJOBS; i++) {
+        struct after_t * a = &afters[i];
+        if(a->pgid == 0)
+            continue;
+        if(a->pgid == job->pgid) {  // killed before it could start
+            close(a->gate);
+            a->pgid = 0;
+            continue;
+        }
+
+        bool waited = false;
+        for(int k = 0; k < a->dep_num; k++) {
+            if(a->dep_pgid[k] == job->pgid) {
+                a->dep_pgid[k] = 0;
+                a->dep_status[k] = job->status;
+                waited = true;
+            }
+        }
+        if(waited)
+            ready(a);
+    }
+}
+
+/* is_waiting - Is job an after whose gate is still closed */
+bool is_waiting(struct job_t * job) {
+    for(int i = 0; i < MAXJOBS; i++) {
+        if(afters[i].pgid != 0 && afters[i].pgid == job->pgid)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * wait_gate - In a process of a waiting job: block until the gate opens,
+ *     exit if the job is cancelled
+ */
+void wait_gate(int gate[2]) {
+    char c = 'x';
+    ssize_t n;
+
+    close(gate[1]);
+    while((n = read(gate[0], &c, 1)) < 0 && errno == EINTR)
+        ;
+    close(gate[0]);
+    if(n != 1 || c != 'g')
+        exit(AFTER_CANCELLED);
+}
+
+/* list_after - Under a job in jobs: what it waits for, what waits for it */
+void list_after(struct job_t * job) {
+    for(int i = 0; i < MAXJOBS; i++) {
+        struct after_t * a = &afters[i];
+        if(a->pgid == 0)
+            continue;
+
+        if(a->pgid == job->pgid) {
+            printf("    %s", a->ok_only ? "after-ok" : "after");
+            for(int k = 0; k < a->dep_num; k++) {
+                if(a->dep_pgid[k] != 0) {
+                    printf(" [%d] running", a->dep_jid[k]);
+                } else {
+                    printf(" [%d] exited %d", a->dep_jid[k], a->dep_status[k]);
+                }
+                printf(k + 1 < a->dep_num ? "," : "\n");
+            }
+        }
+    }
+
+    bool any = false;
+    for(int i = 0; i < MAXJOBS; i++) {
+        struct after_t * a = &afters[i];
+        for(int k = 0; a->pgid != 0 && k < a->dep_num; k++) {
+            if(a->dep_pgid[k] == job->pgid) {
+                printf(any ? " [%d]" : "    then [%d]", pgid2jid(a->pgid));
+                any = true;
+                break;
+            }
+        }
+    }
+    if(any)
+        printf("\n");
+}
+
+/* add_dep - Add the job named by word to a. Return false if there is no such job. */
+static bool add_dep(struct after_t * a, char * word) {
+    struct job_t * job = pgidjid_str2job(word);
+    int k = a->dep_num;
+
+    if(job != NULL && job->state != UNDEF) {
+        a->dep_pgid[k] = job->pgid;
+        a->dep_jid[k] = job->jid;
+        a->dep_status[k] = -1;
+    } else if(word[0] == '%' && atoi(word + 1) >= 1 && atoi(word + 1) <= MAXJOBS && finished[atoi(word + 1)].done) {
+        a->dep_pgid[k] = 0;
+        a->dep_jid[k] = atoi(word + 1);
+        a->dep_status[k] = finished[a->dep_jid[k]].status;
+    } else {
+        return false;
+    }
+    a->dep_num++;
+    return true;
+}
+
+/*
+ * run_after - Run a pipeline whose first word is after or after-ok: start
+ *     it as a waiting background job, and register what it waits for
+ */
+int run_after(struct cmd_t * cmd, int cmd_num, char * cmdline) {
+    char msg[MAXLINE + 64];
+    char ** argv = cmd[0].argv;
+    const char * name = argv[0];
+    struct after_t a;
+    sigset_t mask, prev;
+    int slot;
+
+    memset(&a, 0, sizeof(a));
+    a.ok_only = strcmp(name, "after-ok") == 0;
+
+    for(slot = 0; slot < MAXJOBS && afters[slot].pgid != 0; slot++)
+        ;
+
+    int i = 1;
+    while(argv[i] != NULL && strcmp(argv[i], "--") != 0)
+        i++;
+    if(argv[i] == NULL || i == 1 || i - 1 > AFTER_MAXDEPS || (argv[i + 1] == NULL && cmd_num == 1)) {
+        snprintf(msg, sizeof(msg), "usage: %s %%JOB... -- cmd args\n", name);
+        print_error(msg);
+        return last_status = 2;
+    }
+    if(slot == MAXJOBS) {
+        snprintf(msg, sizeof(msg), "%s: too many waiting jobs\n", name);
+        print_error(msg);
+        return last_status = 1;
+    }
+
+    // the job list doesn't change until the job is registered
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &prev);
+
+    for(int k = 1; k < i; k++) {
+        if(!add_dep(&a, argv[k])) {
+            sigprocmask(SIG_SETMASK, &prev, NULL);
+            snprintf(msg, sizeof(msg), "%s: %.64s: no such job\n", name, argv[k]);
+            print_error(msg);
+            return last_status = 1;
+        }
+    }
+
+    // drop "after %1 %2 --"
+    int skip = i + 1;
+    i = 0;
+    do {
+        argv[i] = argv[i + skip];
+    } while(argv[i++] != NULL);
+
+    // every stage must be a process of its own that can wait at the gate
+    int process_num = 0;
+    for(int k = 0; k < cmd_num; k++) {
+        set_is_builtin(&cmd[k]);
+        if(cmd[k].is_builtin && cmd[k].argv[0] != NULL && (is_fastpath(&cmd[k]) || is_pure_builtin(&cmd[k])))
+            cmd[k].is_builtin = false;
+        if(cmd[k].is_builtin) {
+            sigprocmask(SIG_SETMASK, &prev, NULL);
+            snprintf(msg, sizeof(msg), "%s: %.64s runs in the shell, it can't wait\n", name,
+                     cmd[k].argv[0] != NULL ? cmd[k].argv[0] : "a redirection");
+            print_error(msg);
+            return last_status = 1;
+        }
+        process_num++;
+    }
+
+    int gate[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, gate) < 0) {
+        sigprocmask(SIG_SETMASK, &prev, NULL);
+        unix_error("socketpair");
+    }
+    gate_next_pipeline(gate);
+    run_pipeline(cmd, cmd_num, process_num, 1, cmdline);
+    close(gate[0]);
+
+    struct job_t * job = getjobpgid(jobs, last_job_pgid);
+    if(job == NULL || job->state != WT) {   // not started
+        close(gate[1]);
+        sigprocmask(SIG_SETMASK, &prev, NULL);
+        return last_status;
+    }
+    a.pgid = job->pgid;
+    a.gate = gate[1];
+    afters[slot] = a;
+    ready(&afters[slot]);     // its jobs may all be done already
+
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+    return last_status;
+}
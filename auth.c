@@ -1,6 +1,7 @@
 #include "auth.h"
 #include "tsh.h"
 #include "helper.h"
+#include "startup.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -57,6 +58,7 @@ char * login() {
     while(1){
         printf("username: ");
         fflush(stdout);
+        startup_pause();
         fgets(name, MAXLINE, stdin);    // use fgets, instead of scanf, in case there are spaces in the input
         name[strlen(name) - 1] = '\0';  // deal with '\n' at the end
         if(strcmp(name, "quit")==0){
@@ -67,6 +69,7 @@ char * login() {
         printf("password: ");
         fflush(stdout);
         fgets(passwd, MAXLINE, stdin); 
+        startup_resume();
         passwd[strlen(passwd) - 1] = '\0';
         if(strcmp(passwd, "quit")==0){
             free(name);
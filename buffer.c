@@ -0,0 +1,368 @@
+#define _GNU_SOURCE
+
+#include "buffer.h"
+#include "job.h"
+#include "tsh.h"
+#include "helper.h"
+#include "group.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+
+/***********************************************
+ * Shell side: the stats of the job's stages
+ **********************************************/
+
+bool is_buffer(struct cmd_t * cmd) {
+    return cmd->argv[0] != NULL && strcmp(cmd->argv[0], "buffer") == 0;
+}
+
+/* open_buffer - Stats shared with a buffer stage, to be created before forking it */
+struct buffer_t * open_buffer() {
+    struct buffer_t * buf = mmap(NULL, sizeof(struct buffer_t), PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(buf == MAP_FAILED) {
+        unix_error("mmap");
+    }
+    return buf;     // zero-filled
+}
+
+static void close_buffer(struct buffer_t * buf) {
+    while(buf != NULL) {
+        struct buffer_t * next = buf->next;
+        munmap(buf, sizeof(struct buffer_t));
+        buf = next;
+    }
+}
+
+/* attach_buffer - Give the stats of its stages to the job, once it is in the job list */
+void attach_buffer(struct job_t * job, struct buffer_t * buf) {
+    if(job == NULL) {
+        close_buffer(buf);
+        return;
+    }
+    job->buf = buf;
+}
+
+/* human - Format bytes as 512, 1.5K, 20.0M, 3.1G */
+static char * human(char * str, long long bytes) {
+    const char * units = "KMGT";
+    double v = bytes;
+
+    if(bytes < 1024) {
+        sprintf(str, "%lld", bytes);
+        return str;
+    }
+    int u = -1;
+    while(v >= 1024 && u < 3) {
+        v /= 1024;
+        u++;
+    }
+    sprintf(str, "%.1f%c", v, units[u]);
+    return str;
+}
+
+static void print_buffer(FILE * out, const char * prefix, struct buffer_t * buf) {
+    char held[16], peak[16], spilled[16], bytes[16];
+
+    fprintf(out, "%sbuffer: %s held, peak %s (%s spilled), %s through, full %.2fs, absorbed %.2fs\n",
+            prefix, human(held, buf->held), human(peak, buf->peak), human(spilled, buf->spill_peak),
+            human(bytes, buf->bytes), buf->full, buf->absorbed);
+}
+
+/*
+ * finish_buffer - The job is done: report its buffer stages and drop their
+ *     stats. Called from deletejob.
+ */
+void finish_buffer(struct job_t * job) {
+    char prefix[32];
+
+    snprintf(prefix, sizeof(prefix), "[%d] (%d) ", job->jid, (int)job->pgid);
+    for(struct buffer_t * buf = job->buf; buf != NULL; buf = buf->next) {
+        if(buf->started) {
+            print_buffer(in_group ? stderr : stdout, prefix, buf);   // a group's stdout is the pipeline's
+        }
+    }
+    close_buffer(job->buf);
+    job->buf = NULL;
+}
+
+/* list_buffer - Print a line per buffer stage of the job */
+void list_buffer(struct job_t * job) {
+    for(struct buffer_t * buf = job->buf; buf != NULL; buf = buf->next) {
+        if(buf->started) {
+            print_buffer(stdout, "    ", buf);
+        }
+    }
+}
+
+/***********************************************
+ * The stage
+ **********************************************/
+
+static struct buffer_t * stats;
+static bool splice_in = true;   /* stdin is a pipe, as far as we know */
+static bool splice_out = true;
+static char scratch[BUFFER_PIPE];
+
+static long long parse_size(const char * s) {
+    char * end;
+    long long size = strtoll(s, &end, 10);
+
+    switch(*end) {
+    case 'G': case 'g': size <<= 10;    // fall through
+    case 'M': case 'm': size <<= 10;    // fall through
+    case 'K': case 'k': size <<= 10;
+        end++;
+    }
+    return *end == '\0' && end != s ? size : -1;
+}
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* open_spill - An unlinked file for what doesn't fit in memory */
+static int open_spill() {
+    char path[MAXLINE];
+    const char * dir = getenv("TMPDIR");
+    if(dir == NULL || dir[0] == '\0')
+        dir = "/tmp";
+
+    int fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if(fd >= 0)
+        return fd;
+    snprintf(path, sizeof(path), "%s/tsh-buffer-XXXXXX", dir);
+    fd = mkostemp(path, O_CLOEXEC);
+    if(fd < 0) {
+        unix_error("buffer: spill file");
+    }
+    unlink(path);
+    return fd;
+}
+
+/*
+ * move_in - Move up to len bytes from stdin to fd at off. Return the bytes
+ *     moved, 0 at the end of the input, -1 if there is nothing to read now.
+ */
+static ssize_t move_in(int fd, off_t off, size_t len) {
+    if(splice_in) {
+        loff_t pos = off;
+        ssize_t n = splice(STDIN_FILENO, NULL, fd, &pos, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(n >= 0)
+            return n;
+        if(errno != EINVAL)
+            return errno == EAGAIN || errno == EINTR ? -1 : 0;
+        splice_in = false;
+    }
+
+    ssize_t n = read(STDIN_FILENO, scratch, len < sizeof(scratch) ? len : sizeof(scratch));
+    if(n < 0)
+        return errno == EAGAIN || errno == EINTR ? -1 : 0;
+    for(ssize_t done = 0; done < n; ) {
+        ssize_t w = pwrite(fd, scratch + done, n - done, off + done);
+        if(w < 0) {
+            unix_error("buffer: write");
+        }
+        done += w;
+    }
+    return n;
+}
+
+/*
+ * move_out - Move up to len bytes from fd at off to stdout. Return the
+ *     bytes moved, 0 if it can't take any now. A closed reader ends the
+ *     stage, as SIGPIPE would.
+ */
+static ssize_t move_out(int fd, off_t off, size_t len) {
+    if(splice_out) {
+        loff_t pos = off;
+        ssize_t n = splice(fd, &pos, STDOUT_FILENO, NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(n >= 0)
+            return n;
+        if(errno == EAGAIN || errno == EINTR)
+            return 0;
+        if(errno != EINVAL)
+            exit(128 + SIGPIPE);
+        splice_out = false;
+    }
+
+    ssize_t n = pread(fd, scratch, len < sizeof(scratch) ? len : sizeof(scratch), off);
+    if(n < 0) {
+        unix_error("buffer: read");
+    }
+    for(ssize_t done = 0; done < n; ) {
+        ssize_t w = write(STDOUT_FILENO, scratch + done, n - done);
+        if(w < 0 && errno == EINTR)
+            continue;
+        if(w < 0)
+            exit(128 + SIGPIPE);
+        done += w;
+    }
+    return n;
+}
+
+/* exec_buffer - Run a buffer stage, in its own process. Return its exit status. */
+int exec_buffer(struct cmd_t * cmd, struct buffer_t * buf) {
+    char ** argv = cmd->argv;
+    long long size = BUFFER_SIZE, mem = BUFFER_MEM;
+    int i;
+
+    for(i = 1; argv[i] != NULL; i++) {
+        if(strcmp(argv[i], "-m") == 0 && argv[i + 1] != NULL) {
+            mem = parse_size(argv[++i]);
+        } else if(argv[i][0] != '-' && argv[i + 1] == NULL) {
+            size = parse_size(argv[i]);
+        } else {
+            break;
+        }
+    }
+    if(argv[i] != NULL || size < 1 || mem < 1) {
+        print_error("usage: buffer [-m MEM] [SIZE]\n");
+        return 2;
+    }
+    if(mem > size) {
+        mem = size;
+    }
+
+    int ring = memfd_create("tsh-buffer", MFD_CLOEXEC);
+    if(ring < 0 || ftruncate(ring, mem) < 0) {
+        unix_error("buffer: memfd");
+    }
+    int spill = -1;
+
+    Signal(SIGPIPE, SIG_IGN);   // EPIPE ends the stage
+    stats = buf;
+    stats->size = size;
+    stats->mem = mem;
+    stats->started = true;
+
+    // the ring holds the oldest bytes, [tail, head), from its start; the spill file the rest
+    long long head = 0, tail = 0, touched = 0;
+    long long spill_head = 0, spill_tail = 0;
+    bool in_eof = false;
+    double last = now_sec();
+
+    for(;;) {
+        long long held = (head - tail) + (spill_head - spill_tail);
+        if(in_eof && held == 0)
+            break;
+
+        struct pollfd fds[2];
+        int nfds = 0, in_idx = -1, out_idx = -1;
+        if(!in_eof && held < size) {
+            fds[nfds].fd = STDIN_FILENO;
+            fds[nfds].events = POLLIN;
+            in_idx = nfds++;
+        }
+        if(held > 0) {
+            fds[nfds].fd = STDOUT_FILENO;
+            fds[nfds].events = POLLOUT;
+            out_idx = nfds++;
+        }
+        if(poll(fds, nfds, -1) < 0) {
+            if(errno == EINTR)
+                continue;
+            unix_error("buffer: poll");
+        }
+
+        // spliced bytes still in the pipe are pages of the ring or the spill file, not copies:
+        // they may not be written over, nor the ring started over, before they are read
+        int in_pipe = 0;
+        if(splice_out && ioctl(STDOUT_FILENO, FIONREAD, &in_pipe) < 0) {
+            in_pipe = 0;
+        }
+        if(in_pipe == 0 && head == tail && head > 0) {
+            // empty: start over from the start, give back the pages of a burst
+            head = tail = 0;
+            if(touched > BUFFER_KEEP) {
+                fallocate(ring, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, mem);
+                touched = 0;
+            }
+        }
+        if(in_pipe == 0 && spill_head == spill_tail && spill_head > 0) {
+            ftruncate(spill, 0);
+            spill_head = spill_tail = 0;
+        }
+
+        // the time since the last round was spent in the state held tells
+        double now = now_sec();
+        if(!in_eof && held >= size)
+            stats->full += now - last;
+        if(held > BUFFER_PIPE)
+            stats->absorbed += now - last;
+        last = now;
+
+        if(in_idx >= 0 && fds[in_idx].revents != 0) {
+            ssize_t n;
+            long long room = size - held < BUFFER_CHUNK ? size - held : BUFFER_CHUNK;
+            if(spill_head == spill_tail && head - tail + in_pipe < mem) {
+                // in order: only while nothing waits in the spill file
+                long long off = head % mem;
+                long long len = mem - (head - tail) - in_pipe;
+                if(len > mem - off)
+                    len = mem - off;
+                if(len > room)
+                    len = room;
+                n = move_in(ring, off, len);
+                if(n > 0) {
+                    head += n;
+                    if(head > touched)
+                        touched = head < mem ? head : mem;
+                }
+            } else {
+                if(spill < 0)
+                    spill = open_spill();
+                n = move_in(spill, spill_head, room);
+                if(n > 0) {
+                    spill_head += n;
+                    stats->spilled += n;
+                    if(spill_head - spill_tail > stats->spill_peak)
+                        stats->spill_peak = spill_head - spill_tail;
+                }
+            }
+            if(n == 0)
+                in_eof = true;
+            if(n > 0)
+                stats->bytes += n;
+        }
+
+        if(out_idx >= 0 && fds[out_idx].revents != 0) {
+            if((fds[out_idx].revents & POLLOUT) == 0)
+                exit(128 + SIGPIPE);    // the reader is gone
+
+            if(head > tail) {
+                long long off = tail % mem;
+                long long len = head - tail;
+                if(len > mem - off)
+                    len = mem - off;
+                if(len > BUFFER_CHUNK)
+                    len = BUFFER_CHUNK;
+                tail += move_out(ring, off, len);
+            } else {
+                long long len = spill_head - spill_tail < BUFFER_CHUNK ? spill_head - spill_tail : BUFFER_CHUNK;
+                spill_tail += move_out(spill, spill_tail, len);
+            }
+        }
+
+        held = (head - tail) + (spill_head - spill_tail);
+        stats->held = held;
+        if(held > stats->peak)
+            stats->peak = held;
+    }
+
+    stats->held = 0;
+    stats->done = true;
+    return 0;
+}
@@ -0,0 +1,240 @@
+#include "builtin.h"
+#include "tsh.h"
+#include "job.h"
+#include "var.h"
+#include "auth.h"
+#include "helper.h"
+#include "history.h"
+#include "joblog.h"
+#include "feed.h"
+#include "jtop.h"
+#include "coproc.h"
+#include "prefetch.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dlfcn.h>
+
+/***********************************************
+ * Core builtins
+ **********************************************/
+
+static int builtin_bgfg(char ** argv) {
+    do_bgfg(argv);
+    return last_status;
+}
+
+static int builtin_jobs(char ** argv) {
+    if(argv[1] != NULL) {
+        print_error("too many arguments\n");
+        return 1;
+    }
+    listjobs(jobs);
+    return 0;
+}
+
+static int builtin_adduser(char ** argv) {
+    add_user(argv);
+    return 0;
+}
+
+static int builtin_logout(char ** argv) {
+    if(check_suspend()) {
+        print_error("There are suspended jobs.\n");
+        return 1;
+    }
+    do_quit();
+    return 0;
+}
+
+static int builtin_quit(char ** argv) {
+    do_quit();
+    return 0;
+}
+
+static int builtin_export(char ** argv) {
+    do_export(argv);
+    return 0;
+}
+
+static int builtin_unset(char ** argv) {
+    do_unset(argv);
+    return 0;
+}
+
+static int builtin_set(char ** argv) {
+    list_vars(false);
+    return 0;
+}
+
+static int builtin_return(char ** argv) {
+    return argv[1] == NULL ? last_status : atoi(argv[1]);
+}
+
+/*
+ * The core table, indexed by core_hash. The multipliers were searched for
+ * so that these names don't collide; adding a builtin means finding new
+ * ones (or a bigger table) and moving the entries.
+ */
+static const struct builtin_t core[BUILTIN_HASH] = {
+    [0]  = {"prefetch", do_prefetch,     0},
+    [2]  = {"history",  do_history,      0},
+    [3]  = {"joblog",   do_joblog,       0},
+    [5]  = {"jobs",     builtin_jobs,    0},
+    [6]  = {"coread",   do_coread,       0},
+    [8]  = {"return",   builtin_return,  0},
+    [12] = {"jtop",     do_jtop,         0},
+    [13] = {"unset",    builtin_unset,   0},
+    [14] = {"export",   builtin_export,  0},
+    [15] = {"fg",       builtin_bgfg,    0},
+    [17] = {"enable",   do_enable,       0},
+    [18] = {"logout",   builtin_logout,  0},
+    [19] = {"set",      builtin_set,     0},
+    [24] = {"feed",     do_feed,         0},
+    [25] = {"adduser",  builtin_adduser, 0},
+    [26] = {"cowrite",  do_cowrite,      0},
+    [28] = {"quit",     builtin_quit,    0},
+    [31] = {"bg",       builtin_bgfg,    0},
+};
+
+static unsigned int core_hash(const char * name, int len) {
+    return ((unsigned char)name[0] * 28 + (unsigned char)name[len - 1] * 19 + len) % BUILTIN_HASH;
+}
+
+/***********************************************
+ * Plugins
+ **********************************************/
+
+struct plugin_t {           /* a builtin loaded with enable -f */
+    struct builtin_t builtin;
+    void * handle;          /* from dlopen, shared by the builtins of the same file */
+    char path[MAXLINE];
+};
+
+static struct plugin_t plugins[MAXPLUGINS];
+static int plugin_num = 0;
+
+static struct plugin_t * find_plugin(const char * name) {
+    for(int i = 0; i < plugin_num; i++) {
+        if(strcmp(plugins[i].builtin.name, name) == 0)
+            return &plugins[i];
+    }
+    return NULL;
+}
+
+/* find_builtin - The builtin called name, NULL if there is none */
+const struct builtin_t * find_builtin(const char * name) {
+    int len = strlen(name);
+
+    if(len > 0) {
+        const struct builtin_t * b = &core[core_hash(name, len)];
+        if(b->name != NULL && strcmp(b->name, name) == 0)
+            return b;
+    }
+
+    struct plugin_t * p = find_plugin(name);
+    return p != NULL ? &p->builtin : NULL;
+}
+
+/* is_pure_builtin - cmd is a plugin builtin that may run in a child of its own */
+bool is_pure_builtin(struct cmd_t * cmd) {
+    if(cmd->argv[0] == NULL || plugin_num == 0)
+        return false;
+
+    const struct builtin_t * b = find_builtin(cmd->argv[0]);
+    return b != NULL && (b->flags & TSH_BUILTIN_PURE);
+}
+
+/* is_plugin_builtin - name was loaded with enable -f */
+bool is_plugin_builtin(const char * name) {
+    return plugin_num > 0 && find_plugin(name) != NULL;
+}
+
+/* load_plugin - Register the builtin name of the shared object path */
+static int load_plugin(const char * path, const char * name) {
+    char symbol[MAXLINE];
+    char msg[MAXLINE * 2];
+
+    if(find_builtin(name) != NULL) {
+        snprintf(msg, sizeof(msg), "enable: %s: already a builtin\n", name);
+        print_error(msg);
+        return 1;
+    }
+    if(plugin_num == MAXPLUGINS) {
+        print_error("enable: too many plugin builtins\n");
+        return 1;
+    }
+
+    void * handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if(handle == NULL) {
+        snprintf(msg, sizeof(msg), "enable: %s\n", dlerror());
+        print_error(msg);
+        return 1;
+    }
+
+    snprintf(symbol, sizeof(symbol), "tsh_builtin_%s", name);
+    struct tsh_builtin * def = dlsym(handle, symbol);
+    if(def == NULL || def->abi != TSH_PLUGIN_ABI || def->run == NULL || def->name == NULL || strcmp(def->name, name) != 0) {
+        snprintf(msg, sizeof(msg), def == NULL ? "enable: %s: no %s\n" : "enable: %s: %s is not a builtin of this shell's ABI\n",
+                 path, symbol);
+        print_error(msg);
+        dlclose(handle);
+        return 1;
+    }
+
+    struct plugin_t * p = &plugins[plugin_num++];
+    p->builtin.name = def->name;
+    p->builtin.run = def->run;
+    p->builtin.flags = def->flags;
+    p->handle = handle;
+    snprintf(p->path, sizeof(p->path), "%s", path);
+    return 0;
+}
+
+/* unload_plugin - enable -d name: forget a plugin builtin */
+static int unload_plugin(const char * name) {
+    struct plugin_t * p = find_plugin(name);
+
+    if(p == NULL) {
+        char msg[MAXLINE];
+        snprintf(msg, sizeof(msg), "enable: %s: not a plugin builtin\n", name);
+        print_error(msg);
+        return 1;
+    }
+
+    void * handle = p->handle;
+    *p = plugins[--plugin_num];
+    dlclose(handle);    // dlopen counts references, other builtins of the file keep it loaded
+    return 0;
+}
+
+/* do_enable - enable [-f lib.so name... | -d name...]: load, unload or list builtins */
+int do_enable(char ** argv) {
+    int status = 0;
+
+    if(argv[1] == NULL) {
+        for(int i = 0; i < BUILTIN_HASH; i++) {
+            if(core[i].name != NULL)
+                printf("enable %s\n", core[i].name);
+        }
+        for(int i = 0; i < plugin_num; i++) {
+            printf("enable -f %s %s\n", plugins[i].path, plugins[i].builtin.name);
+        }
+        return 0;
+    }
+
+    if(strcmp(argv[1], "-f") == 0 && argv[2] != NULL && argv[3] != NULL) {
+        for(int i = 3; argv[i] != NULL; i++) {
+            status |= load_plugin(argv[2], argv[i]);
+        }
+    } else if(strcmp(argv[1], "-d") == 0 && argv[2] != NULL) {
+        for(int i = 2; argv[i] != NULL; i++) {
+            status |= unload_plugin(argv[i]);
+        }
+    } else {
+        print_error("usage: enable [-f lib.so name... | -d name...]\n");
+        status = 2;
+    }
+    return status;
+}
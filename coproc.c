@@ -0,0 +1,386 @@
+#define _GNU_SOURCE
+
+#include "coproc.h"
+#include "tsh.h"
+#include "job.h"
+#include "helper.h"
+#include "var.h"
+#include "fastpath.h"
+#include "builtin.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+
+static struct coproc_t coprocs[MAXJOBS];
+
+/* since - Seconds from start to now */
+static double since(const struct timespec * start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static struct coproc_t * find_coproc(const char * name) {
+    for(int i = 0; i < MAXJOBS; i++) {
+        if(coprocs[i].name[0] != '\0' && strcmp(coprocs[i].name, name) == 0)
+            return &coprocs[i];
+    }
+    return NULL;
+}
+
+/* drop - Forget a coprocess whose job is done */
+static void drop(struct coproc_t * c) {
+    close(c->fd);
+    free(c->buf);
+    memset(c, 0, sizeof(*c));
+}
+
+/*
+ * run_coproc - Run a pipeline whose first word is coproc: start it as a
+ *     background job connected to the shell, and register it
+ */
+int run_coproc(struct cmd_t * cmd, int cmd_num, char * cmdline) {
+    char msg[MAXLINE + 64];
+    char ** argv = cmd[0].argv;
+    const char * name = argv[1];
+    sigset_t mask, prev;
+
+    if(name == NULL || !is_valid_name(name, name + strlen(name)) || strlen(name) >= COPROC_NAME ||
+       (argv[2] == NULL && cmd_num == 1)) {
+        print_error("usage: coproc NAME cmd args\n");
+        return last_status = 2;
+    }
+
+    // the job list doesn't change until the coprocess is registered
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &prev);
+
+    struct coproc_t * c = find_coproc(name);
+    if(c != NULL && c->pgid != 0) {
+        sigprocmask(SIG_SETMASK, &prev, NULL);
+        snprintf(msg, sizeof(msg), "coproc: %s is already running\n", name);
+        print_error(msg);
+        return last_status = 1;
+    }
+    // a free slot, or else one whose job is done
+    for(int i = 0; i < MAXJOBS && c == NULL; i++) {
+        if(coprocs[i].name[0] == '\0')
+            c = &coprocs[i];
+    }
+    for(int i = 0; i < MAXJOBS && c == NULL; i++) {
+        if(coprocs[i].pgid == 0)
+            c = &coprocs[i];
+    }
+    if(c == NULL) {
+        sigprocmask(SIG_SETMASK, &prev, NULL);
+        print_error("coproc: too many coprocesses\n");
+        return last_status = 1;
+    }
+
+    // drop "coproc NAME"
+    int i = 0;
+    do {
+        argv[i] = argv[i + 2];
+    } while(argv[i++] != NULL);
+
+    // every stage must be a process of its own
+    int process_num = 0;
+    for(int k = 0; k < cmd_num; k++) {
+        set_is_builtin(&cmd[k]);
+        if(cmd[k].is_builtin && cmd[k].argv[0] != NULL && (is_fastpath(&cmd[k]) || is_pure_builtin(&cmd[k])))
+            cmd[k].is_builtin = false;
+        if(cmd[k].is_builtin) {
+            sigprocmask(SIG_SETMASK, &prev, NULL);
+            snprintf(msg, sizeof(msg), "coproc: %.64s runs in the shell, it can't be a coprocess\n",
+                     cmd[k].argv[0] != NULL ? cmd[k].argv[0] : "a redirection");
+            print_error(msg);
+            return last_status = 1;
+        }
+        process_num++;
+    }
+
+    int sv[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+        sigprocmask(SIG_SETMASK, &prev, NULL);
+        unix_error("socketpair");
+    }
+    int out = fcntl(sv[1], F_DUPFD_CLOEXEC, 0);
+    if(out < 0) {
+        unix_error("fcntl");
+    }
+
+    last_job_pgid = 0;
+    connect_next_pipeline(sv[1], out);     // closed by run_pipeline
+    run_pipeline(cmd, cmd_num, process_num, 1, cmdline);
+
+    struct job_t * job = last_job_pgid != 0 ? getjobpgid(jobs, last_job_pgid) : NULL;
+    if(job == NULL) {   // not started
+        close(sv[0]);
+        sigprocmask(SIG_SETMASK, &prev, NULL);
+        return last_status;
+    }
+
+    if(c->name[0] != '\0') {
+        drop(c);
+    }
+    strcpy(c->name, name);
+    c->pgid = job->pgid;
+    c->fd = sv[0];
+    clock_gettime(CLOCK_MONOTONIC, &c->started);
+
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+    return last_status;
+}
+
+/* send_all - Write len bytes to c. ctrl-c stops the wait for room. */
+static int send_all(struct coproc_t * c, const char * p, int len) {
+    while(len > 0) {
+        ssize_t n = send(c->fd, p, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(n > 0) {
+            p += n;
+            len -= n;
+            continue;
+        }
+        if(n < 0 && errno != EAGAIN && errno != EINTR)
+            return -1;
+
+        struct pollfd pfd = {c->fd, POLLOUT, 0};
+        if(poll(&pfd, 1, -1) < 0 && sigint_received) {
+            errno = EINTR;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* do_cowrite - cowrite NAME words... | cowrite -e NAME */
+int do_cowrite(char ** argv) {
+    char msg[MAXLINE + 64];
+    bool eof = argv[1] != NULL && strcmp(argv[1], "-e") == 0;
+    char ** words = argv + (eof ? 2 : 1);
+
+    if(words[0] == NULL || (eof && words[1] != NULL)) {
+        print_error("usage: cowrite NAME words... | cowrite -e NAME\n");
+        return 2;
+    }
+    struct coproc_t * c = find_coproc(words[0]);
+    if(c == NULL) {
+        snprintf(msg, sizeof(msg), "cowrite: %.64s: no such coprocess\n", words[0]);
+        print_error(msg);
+        return 1;
+    }
+    if(c->input_closed) {
+        snprintf(msg, sizeof(msg), "cowrite: %s: its input is closed\n", c->name);
+        print_error(msg);
+        return 1;
+    }
+    if(eof) {
+        shutdown(c->fd, SHUT_WR);
+        c->input_closed = true;
+        return 0;
+    }
+
+    int len = 1;
+    for(char ** w = words + 1; *w != NULL; w++) {
+        len += strlen(*w) + 1;
+    }
+    char * line = malloc(len);
+    if(line == NULL) {
+        unix_error("malloc");
+    }
+    len = 0;
+    for(char ** w = words + 1; *w != NULL; w++) {
+        len += sprintf(line + len, w == words + 1 ? "%s" : " %s", *w);
+    }
+    line[len++] = '\n';
+
+    int status = 0;
+    if(send_all(c, line, len) < 0) {
+        snprintf(msg, sizeof(msg), "cowrite: %s: %s\n", c->name, errno == EPIPE ? "it has exited" : strerror(errno));
+        print_error(msg);
+        status = 1;
+    } else {
+        for(int k = 0; k < len; k++) {
+            c->requests += line[k] == '\n';   // a word may hold a newline
+        }
+        c->bytes_out += len;
+        clock_gettime(CLOCK_MONOTONIC, &c->last_request);
+    }
+    free(line);
+    return status;
+}
+
+/*
+ * reply_end - If buf holds a whole reply (lines lines, or the lines up to
+ *     a line mark), return its length and set *next to where the one after
+ *     it starts. -1 otherwise.
+ */
+static int reply_end(const char * buf, int len, int lines, const char * mark, int * next) {
+    int mark_len = mark != NULL ? strlen(mark) : 0;
+    int st = 0;     /* of the current line */
+
+    for(int i = 0; i < len; i++) {
+        if(buf[i] != '\n')
+            continue;
+        if(mark != NULL) {
+            if(i - st == mark_len && memcmp(buf + st, mark, mark_len) == 0) {
+                *next = i + 1;
+                return st > 0 ? st - 1 : 0;
+            }
+        } else if(--lines == 0) {
+            *next = i + 1;
+            return i;
+        }
+        st = i + 1;
+    }
+    return -1;
+}
+
+/* do_coread - coread [-n N | -u MARK] [-t SECONDS] NAME [VAR] */
+int do_coread(char ** argv) {
+    char msg[MAXLINE + 64];
+    int lines = 1;
+    const char * mark = NULL;
+    double timeout = -1;
+    int i = 1;
+
+    for(; argv[i] != NULL && argv[i][0] == '-' && argv[i + 1] != NULL; i += 2) {
+        if(strcmp(argv[i], "-n") == 0 && atoi(argv[i + 1]) > 0) {
+            lines = atoi(argv[i + 1]);
+        } else if(strcmp(argv[i], "-u") == 0) {
+            mark = argv[i + 1];
+        } else if(strcmp(argv[i], "-t") == 0 && strtod(argv[i + 1], NULL) >= 0) {
+            timeout = strtod(argv[i + 1], NULL);
+        } else {
+            break;
+        }
+    }
+    const char * name = argv[i];
+    const char * var = name != NULL ? argv[i + 1] : NULL;
+    if(name == NULL || name[0] == '-' || (var != NULL && (argv[i + 2] != NULL || !is_valid_name(var, var + strlen(var))))) {
+        print_error("usage: coread [-n N | -u MARK] [-t SECONDS] NAME [VAR]\n");
+        return 2;
+    }
+
+    struct coproc_t * c = find_coproc(name);
+    if(c == NULL) {
+        snprintf(msg, sizeof(msg), "coread: %.64s: no such coprocess\n", name);
+        print_error(msg);
+        return 1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int len, next = 0, status = 0;
+    while((len = reply_end(c->buf, c->buf_len, lines, mark, &next)) < 0) {
+        if(c->output_closed) {
+            // the end of its output: what is left is the last reply
+            len = next = c->buf_len;
+            status = 1;
+            break;
+        }
+
+        int wait_ms = -1;
+        if(timeout >= 0) {
+            double left = timeout - since(&start);
+            if(left <= 0) {
+                snprintf(msg, sizeof(msg), "coread: %s: timed out\n", c->name);
+                print_error(msg);
+                return COPROC_TIMEOUT;
+            }
+            wait_ms = (int)(left * 1000) + 1;
+        }
+        struct pollfd pfd = {c->fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, wait_ms);
+        if(ready < 0 && sigint_received)
+            return 1;
+        if(ready <= 0)
+            continue;
+
+        if(c->buf_cap - c->buf_len < COPROC_BUF / 4) {
+            int cap = c->buf_cap == 0 ? COPROC_BUF : c->buf_cap * 2;
+            char * grown = realloc(c->buf, cap);
+            if(grown == NULL) {
+                unix_error("realloc");
+            }
+            c->buf = grown;
+            c->buf_cap = cap;
+        }
+        ssize_t n = read(c->fd, c->buf + c->buf_len, c->buf_cap - c->buf_len);
+        if(n > 0) {
+            c->buf_len += n;
+            c->bytes_in += n;
+        } else if(n == 0 || errno != EINTR) {
+            c->output_closed = true;
+        }
+    }
+
+    if(status == 0) {
+        double waited = since(&start);
+        c->replies += mark != NULL ? 1 : lines;
+        c->reads++;
+        c->wait_sum += waited;
+        if(waited > c->wait_max)
+            c->wait_max = waited;
+    }
+
+    if(var != NULL) {
+        char * value = malloc(len + 1);
+        if(value == NULL) {
+            unix_error("malloc");
+        }
+        memcpy(value, c->buf, len);
+        value[len] = '\0';
+        set_var(var, value, false);
+        free(value);
+    } else if(len > 0 || status == 0) {
+        fwrite(c->buf, 1, len, stdout);
+        fputc('\n', stdout);
+    }
+
+    c->buf_len -= next;
+    memmove(c->buf, c->buf + next, c->buf_len);
+    if(c->output_closed && c->pgid == 0 && c->buf_len == 0) {
+        drop(c);    // nothing more will come
+    }
+    return status;
+}
+
+/* coproc_job_done - The job of a coprocess is done. Called in the SIGCHLD handler: its output is still readable. */
+void coproc_job_done(struct job_t * job) {
+    for(int i = 0; i < MAXJOBS; i++) {
+        if(coprocs[i].name[0] != '\0' && coprocs[i].pgid == job->pgid)
+            coprocs[i].pgid = 0;
+    }
+}
+
+/* list_coproc - Under a job in jobs: its traffic and health, if it is a coprocess */
+void list_coproc(struct job_t * job) {
+    for(int i = 0; i < MAXJOBS; i++) {
+        struct coproc_t * c = &coprocs[i];
+        if(c->name[0] == '\0' || c->pgid != job->pgid)
+            continue;
+
+        double age = since(&c->started);
+        printf("    coproc %s: %lu requests, %lu replies (%.1f/s), %llu bytes out, %llu in", c->name,
+               c->requests, c->replies, age > 0 ? c->replies / age : 0, c->bytes_out, c->bytes_in);
+        if(c->reads > 0)
+            printf(", wait avg %.2fms max %.2fms", c->wait_sum * 1000 / c->reads, c->wait_max * 1000);
+        if(c->requests > c->replies)
+            printf(", %lu pending, last request %.1fs ago", c->requests - c->replies, since(&c->last_request));
+        if(c->input_closed)
+            printf(", input closed");
+        if(c->output_closed)
+            printf(", output closed");
+        printf("\n");
+    }
+}
@@ -0,0 +1,858 @@
+#define _GNU_SOURCE
+
+#include "fastpath.h"
+#include "tsh.h"
+#include "var.h"
+#include "helper.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+static const char * fastpath_names[] = {"echo", "printf", "true", "false", "test", "[", "cat", "tee", NULL};
+
+/*
+ * fastpath_name - If cmd names a utility we run in the shell (echo,
+ *     /bin/echo or /usr/bin/echo), return its name, otherwise NULL
+ */
+const char * fastpath_name(const char * cmd) {
+    const char * base = cmd;
+
+    if(strncmp(cmd, "/bin/", 5) == 0) {
+        base = cmd + 5;
+    } else if(strncmp(cmd, "/usr/bin/", 9) == 0) {
+        base = cmd + 9;
+    }
+
+    for(int i = 0; fastpath_names[i] != NULL; i++) {
+        if(strcmp(base, fastpath_names[i]) == 0)
+            return fastpath_names[i];
+    }
+    return NULL;
+}
+
+/*
+ * is_fastpath - The command can be run in the shell: it is one of our
+ *     utilities, TSH_FASTPATH isn't 0, and it doesn't use an option
+ *     we don't implement
+ */
+bool is_fastpath(struct cmd_t * cmd) {
+    char ** argv = cmd->argv;
+    const char * name;
+
+    if(argv[0] == NULL || (name = fastpath_name(argv[0])) == NULL)
+        return false;
+
+    char * opt = get_var("TSH_FASTPATH");
+    for(char ** a = cmd->assign_str; *a != NULL; a++) {
+        if(strncmp(*a, "TSH_FASTPATH=", 13) == 0)
+            opt = *a + 13;
+    }
+    if(opt != NULL && strcmp(opt, "0") == 0)
+        return false;
+
+    if(strcmp(name, "tee") == 0) {
+        for(int i = 1; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+            if(strcmp(argv[i], "-a") != 0 && strcmp(argv[i], "-s") != 0)
+                return false;   // -i, -p, ...
+        }
+        bool redirected = redirects(cmd, STDIN_FILENO);
+        if(!redirected && isatty(STDIN_FILENO))
+            return false;
+    }
+
+    if(strcmp(name, "cat") == 0) {
+        bool reads_stdin = argv[1] == NULL;
+        for(int i = 1; argv[i] != NULL; i++) {
+            if(strcmp(argv[i], "-") == 0) {
+                reads_stdin = true;
+            } else if(argv[i][0] == '-' && strcmp(argv[i], "-u") != 0) {
+                return false;   // -n, -A, ...
+            }
+        }
+
+        // ctrl-c couldn't stop a cat that waits for the terminal in the shell
+        bool redirected = redirects(cmd, STDIN_FILENO);
+        if(reads_stdin && !redirected && isatty(STDIN_FILENO))
+            return false;
+    }
+
+    return true;
+}
+
+/***********************************************
+ * echo and printf
+ **********************************************/
+
+/*
+ * put_escape - Print the backslash escape that starts at p (right after
+ *     the backslash) and return where it ends. Octal escapes are \0nnn
+ *     in echo and %b, \nnn in a printf format. *stop is set by \c.
+ */
+static const char * put_escape(const char * p, bool zero_octal, bool * stop) {
+    int c = 0, n;
+
+    switch(*p) {
+    case 'a':  c = '\a'; break;
+    case 'b':  c = '\b'; break;
+    case 'e':  c = '\033'; break;
+    case 'f':  c = '\f'; break;
+    case 'n':  c = '\n'; break;
+    case 'r':  c = '\r'; break;
+    case 't':  c = '\t'; break;
+    case 'v':  c = '\v'; break;
+    case '\\': c = '\\'; break;
+    case 'c':
+        *stop = true;
+        return p + 1;
+    case 'x':
+        for(n = 0; n < 2 && isxdigit((unsigned char)p[1]); n++, p++)
+            c = c * 16 + (isdigit((unsigned char)p[1]) ? p[1] - '0' : tolower((unsigned char)p[1]) - 'a' + 10);
+        if(n == 0) {
+            fputs("\\x", stdout);
+            return p + 1;
+        }
+        break;
+    case '\0':
+        putchar('\\');
+        return p;
+    default:
+        if(*p < '0' || *p > '7' || (zero_octal && *p != '0')) {
+            putchar('\\');
+            putchar(*p);
+            return p + 1;
+        }
+        if(zero_octal) {
+            p++;
+        }
+        for(n = 0; n < 3 && *p >= '0' && *p <= '7'; n++, p++)
+            c = c * 8 + *p - '0';
+        putchar(c);
+        return p;
+    }
+
+    putchar(c);
+    return p + 1;
+}
+
+/* put_escaped - Print s with escapes, return false if \c stops the output */
+static bool put_escaped(const char * s) {
+    bool stop = false;
+
+    while(*s && !stop) {
+        if(*s == '\\') {
+            s = put_escape(s + 1, true, &stop);
+        } else {
+            putchar(*s++);
+        }
+    }
+    return !stop;
+}
+
+/* echo [-neE] [arg ...] */
+static int do_echo(char ** argv) {
+    bool newline = true, escapes = false;
+    int i = 1;
+
+    for(; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'
+          && strspn(argv[i] + 1, "neE") == strlen(argv[i] + 1); i++) {
+        for(char * c = argv[i] + 1; *c; c++) {
+            if(*c == 'n')
+                newline = false;
+            else
+                escapes = (*c == 'e');
+        }
+    }
+
+    for(int first = i; argv[i] != NULL; i++) {
+        if(i > first)
+            putchar(' ');
+        if(!escapes) {
+            fputs(argv[i], stdout);
+        } else if(!put_escaped(argv[i])) {
+            return 0;   // \c: no more output, not even the newline
+        }
+    }
+    if(newline)
+        putchar('\n');
+    return 0;
+}
+
+/* printf_number - Convert a printf argument: 12, 0x1f, 017 or 'c (the code of c) */
+static long printf_number(const char * arg, int * status) {
+    char * end;
+
+    if(arg == NULL)
+        return 0;
+    if(arg[0] == '\'' || arg[0] == '"')
+        return (unsigned char)arg[1];
+
+    errno = 0;
+    long v = strtol(arg, &end, 0);
+    if(end == arg || *end != '\0' || errno != 0) {
+        char msg[MAXLINE + 50];
+        snprintf(msg, sizeof(msg), "printf: '%s': expected a numeric value\n", arg);
+        print_error(msg);
+        *status = 1;
+    }
+    return v;
+}
+
+/* printf format [arg ...], the format is reused while arguments remain */
+static int do_printf(char ** argv) {
+    int status = 0;
+    bool stop = false;
+    bool consumed;
+
+    if(argv[1] == NULL) {
+        print_error("printf: missing operand\n");
+        return 1;
+    }
+    const char * fmt = argv[1];
+    char ** args = argv + 2;
+
+    do {
+        consumed = false;
+        for(const char * p = fmt; *p && !stop; ) {
+            if(*p == '\\') {
+                p = put_escape(p + 1, false, &stop);
+                continue;
+            }
+            if(*p != '%') {
+                putchar(*p++);
+                continue;
+            }
+            if(p[1] == '%') {
+                putchar('%');
+                p += 2;
+                continue;
+            }
+
+            // %[flags][width][.precision]conversion
+            char spec[40];
+            int n = 0;
+            spec[n++] = *p++;
+            while(*p && strchr("-+ #0", *p) != NULL && n < 8)
+                spec[n++] = *p++;
+            while(isdigit((unsigned char)*p) && n < 20)
+                spec[n++] = *p++;
+            if(*p == '.') {
+                spec[n++] = *p++;
+                while(isdigit((unsigned char)*p) && n < 32)
+                    spec[n++] = *p++;
+            }
+
+            char conv = *p;
+            if(conv == '\0') {
+                print_error("printf: missing format character\n");
+                return 1;
+            }
+            p++;
+
+            const char * arg = NULL;
+            if(*args != NULL) {
+                arg = *args++;
+                consumed = true;
+            }
+
+            switch(conv) {
+            case 'd': case 'i':
+                spec[n++] = 'l';
+                spec[n++] = 'd';
+                spec[n] = '\0';
+                printf(spec, printf_number(arg, &status));
+                break;
+            case 'u': case 'o': case 'x': case 'X':
+                spec[n++] = 'l';
+                spec[n++] = conv;
+                spec[n] = '\0';
+                printf(spec, (unsigned long)printf_number(arg, &status));
+                break;
+            case 'e': case 'E': case 'f': case 'F': case 'g': case 'G':
+                spec[n++] = conv;
+                spec[n] = '\0';
+                printf(spec, arg == NULL ? 0.0 : strtod(arg, NULL));
+                break;
+            case 'c':
+                spec[n++] = 'c';
+                spec[n] = '\0';
+                if(arg != NULL && arg[0] != '\0')
+                    printf(spec, arg[0]);
+                break;
+            case 's':
+                spec[n++] = 's';
+                spec[n] = '\0';
+                printf(spec, arg == NULL ? "" : arg);
+                break;
+            case 'b':
+                if(arg != NULL && !put_escaped(arg))
+                    stop = true;
+                break;
+            default: {
+                char msg[50];
+                sprintf(msg, "printf: %%%c: invalid conversion\n", conv);
+                print_error(msg);
+                return 1;
+            }
+            }
+        }
+    } while(!stop && consumed && *args != NULL);
+
+    return status;
+}
+
+/***********************************************
+ * test and [
+ **********************************************/
+
+struct test_t {
+    char ** argv;           /* the operands */
+    int argc;
+    int pos;
+    bool error;
+    bool reported;          /* the error message has been printed */
+};
+
+static bool test_or(struct test_t * t);
+
+static bool is_binop(const char * s) {
+    static const char * binops[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+                                    "-nt", "-ot", "-ef", NULL};
+    for(int i = 0; binops[i] != NULL; i++) {
+        if(strcmp(s, binops[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+static long test_number(struct test_t * t, const char * s) {
+    char * end;
+
+    errno = 0;
+    long v = strtol(s, &end, 10);
+    while(isspace((unsigned char)*end))
+        end++;
+    if(end == s || *end != '\0' || errno != 0) {
+        char msg[MAXLINE + 50];
+        snprintf(msg, sizeof(msg), "test: %s: integer expression expected\n", s);
+        print_error(msg);
+        t->error = true;
+        t->reported = true;
+    }
+    return v;
+}
+
+static bool test_binary(struct test_t * t, const char * a, const char * op, const char * b) {
+    struct stat sa, sb;
+
+    if(strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+        return strcmp(a, b) == 0;
+    if(strcmp(op, "!=") == 0)
+        return strcmp(a, b) != 0;
+    if(strcmp(op, "<") == 0)
+        return strcmp(a, b) < 0;
+    if(strcmp(op, ">") == 0)
+        return strcmp(a, b) > 0;
+
+    if(strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0) {
+        bool has_a = stat(a, &sa) == 0, has_b = stat(b, &sb) == 0;
+        if(op[1] == 'e')
+            return has_a && has_b && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+        if(op[1] == 'n')
+            return has_a && (!has_b || sa.st_mtim.tv_sec > sb.st_mtim.tv_sec ||
+                   (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec && sa.st_mtim.tv_nsec > sb.st_mtim.tv_nsec));
+        return has_b && (!has_a || sa.st_mtim.tv_sec < sb.st_mtim.tv_sec ||
+               (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec && sa.st_mtim.tv_nsec < sb.st_mtim.tv_nsec));
+    }
+
+    long x = test_number(t, a), y = test_number(t, b);
+    if(strcmp(op, "-eq") == 0) return x == y;
+    if(strcmp(op, "-ne") == 0) return x != y;
+    if(strcmp(op, "-lt") == 0) return x < y;
+    if(strcmp(op, "-le") == 0) return x <= y;
+    if(strcmp(op, "-gt") == 0) return x > y;
+    return x >= y;
+}
+
+static bool test_unary(char op, const char * s) {
+    struct stat st;
+
+    switch(op) {
+    case 'z': return s[0] == '\0';
+    case 'n': return s[0] != '\0';
+    case 't': return isatty(builtin_fd(atoi(s)));
+    case 'r': return access(s, R_OK) == 0;
+    case 'w': return access(s, W_OK) == 0;
+    case 'x': return access(s, X_OK) == 0;
+    case 'L':
+    case 'h': return lstat(s, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+
+    if(stat(s, &st) != 0)
+        return false;
+    switch(op) {
+    case 'e': return true;
+    case 'f': return S_ISREG(st.st_mode);
+    case 'd': return S_ISDIR(st.st_mode);
+    case 's': return st.st_size > 0;
+    case 'p': return S_ISFIFO(st.st_mode);
+    case 'S': return S_ISSOCK(st.st_mode);
+    case 'b': return S_ISBLK(st.st_mode);
+    case 'c': return S_ISCHR(st.st_mode);
+    case 'g': return (st.st_mode & S_ISGID) != 0;
+    case 'u': return (st.st_mode & S_ISUID) != 0;
+    case 'k': return (st.st_mode & S_ISVTX) != 0;
+    }
+    return false;
+}
+
+/* ( expr ), unary, binary or a lone string */
+static bool test_primary(struct test_t * t) {
+    if(t->pos >= t->argc) {
+        t->error = true;
+        return false;
+    }
+
+    char ** argv = t->argv + t->pos;
+    int left = t->argc - t->pos;
+
+    if(left >= 3 && is_binop(argv[1])) {
+        t->pos += 3;
+        return test_binary(t, argv[0], argv[1], argv[2]);
+    }
+    if(left >= 2 && strcmp(argv[0], "(") == 0) {
+        t->pos++;
+        bool v = test_or(t);
+        if(t->pos >= t->argc || strcmp(t->argv[t->pos], ")") != 0) {
+            t->error = true;
+            return false;
+        }
+        t->pos++;
+        return v;
+    }
+    if(left >= 2 && argv[0][0] == '-' && argv[0][1] != '\0' && argv[0][2] == '\0'
+       && strchr("zntrwxLhefdspSbcguk", argv[0][1]) != NULL) {
+        t->pos += 2;
+        return test_unary(argv[0][1], argv[1]);
+    }
+
+    t->pos++;
+    return argv[0][0] != '\0';
+}
+
+static bool test_not(struct test_t * t) {
+    if(t->pos + 1 < t->argc && strcmp(t->argv[t->pos], "!") == 0) {
+        t->pos++;
+        return !test_not(t);
+    }
+    return test_primary(t);
+}
+
+static bool test_and(struct test_t * t) {
+    bool v = test_not(t);
+    while(!t->error && t->pos < t->argc && strcmp(t->argv[t->pos], "-a") == 0) {
+        t->pos++;
+        v = test_not(t) && v;
+    }
+    return v;
+}
+
+static bool test_or(struct test_t * t) {
+    bool v = test_and(t);
+    while(!t->error && t->pos < t->argc && strcmp(t->argv[t->pos], "-o") == 0) {
+        t->pos++;
+        v = test_and(t) || v;
+    }
+    return v;
+}
+
+/* test expr, [ expr ]: 0 if true, 1 if false, 2 on error */
+static int do_test(char ** argv, bool bracket) {
+    struct test_t t;
+
+    t.argv = argv + 1;
+    t.argc = 0;
+    t.pos = 0;
+    t.error = false;
+    t.reported = false;
+    while(t.argv[t.argc] != NULL)
+        t.argc++;
+
+    if(bracket) {
+        if(t.argc == 0 || strcmp(t.argv[t.argc - 1], "]") != 0) {
+            print_error("[: missing ']'\n");
+            return 2;
+        }
+        t.argc--;
+    }
+    if(t.argc == 0)
+        return 1;
+
+    bool v = test_or(&t);
+    if(!t.error && t.pos != t.argc) {
+        t.error = true;
+    }
+    if(t.error) {
+        if(!t.reported)
+            print_error("test: syntax error\n");
+        return 2;
+    }
+    return v ? 0 : 1;
+}
+
+/***********************************************
+ * cat
+ **********************************************/
+
+/* copy_chunk - Copy up to one buffer from in to out with read and write */
+static ssize_t copy_chunk(int in, int out) {
+    static char buf[1 << 16];
+
+    ssize_t n = read(in, buf, sizeof(buf));
+    for(ssize_t done = 0; done < n; ) {
+        ssize_t w = write(out, buf + done, n - done);
+        if(w < 0) {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        done += w;
+    }
+    return n;
+}
+
+/*
+ * copy_fd - Copy in to out until end of file. The data stays in the
+ *     kernel: sendfile from a regular file, splice when one end is a pipe,
+ *     and read/write only for what is left (e.g. terminal to file).
+ */
+int copy_fd(int in, int out) {
+    struct stat st;
+    int mode = fstat(in, &st) == 0 && S_ISREG(st.st_mode) ? 0 : 1;    /* 0: sendfile, 1: splice, 2: read/write */
+
+    while(!sigint_received) {
+        ssize_t n;
+
+        if(mode == 0) {
+            n = sendfile(out, in, NULL, FASTPATH_CHUNK);
+        } else if(mode == 1) {
+            n = splice(in, NULL, out, NULL, FASTPATH_CHUNK, SPLICE_F_MOVE);
+        } else {
+            n = copy_chunk(in, out);
+        }
+
+        if(n == 0)
+            return 0;
+        if(n > 0)
+            continue;
+        if(errno == EINTR)
+            continue;
+        if(mode < 2 && (errno == EINVAL || errno == ENOSYS)) {
+            mode++;     // the kernel can't do it for these files, nothing was copied
+            continue;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/* cat [-u] [file ...], - is stdin */
+static int do_cat(char ** argv) {
+    int status = 0;
+    bool any = false;
+
+    fflush(stdout);
+
+    for(int i = 1; argv[i] != NULL || !any; i++) {
+        const char * path = argv[i] != NULL ? argv[i] : "-";
+        if(strcmp(path, "-u") == 0)
+            continue;
+        any = true;
+
+        bool is_stdin = strcmp(path, "-") == 0;
+        int fd = is_stdin ? builtin_fd(STDIN_FILENO) : open(path, O_RDONLY | O_CLOEXEC);
+        if(fd < 0 || copy_fd(fd, builtin_fd(STDOUT_FILENO)) < 0) {
+            if(errno == EPIPE) {    // the reader is gone, like being killed by SIGPIPE
+                if(!is_stdin && fd >= 0)
+                    close(fd);
+                return 128 + SIGPIPE;
+            }
+            char msg[MAXLINE + 100];
+            snprintf(msg, sizeof(msg), "cat: %s: %s\n", path, strerror(errno));
+            print_error(msg);
+            status = 1;
+        }
+        if(!is_stdin && fd >= 0)
+            close(fd);
+        if(argv[i] == NULL)
+            break;
+    }
+
+    return status;
+}
+
+/***********************************************
+ * tee
+ **********************************************/
+
+struct tee_out_t {          /* an output of tee */
+    const char * name;      /* file name, or "stdout" */
+    int fd;                 /* -1 once it failed */
+    int stage[2];           /* holds the round's data until the output takes it */
+    size_t pending;         /* bytes of the round still in stage */
+    long long bytes;
+    long stalls;            /* times it was full when the round had data for it */
+    double stalled;         /* seconds spent waiting for it */
+    struct timespec since;  /* start of the current stall */
+    bool blocked;
+};
+
+static double seconds_since(struct timespec * t) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - t->tv_sec) + (now.tv_nsec - t->tv_nsec) / 1e9;
+}
+
+/* tee_error - Report a failed output on stderr: stdout carries the data */
+static void tee_error(struct tee_out_t * out, int * status) {
+    fprintf(stderr, "tee: %s: %s\n", out->name, strerror(errno));
+    out->fd = -1;
+    *status = 1;
+}
+
+/* tee_copy - The outputs are not all pipes or files: read once, write to each */
+static int tee_copy(struct tee_out_t * outs, int num) {
+    static char buf[1 << 16];
+    int status = 0;
+    ssize_t n;
+
+    while(!sigint_received && (n = read(builtin_fd(STDIN_FILENO), buf, sizeof(buf))) != 0) {
+        if(n < 0) {
+            if(errno == EINTR)
+                continue;
+            return 1;
+        }
+        for(int i = 0; i < num; i++) {
+            for(ssize_t done = 0; outs[i].fd >= 0 && done < n; ) {
+                ssize_t w = write(outs[i].fd, buf + done, n - done);
+                if(w < 0 && errno == EINTR)
+                    continue;
+                if(w < 0 && errno == EPIPE && i == 0)
+                    return 128 + SIGPIPE;
+                if(w < 0) {
+                    tee_error(&outs[i], &status);
+                    break;
+                }
+                done += w;
+                outs[i].bytes += w;
+            }
+        }
+    }
+    return status;
+}
+
+/*
+ * tee_splice - Each round, duplicate what stdin holds into the stage pipe
+ *     of every output with tee(2), drop it from stdin by splicing it to
+ *     /dev/null, then splice the stages to the outputs. The bytes never
+ *     leave the kernel; a round ends when the slowest output has its copy.
+ */
+static int tee_splice(struct tee_out_t * outs, int num) {
+    struct pollfd fds[MAXARGS];
+    int status = 0;
+    int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    int size = fcntl(builtin_fd(STDIN_FILENO), F_GETPIPE_SZ);
+
+    if(null_fd < 0)
+        return tee_copy(outs, num);
+    for(int i = 0; i < num; i++) {
+        if(pipe2(outs[i].stage, O_CLOEXEC) < 0) {
+            close(null_fd);
+            return tee_copy(outs, num);
+        }
+        // an empty stage as large as stdin takes all of what tee gives the first one
+        if(size > 0)
+            fcntl(outs[i].stage[1], F_SETPIPE_SZ, size);
+    }
+
+    while(!sigint_received) {
+        ssize_t n = -1;
+        for(int i = 0; i < num && n != 0; i++) {
+            ssize_t m = tee(builtin_fd(STDIN_FILENO), outs[i].stage[1], i == 0 ? FASTPATH_CHUNK : (size_t)n, 0);
+            if(m < 0 && errno == EINTR) {
+                i--;
+                continue;
+            }
+            if(m < 0 || (i > 0 && m != n)) {
+                fprintf(stderr, "tee: tee(2): %s\n", strerror(errno));
+                status = 1;
+                goto done;
+            }
+            n = m;
+            outs[i].pending = n;
+        }
+        if(n == 0)
+            break;  // end of input
+
+        for(ssize_t left = n; left > 0; ) {
+            ssize_t m = splice(builtin_fd(STDIN_FILENO), NULL, null_fd, NULL, left, 0);
+            if(m < 0 && errno != EINTR) {
+                status = 1;
+                goto done;
+            }
+            if(m > 0)
+                left -= m;
+        }
+
+        for(;;) {
+            int nfds = 0;
+            for(int i = 0; i < num; i++) {
+                struct tee_out_t * out = &outs[i];
+                while(out->pending > 0 && out->fd >= 0) {
+                    ssize_t m = splice(out->stage[0], NULL, out->fd, NULL, out->pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                    if(m > 0) {
+                        out->pending -= m;
+                        out->bytes += m;
+                        if(out->blocked) {
+                            out->stalled += seconds_since(&out->since);
+                            out->blocked = false;
+                        }
+                    } else if(m < 0 && errno == EAGAIN) {
+                        if(!out->blocked) {
+                            out->stalls++;
+                            out->blocked = true;
+                            clock_gettime(CLOCK_MONOTONIC, &out->since);
+                        }
+                        fds[nfds].fd = out->fd;
+                        fds[nfds++].events = POLLOUT;
+                        break;
+                    } else if(m < 0 && errno == EINTR) {
+                        continue;
+                    } else if(m < 0 && errno == EPIPE && i == 0) {
+                        status = 128 + SIGPIPE;     // like being killed by SIGPIPE
+                        goto done;
+                    } else {
+                        tee_error(out, &status);
+                    }
+                }
+                if(out->fd < 0 && out->pending > 0) {   // drop what the failed output won't take
+                    splice(out->stage[0], NULL, null_fd, NULL, out->pending, 0);
+                    out->pending = 0;
+                }
+            }
+            if(nfds == 0)
+                break;
+            if(poll(fds, nfds, -1) < 0 && errno != EINTR)
+                break;
+            if(sigint_received)
+                goto done;
+        }
+    }
+
+done:
+    for(int i = 0; i < num; i++) {
+        close(outs[i].stage[0]);
+        close(outs[i].stage[1]);
+    }
+    close(null_fd);
+    return status;
+}
+
+/* tee [-a] [-s] [file ...]: -s reports bytes, throughput and stalls of each output on stderr */
+static int do_tee(char ** argv) {
+    struct tee_out_t outs[MAXARGS];
+    int num = 0, status = 0, i;
+    bool append = false, report = false;
+    struct timespec start;
+    struct stat st;
+
+    for(i = 1; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        append |= strcmp(argv[i], "-a") == 0;
+        report |= strcmp(argv[i], "-s") == 0;
+    }
+
+    fflush(stdout);
+    memset(outs, 0, sizeof(outs));
+    outs[num].name = "stdout";
+    outs[num++].fd = builtin_fd(STDOUT_FILENO);
+    for(; argv[i] != NULL; i++) {
+        outs[num].name = argv[i];
+        // not O_APPEND, which splice refuses: -a starts at the end instead
+        outs[num].fd = open(argv[i], O_WRONLY | O_CREAT | O_CLOEXEC | (append ? 0 : O_TRUNC), 0666);
+        if(outs[num].fd < 0 || (append && lseek(outs[num].fd, 0, SEEK_END) < 0)) {
+            tee_error(&outs[num], &status);
+            continue;
+        }
+        num++;
+    }
+
+    // tee(2) needs stdin to be a pipe, splice the outputs to be pipes or files
+    bool zero_copy = fstat(builtin_fd(STDIN_FILENO), &st) == 0 && S_ISFIFO(st.st_mode);
+    for(int j = 0; j < num && zero_copy; j++) {
+        zero_copy = fstat(outs[j].fd, &st) == 0 && (S_ISFIFO(st.st_mode) || S_ISREG(st.st_mode));
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int result = zero_copy ? tee_splice(outs, num) : tee_copy(outs, num);
+    if(result != 0) {
+        status = result;
+    }
+    double elapsed = seconds_since(&start);
+
+    for(int j = 0; j < num; j++) {
+        if(report) {
+            fprintf(stderr, "tee: %s: %lld bytes, %.1f MB/s, %ld stalls (%.3fs)%s\n", outs[j].name, outs[j].bytes,
+                    elapsed > 0 ? outs[j].bytes / 1048576.0 / elapsed : 0.0, outs[j].stalls, outs[j].stalled,
+                    zero_copy ? "" : ", copied");
+        }
+        if(j > 0 && outs[j].fd >= 0) {
+            close(outs[j].fd);
+        }
+    }
+    return status;
+}
+
+/*
+ * exec_fastpath - Run utility argv[0] in the current process and return its
+ *     exit status. SIGPIPE is ignored meanwhile, a closed reader must not
+ *     kill the shell.
+ */
+int exec_fastpath(char ** argv) {
+    const char * name = fastpath_name(argv[0]);
+    int status = 0;
+
+    handler_t * old = Signal(SIGPIPE, SIG_IGN);
+
+    if(strcmp(name, "echo") == 0) {
+        status = do_echo(argv);
+    } else if(strcmp(name, "printf") == 0) {
+        status = do_printf(argv);
+    } else if(strcmp(name, "true") == 0) {
+        status = 0;
+    } else if(strcmp(name, "false") == 0) {
+        status = 1;
+    } else if(strcmp(name, "test") == 0) {
+        status = do_test(argv, false);
+    } else if(strcmp(name, "[") == 0) {
+        status = do_test(argv, true);
+    } else if(strcmp(name, "cat") == 0) {
+        status = do_cat(argv);
+    } else if(strcmp(name, "tee") == 0) {
+        status = do_tee(argv);
+    }
+
+    if(fflush(stdout) != 0) {
+        clearerr(stdout);
+    }
+    Signal(SIGPIPE, old);
+
+    return status;
+}
@@ -0,0 +1,211 @@
+#define _GNU_SOURCE
+
+#include "feed.h"
+#include "record.h"
+#include "job.h"
+#include "tsh.h"
+#include "var.h"
+#include "helper.h"
+#include "group.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+struct sub_t {              /* a subscriber */
+    int fd;
+    int len;                /* bytes queued */
+    char pending[FEED_BACKLOG];
+};
+
+static int feed_fd = -1;                    /* listening socket, -1 if off */
+static char feed_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static struct sub_t subs[FEED_MAXSUBS];
+static int sub_num = 0;
+
+static const char * state_name(int state) {
+    switch(state) {
+    case FG:   return "FG";
+    case BG:   return "BG";
+    case ST:   return "ST";
+    case WT:   return "WT";
+    case DONE: return "done";
+    default:   return "none";
+    }
+}
+
+static void drop_sub(int i) {
+    close(subs[i].fd);
+    subs[i] = subs[--sub_num];
+}
+
+/* accept_subs - Take in the clients that connected since the last event */
+static void accept_subs() {
+    int fd;
+
+    while((fd = accept4(feed_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        if(sub_num == FEED_MAXSUBS) {
+            close(fd);
+            continue;
+        }
+        subs[sub_num].fd = fd;
+        subs[sub_num].len = 0;
+        sub_num++;
+    }
+}
+
+/* flush_sub - Send what is queued for subscriber i, without waiting. Return false if it is gone. */
+static bool flush_sub(int i) {
+    struct sub_t * sub = &subs[i];
+
+    while(sub->len > 0) {
+        ssize_t n = send(sub->fd, sub->pending, sub->len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if(n > 0) {
+            memmove(sub->pending, sub->pending + n, sub->len - n);
+            sub->len -= n;
+        } else if(n < 0 && errno == EINTR) {
+            continue;
+        } else if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * publish_job - Send a state change of job to all subscribers. Called
+ *     with signals blocked (the job list is changed with signals blocked).
+ */
+void publish_job(struct job_t * job, int old_state, int new_state) {
+    char line[256];
+    char status[16];
+    struct timespec ts;
+
+    if(in_group)    // a job of a group's child, not of the shell
+        return;
+    record_job(job, state_name(old_state), state_name(new_state));
+    if(feed_fd < 0)
+        return;
+    accept_subs();
+    if(sub_num == 0)
+        return;
+
+    if(new_state == DONE) {
+        sprintf(status, "%d", job->status);
+    } else {
+        strcpy(status, "null");
+    }
+    clock_gettime(CLOCK_REALTIME, &ts);
+    int len = snprintf(line, sizeof(line), "{\"jid\":%d,\"pgid\":%d,\"old\":\"%s\",\"new\":\"%s\",\"time\":%ld.%06ld,\"status\":%s}\n",
+                       job->jid, (int)job->pgid, state_name(old_state), state_name(new_state),
+                       (long)ts.tv_sec, ts.tv_nsec / 1000, status);
+
+    for(int i = sub_num - 1; i >= 0; i--) {
+        struct sub_t * sub = &subs[i];
+
+        if(sub->len + len > FEED_BACKLOG) {     // too slow, never make the shell wait for it
+            drop_sub(i);
+            continue;
+        }
+        memcpy(sub->pending + sub->len, line, len);
+        sub->len += len;
+
+        if(!flush_sub(i)) {
+            drop_sub(i);
+        }
+    }
+}
+
+/* open_feed - Publish job state changes on a Unix socket at path */
+int open_feed(const char * path) {
+    struct sockaddr_un addr;
+    struct stat st;
+
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        print_error("feed: path too long\n");
+        return 1;
+    }
+    close_feed();
+
+    // a socket left behind by a shell that didn't quit cleanly
+    if(lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, FEED_MAXSUBS) < 0) {
+        char msg[MAXLINE];
+        snprintf(msg, sizeof(msg), "feed: %s: %s\n", path, strerror(errno));
+        print_error(msg);
+        if(fd >= 0)
+            close(fd);
+        return 1;
+    }
+
+    feed_fd = fd;
+    strcpy(feed_path, path);
+    return 0;
+}
+
+/* close_feed - Stop publishing, disconnect all subscribers */
+void close_feed() {
+    if(feed_fd < 0)
+        return;
+
+    while(sub_num > 0)
+        drop_sub(sub_num - 1);
+    close(feed_fd);
+    unlink(feed_path);
+    feed_fd = -1;
+}
+
+/* init_feed - Open the feed named by TSH_FEED in the environment, if any */
+void init_feed() {
+    char * path = get_var("TSH_FEED");
+
+    if(path != NULL && path[0] != '\0') {
+        open_feed(path);
+    }
+}
+
+/* do_feed - feed [PATH | off]: start, stop or show the job state feed */
+int do_feed(char ** argv) {
+    sigset_t mask_all, prev;
+    int status = 0;
+
+    if(argv[1] != NULL && argv[2] != NULL) {
+        print_error("too many arguments\n");
+        return 1;
+    }
+
+    sigfillset(&mask_all);
+    sigprocmask(SIG_BLOCK, &mask_all, &prev);
+
+    if(argv[1] == NULL) {
+        if(feed_fd < 0) {
+            printf("feed: off\n");
+        } else {
+            accept_subs();
+            printf("feed: %s (%d subscribers)\n", feed_path, sub_num);
+        }
+    } else if(strcmp(argv[1], "off") == 0) {
+        close_feed();
+    } else {
+        status = open_feed(argv[1]);
+    }
+
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+    return status;
+}
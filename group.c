@@ -0,0 +1,117 @@
+#define _GNU_SOURCE
+
+#include "group.h"
+#include "tsh.h"
+#include "job.h"
+#include "script.h"
+#include "redir.h"
+#include "var.h"
+#include "procsub.h"
+#include "parallel.h"
+#include "buffer.h"
+#include "journal.h"
+#include "prefetch.h"
+#include "helper.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+
+bool in_group = false;
+
+/*
+ * group_end - Where the group word starts with ends: past the ')' that
+ *     matches its '(', or the '}' that matches its '{' (a word of its
+ *     own, after ';', '&' or a newline). NULL if word doesn't start a
+ *     group or the end is missing.
+ */
+const char * group_end(const char * word) {
+    const char * last = word;   /* the last character that isn't blank */
+    int depth = 0;
+
+    if(word[0] != '(' && !(word[0] == '{' && word[1] != '\0' && strchr(" \t\n", word[1]) != NULL))
+        return NULL;
+    for(const char * p = word; *p != '\0'; p++) {
+        if(*p == '\'' || *p == '"') {
+            if((p = strchr(p + 1, *p)) == NULL)
+                return NULL;
+        } else if(word[0] == '(') {
+            if(*p == '(') {
+                depth++;
+            } else if(*p == ')' && --depth == 0) {
+                return p + 1;
+            }
+        } else if(*p == '{' && (p == word || strchr(" \t\n;", p[-1]) != NULL) && p[1] != '\0' && strchr(" \t\n", p[1]) != NULL) {
+            depth++;
+        } else if(*p == '}' && strchr(";&\n", *last) != NULL && (p[1] == '\0' || strchr(" \t\n;|&)<>", p[1]) != NULL)) {
+            if(--depth == 0)
+                return p + 1;
+        }
+        if(strchr(" \t", *p) == NULL)
+            last = p;
+    }
+    return NULL;
+}
+
+/* is_group - The command is a group, ( list ) or { list; } as a whole */
+bool is_group(struct cmd_t * cmd) {
+    const char * end;
+    return cmd->argv[0] != NULL && (end = group_end(cmd->argv[0])) != NULL && *end == '\0';
+}
+
+/*
+ * run_group - Run the list of a group word, in the child forked for it
+ *     (after its redirections). Return its exit status.
+ */
+int run_group(const char * word) {
+    char * body = strndup(word + 1, strlen(word) - 2);
+    if(body == NULL) {
+        unix_error("strndup");
+    }
+
+    // the shell's jobs aren't ours; ctrl-c and ctrl-z are sent to the whole process group
+    in_group = true;
+    initjobs(jobs);
+    Signal(SIGINT, SIG_DFL);
+    Signal(SIGTSTP, SIG_DFL);
+    Signal(SIGQUIT, SIG_DFL);
+
+    int status = run_list(body, true);
+    free(body);
+    fflush(stdout);
+    return status;
+}
+
+/*
+ * exec_tail - The last command of a group: if it is a lone external
+ *     command in the foreground, exec it in place of the group's child.
+ *     Return otherwise.
+ */
+void exec_tail(struct cmd_t * cmd, int cmd_num, int bg) {
+    static const char * dispatched[] = {"memo", "after", "after-ok", "coproc", NULL};
+
+    if(cmd_num != 1 || bg || cmd->is_builtin || cmd->argv[0] == NULL)
+        return;
+    if(is_group(cmd) || has_procsub(cmd) || is_parallel(cmd) || is_buffer(cmd))
+        return;
+    for(int i = 0; dispatched[i] != NULL; i++) {
+        if(strcmp(cmd->argv[0], dispatched[i]) == 0)
+            return;
+    }
+
+    if(apply_redir(cmd, -1, -1) < 0) {
+        exit(1);
+    }
+    journal_exec(getpid(), getpgrp(), cmd->argv);
+    note_exec(cmd->argv[0]);
+    fflush(stdout);
+
+    char ** envp = cmd->assign_str[0] == NULL ? var_envp() : var_envp_with(cmd->assign_str);
+    execve(cmd->argv[0], cmd->argv, envp);
+    char msg[MAXLINE + 30];
+    snprintf(msg, sizeof(msg), "%s: Command not found.\n", cmd->argv[0]);
+    print_error(msg);
+    exit(1);
+}
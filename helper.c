@@ -13,10 +13,17 @@ char prompt[] = "tsh> ";    /* command line prompt */
  * usage - print a help message
  */
 void usage(void) {
-    printf("Usage: shell [-hvp]\n");
+    printf("Usage: shell [-hvpz] [--startup-profile] [--no-prefetch] [--record FILE] [--replay FILE [--speed Nx | --max]]\n");
     printf("   -h   print this message\n");
     printf("   -v   print additional diagnostic information\n");
     printf("   -p   do not emit a command prompt\n");
+    printf("   -z   spawn commands through a fork-server started at launch\n");
+    printf("   --startup-profile  print the time to the first prompt, phase by phase\n");
+    printf("   --no-prefetch  don't read the executables of the history into the page cache\n");
+    printf("   --record FILE  record the command lines, exit statuses and job events to FILE\n");
+    printf("   --replay FILE  run the commands recorded in FILE at their recorded times, then exit\n");
+    printf("   --speed Nx     replay N times faster (N can be a fraction)\n");
+    printf("   --max          replay the commands back to back\n");
     exit(1);
 }
 
@@ -1,39 +1,253 @@
+#define _GNU_SOURCE
+
 #include "history.h"
 #include "tsh.h"
 #include "helper.h"
+#include "warm.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
 
 /* where to store the next history record
 indicate the position of the oldest command as well (if there is a command at history_idx)*/
-int history_idx = 0;        
+int history_idx = 0;
 char history[MAXHISTORY][MAXLINE];  /* the last 10 records of history */
 
+/*
+ * .tsh_history is shared by all sessions of a user. Every record is one
+ * command line terminated by '\n', appended with a single write() under
+ * flock(), so records of concurrent sessions never interleave. Each session
+ * remembers how far it has read the file, and only reads what other
+ * sessions have appended since then.
+ */
+static int history_fd = -1;
+static off_t history_off = 0;   /* end of the last complete record we have read */
+static ino_t history_ino = 0;   /* to notice that the file has been replaced */
 
-void init_history() {  
-    char path[MAXLINE];
+#define HMETA_HEAD (offsetof(struct hmeta_t, reserved) + 1)  /* bytes of a record's header on disk */
+
+static int meta_fd = -1;        /* .tsh_history.meta */
+
+static struct {                 /* the entry being run */
+    bool active;
+    uint64_t cmd_off;
+    int64_t start;
+    struct timespec started;    /* CLOCK_MONOTONIC */
+    int stage_num;              /* -1 until a pipeline has run */
+    uint8_t status[HMETA_MAXSTAGES];
+} cur;
+
+static void history_path(char * path) {
     sprintf(path, "./home/%s/.tsh_history", username);
+}
 
-    FILE * fp = fopen(path, "r");
-    if(fp == NULL){
-        unix_error("fopen");
+/* push_history - Put a record of len bytes (without '\n') into the ring */
+static void push_history(const char * record, int len) {
+    if(len > MAXLINE - 2) {
+        len = MAXLINE - 2;
     }
+    memcpy(history[history_idx], record, len);
+    history[history_idx][len] = '\n';
+    history[history_idx][len + 1] = '\0';
+    history_idx = (history_idx + 1) % MAXHISTORY;
+}
 
-    int i = 0;
-    while(fgets(history[i], MAXLINE, fp) != NULL){
-        i++;        
+/*
+ * read_records - Read the complete records in [off, end) of the history
+ *     file into the ring, return the offset right after the last one
+ */
+static off_t read_records(off_t off, off_t end) {
+    char buf[MAXLINE * 4];
+
+    while(off < end) {
+        int want = end - off < (off_t)sizeof(buf) ? end - off : sizeof(buf);
+        int n = pread(history_fd, buf, want, off);
+        if(n <= 0) {
+            break;
+        }
+
+        char * st = buf;
+        char * nl;
+        while((nl = memchr(st, '\n', buf + n - st)) != NULL) {
+            push_history(st, nl - st);
+            st = nl + 1;
+        }
+
+        if(st == buf) {
+            if(n < (int)sizeof(buf)) {  // a torn record at the end of the file
+                break;
+            }
+            st = buf + n;   // a record longer than the buffer, skip it
+        }
+        off += st - buf;
     }
 
-    fclose(fp);
+    return off;
+}
+
+/*
+ * restore_warm - Take the ring from the warm snapshot if it was read from
+ *     the file st, which has only grown since. Then history_off is where
+ *     the records left to read start.
+ */
+static bool restore_warm(struct stat * st) {
+    uint32_t len;
+    const char * p = warm_section(WARM_HISTORY, &len);
+    struct hwarm_t w;
+    char c;
+
+    if(p == NULL || len < sizeof(w))
+        return false;
+    memcpy(&w, p, sizeof(w));
+    if(w.dev != (uint64_t)st->st_dev || w.ino != (uint64_t)st->st_ino || w.off > (uint64_t)st->st_size || w.num > MAXHISTORY)
+        return false;
+    // the same file rewritten in place wouldn't have a record ending there
+    if(w.off > 0 && (pread(history_fd, &c, 1, w.off - 1) != 1 || c != '\n'))
+        return false;
+
+    const char * end = p + len;
+    p += sizeof(w);
+    for(uint32_t i = 0; i < w.num; i++) {
+        uint16_t rec_len;
+        if(end - p < (long)sizeof(rec_len))
+            return false;
+        memcpy(&rec_len, p, sizeof(rec_len));
+        p += sizeof(rec_len);
+        if(end - p < rec_len)
+            return false;
+        push_history(p, rec_len);
+        p += rec_len;
+    }
+    history_off = w.off;
+    return true;
+}
+
+/* save_history_warm - Put the ring in the warm snapshot, as struct hwarm_t explains */
+int save_history_warm(void * buf, int cap) {
+    struct hwarm_t w;
+    struct stat st;
+    uint32_t len;
+
+    if(history_fd < 0) {    // not loaded in this session: what the last one saved still holds
+        const void * prev = warm_section(WARM_HISTORY, &len);
+        if(prev == NULL || (int)len > cap)
+            return 0;
+        memcpy(buf, prev, len);
+        return len;
+    }
+    if(fstat(history_fd, &st) != 0 || cap < (int)sizeof(w))
+        return 0;
+
+    memset(&w, 0, sizeof(w));
+    w.dev = st.st_dev;
+    w.ino = st.st_ino;
+    w.off = history_off;
+
+    char * p = (char *)buf + sizeof(w);
+    int start = history_start();
+    for(int count = 0; count < MAXHISTORY && history[start][0] != '\0'; count++) {
+        uint16_t rec_len = strlen(history[start]) - 1;  // without '\n'
+        if(p + sizeof(rec_len) + rec_len > (char *)buf + cap)
+            return 0;
+        memcpy(p, &rec_len, sizeof(rec_len));
+        memcpy(p + sizeof(rec_len), history[start], rec_len);
+        p += sizeof(rec_len) + rec_len;
+        w.num++;
+        start = (start + 1) % MAXHISTORY;
+    }
+    memcpy(buf, &w, sizeof(w));
+    return p - (char *)buf;
+}
+
+static void open_history() {
+    char path[MAXLINE];
+    history_path(path);
+
+    if(history_fd >= 0) {
+        close(history_fd);
+    }
+    history_fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if(history_fd < 0) {
+        unix_error("open history");
+    }
 
-    for(int j = i; j < MAXHISTORY; j++){
+    if(meta_fd >= 0) {
+        close(meta_fd);
+    }
+    strcat(path, ".meta");
+    meta_fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);  // -1: entries are just not timed
+
+    struct stat st;
+    fstat(history_fd, &st);
+    history_ino = st.st_ino;
+
+    for(int j = 0; j < MAXHISTORY; j++){
         history[j][0] = '\0';
     }
+    history_idx = 0;
+
+    if(restore_warm(&st)) {
+        history_off = read_records(history_off, st.st_size);
+        return;
+    }
+
+    // only the tail of the file can hold the last MAXHISTORY records
+    off_t off = st.st_size - (off_t)MAXHISTORY * MAXLINE;
+    if(off <= 0) {
+        off = 0;
+    } else {
+        char c;
+        // start at the beginning of a record
+        while(off < st.st_size && pread(history_fd, &c, 1, off - 1) == 1 && c != '\n') {
+            off++;
+        }
+    }
+    history_off = read_records(off, st.st_size);
+}
+
+/* ensure_history - The history is read on first use, not at startup */
+static void ensure_history() {
+    if(history_fd < 0) {
+        open_history();
+    }
+}
+
+/* history_replaced - The file has been removed or replaced since we opened it */
+static bool history_replaced() {
+    char path[MAXLINE];
+    struct stat st;
+
+    history_path(path);
+    return stat(path, &st) != 0 || st.st_ino != history_ino;
+}
+
+/* catch_up_history - Read the records appended past history_off */
+static void catch_up_history() {
+    struct stat st;
 
-    history_idx = i % MAXHISTORY;
+    if(fstat(history_fd, &st) == 0 && st.st_size > history_off) {
+        history_off = read_records(history_off, st.st_size);
+    }
 }
 
+/*
+ * sync_history - Merge the records other sessions have appended since we
+ *     last looked at the file. Costs a stat() and an fstat() when nothing
+ *     is new.
+ */
+void sync_history() {
+    if(history_replaced()) {
+        open_history(); // start over
+        return;
+    }
+    catch_up_history();
+}
 
 int history_start() {
     int start = history_idx;
@@ -44,36 +258,121 @@ int history_start() {
 }
 
 void add_history(char * cmdline) {
-    strcpy(history[history_idx], cmdline);
-    history_idx = (history_idx + 1) % MAXHISTORY;
+    char record[MAXLINE + 2];
+    int len = strlen(cmdline);
 
-    // change .tsh_history  
-    char path[MAXLINE];
-    sprintf(path, "./home/%s/.tsh_history", username);
+    if(len > 0 && cmdline[len - 1] == '\n') {
+        len--;
+    }
+    if(len > MAXLINE - 1) {
+        len = MAXLINE - 1;
+    }
+    // cmdline may point into the ring (!n), copy it before merging other records
+    memcpy(record + 1, cmdline, len);
+    record[len + 1] = '\n';
 
-    int start = history_start();
+    ensure_history();
+    // opening a removed or replaced file again closes the locked fd: lock the new one
+    for(;;) {
+        flock(history_fd, LOCK_EX);
+        if(!history_replaced())
+            break;
+        open_history();
+    }
+
+    // take in other sessions' records first, so that ours lands after them in the ring as well
+    catch_up_history();
 
-    FILE * fp = fopen(path, "w");
-    if(fp == NULL){
-        unix_error("fopen");
+    // a session that died in the middle of a write may have left a torn record, terminate it
+    struct stat st;
+    int skip = 1;
+    if(fstat(history_fd, &st) == 0 && st.st_size > history_off) {
+        record[0] = '\n';
+        skip = 0;
     }
 
-    for(int count = 0; count < MAXHISTORY && history[start][0]!='\0'; count++){
-        fprintf(fp, "%s", history[start]);
-        start = (start + 1) % MAXHISTORY;
+    cur.active = false;
+    if(write(history_fd, record + skip, len + 2 - skip) == len + 2 - skip) {
+        history_off = st.st_size + len + 2 - skip;
+
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        clock_gettime(CLOCK_MONOTONIC, &cur.started);
+        cur.active = true;
+        cur.cmd_off = st.st_size + 1 - skip;
+        cur.start = (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+        cur.stage_num = -1;
     }
 
-    fclose(fp);
+    flock(history_fd, LOCK_UN);
+
+    push_history(record + 1, len);
+}
+
+/* note_history_status - The exit statuses of the stages of a pipeline of the current entry */
+void note_history_status(const int * status, int num) {
+    if(!cur.active)
+        return;
+
+    if(num > HMETA_MAXSTAGES) {
+        status += num - HMETA_MAXSTAGES;
+        num = HMETA_MAXSTAGES;
+    }
+    cur.stage_num = num;
+    for(int i = 0; i < num; i++) {
+        cur.status[i] = status[i];
+    }
+}
+
+/*
+ * finish_history - The current entry is done: append its timing, statuses
+ *     and working directory to the sidecar
+ */
+void finish_history() {
+    char record[HMETA_HEAD + HMETA_MAXSTAGES + MAXLINE];
+    char cwd[MAXLINE];
+    struct hmeta_t meta;
+    struct timespec now;
+
+    if(!cur.active || meta_fd < 0)
+        return;
+    cur.active = false;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if(cur.stage_num < 0) {     // nothing ran a pipeline (e.g. memo replayed it)
+        cur.stage_num = 1;
+        cur.status[0] = last_status;
+    }
+    if(getcwd(cwd, sizeof(cwd)) == NULL) {
+        cwd[0] = '\0';
+    }
+    int cwd_len = strlen(cwd);
+
+    meta.cmd_off = cur.cmd_off;
+    meta.start = cur.start;
+    meta.duration = (uint64_t)(now.tv_sec - cur.started.tv_sec) * 1000000 + (now.tv_nsec - cur.started.tv_nsec) / 1000;
+    meta.size = HMETA_HEAD + cur.stage_num + cwd_len;
+    meta.stage_num = cur.stage_num;
+    meta.reserved = 0;
+
+    memcpy(record, &meta, HMETA_HEAD);
+    memcpy(record + HMETA_HEAD, cur.status, cur.stage_num);
+    memcpy(record + HMETA_HEAD + cur.stage_num, cwd, cwd_len);
+    if(write(meta_fd, record, meta.size) != meta.size) {
+        return;     // the entry is just not timed, not worth an error
+    }
 }
 
 void list_history() {
+    sync_history();
+
     int start = history_start();
 
     for(int count = 0; count < MAXHISTORY && history[start][0] != '\0'; count++){
         printf("%d %s", count + 1, history[start]);
-        start = (start + 1) % MAXHISTORY; 
+        start = (start + 1) % MAXHISTORY;
     }
-} 
+}
 
 char * nth_history(int n) {
     int start = history_start();
@@ -97,6 +396,8 @@ void exec_nth_cmd(char ** argv) {
         return;
     }
 
+    sync_history();
+
     char * cmdline = nth_history(n);
 
     if(cmdline[0] == '\0'){
@@ -105,4 +406,162 @@ void exec_nth_cmd(char ** argv) {
         return;
     }
     eval(cmdline);
-}
\ No newline at end of file
+}
+
+/***********************************************
+ * Queries on the sidecar: history --slowest N, --failed, --since WHEN
+ **********************************************/
+
+struct hentry_t {           /* a record of the sidecar, in memory */
+    struct hmeta_t meta;
+    const uint8_t * status;
+    const char * cwd;
+    int cwd_len;
+};
+
+static int cmp_duration(const void * a, const void * b) {
+    const struct hentry_t * x = a, * y = b;
+    return x->meta.duration < y->meta.duration ? 1 : x->meta.duration > y->meta.duration ? -1 : 0;
+}
+
+/*
+ * parse_since - WHEN is N followed by s, m, h or d (that long ago), seconds
+ *     since the epoch, or a local YYYY-MM-DD[THH:MM[:SS]]
+ */
+static bool parse_since(const char * when, int64_t * usec) {
+    char * end;
+    long long n = strtoll(when, &end, 10);
+    int64_t now = time(NULL);
+
+    if(end != when && end[0] != '\0' && end[1] == '\0' && strchr("smhd", end[0]) != NULL) {
+        int unit = end[0] == 's' ? 1 : end[0] == 'm' ? 60 : end[0] == 'h' ? 3600 : 86400;
+        *usec = (now - n * unit) * 1000000;
+        return true;
+    }
+    if(end != when && end[0] == '\0') {
+        *usec = n * 1000000;
+        return true;
+    }
+
+    const char * formats[] = {"%Y-%m-%dT%H:%M:%S", "%Y-%m-%dT%H:%M", "%Y-%m-%d"};
+    for(int i = 0; i < 3; i++) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        end = strptime(when, formats[i], &tm);
+        if(end != NULL && *end == '\0') {
+            tm.tm_isdst = -1;
+            *usec = (int64_t)mktime(&tm) * 1000000;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* print_entry - One line of a query: start, duration, statuses, directory, command line */
+static void print_entry(struct hentry_t * e) {
+    char when[32], line[MAXLINE + 1];
+    time_t sec = e->meta.start / 1000000;
+    struct tm tm;
+
+    localtime_r(&sec, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+
+    int n = pread(history_fd, line, MAXLINE, e->meta.cmd_off);
+    char * nl = n > 0 ? memchr(line, '\n', n) : NULL;
+    if(nl == NULL) {
+        strcpy(line, "?");      // the history file has been replaced
+    } else {
+        *nl = '\0';
+    }
+
+    printf("%s %10.3fs  ", when, e->meta.duration / 1e6);
+    for(int i = 0; i < e->meta.stage_num; i++) {
+        printf(i == 0 ? "%d" : "|%d", e->status[i]);
+    }
+    printf("  %.*s  %s\n", e->cwd_len, e->cwd, line);
+}
+
+/* query_history - List the timed entries matching the options, the slowest first with slowest > 0 */
+static int query_history(int slowest, bool failed, bool since_set, int64_t since) {
+    struct stat st;
+
+    ensure_history();
+    if(meta_fd < 0 || fstat(meta_fd, &st) != 0) {
+        print_error("history: no timing records\n");
+        return 1;
+    }
+
+    char * buf = malloc(st.st_size + 1);
+    int cap = 256, num = 0;
+    struct hentry_t * entries = malloc(sizeof(struct hentry_t) * cap);
+    if(buf == NULL || entries == NULL) {
+        unix_error("malloc");
+    }
+    off_t len = pread(meta_fd, buf, st.st_size, 0);
+
+    for(off_t off = 0; len > 0 && off + (off_t)HMETA_HEAD <= len; ) {
+        struct hentry_t e;
+        memcpy(&e.meta, buf + off, HMETA_HEAD);
+        if(e.meta.size < HMETA_HEAD + e.meta.stage_num || off + e.meta.size > len) {
+            break;  // torn by a session that died while writing
+        }
+        e.status = (const uint8_t *)buf + off + HMETA_HEAD;
+        e.cwd = buf + off + HMETA_HEAD + e.meta.stage_num;
+        e.cwd_len = e.meta.size - HMETA_HEAD - e.meta.stage_num;
+        off += e.meta.size;
+
+        if(since_set && e.meta.start < since)
+            continue;
+        if(failed && (e.meta.stage_num == 0 || e.status[e.meta.stage_num - 1] == 0))
+            continue;
+
+        if(num == cap) {
+            cap *= 2;
+            entries = realloc(entries, sizeof(struct hentry_t) * cap);
+            if(entries == NULL) {
+                unix_error("realloc");
+            }
+        }
+        entries[num++] = e;
+    }
+
+    if(slowest > 0) {
+        qsort(entries, num, sizeof(struct hentry_t), cmp_duration);
+        if(num > slowest)
+            num = slowest;
+    }
+    for(int i = 0; i < num; i++) {
+        print_entry(&entries[i]);
+    }
+
+    free(entries);
+    free(buf);
+    return 0;
+}
+
+/* do_history - history [--slowest N] [--failed] [--since WHEN] */
+int do_history(char ** argv) {
+    int slowest = 0;
+    bool failed = false, since_set = false;
+    int64_t since = 0;
+
+    if(argv[1] == NULL) {
+        list_history();
+        return 0;
+    }
+
+    for(int i = 1; argv[i] != NULL; i++) {
+        if(strcmp(argv[i], "--slowest") == 0 && argv[i + 1] != NULL && atoi(argv[i + 1]) > 0) {
+            slowest = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "--failed") == 0) {
+            failed = true;
+        } else if(strcmp(argv[i], "--since") == 0 && argv[i + 1] != NULL && parse_since(argv[i + 1], &since)) {
+            since_set = true;
+            i++;
+        } else {
+            print_error("usage: history [--slowest N] [--failed] [--since WHEN]\n");
+            return 1;
+        }
+    }
+    return query_history(slowest, failed, since_set, since);
+}
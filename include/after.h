@@ -0,0 +1,33 @@
+#ifndef AFTER_H
+#define AFTER_H
+
+#include "tsh.h"
+#include "job.h"
+#include <stdbool.h>
+
+/*
+ * after %1 %2 -- cmd | cmd ...: a background job that starts once the jobs
+ * it names (%jid or pgid) are done; after-ok only if they all exited 0,
+ * otherwise it is cancelled (exit status AFTER_CANCELLED), which cancels
+ * the after-ok jobs that wait for it in turn. A whole workflow is a set of
+ * after lines, its independent branches run at the same time.
+ *
+ * The job is started right away, in state WT: every process of it blocks
+ * on a socket, the gate, before its redirections and exec. When the last job
+ * it waits for is reaped, the SIGCHLD handler writes one byte per process
+ * to the gate, 'g' to go or 'x' to cancel. A job that is already done when
+ * it is named counts with the exit status it had.
+ *
+ * jobs shows under a job what it waits for, and which jobs wait for it.
+ */
+
+#define AFTER_MAXDEPS       MAXJOBS     /* jobs an after waits for */
+#define AFTER_CANCELLED     125         /* exit status of a cancelled job */
+
+int run_after(struct cmd_t * cmd, int cmd_num, char * cmdline);
+void wait_gate(int gate[2]);
+void after_job_done(struct job_t * job);
+bool is_waiting(struct job_t * job);
+void list_after(struct job_t * job);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include "tsh.h"
+#include "job.h"
+#include <stdbool.h>
+
+/*
+ * buffer [-m MEM] [SIZE]: a pipeline stage that copies its stdin to its
+ * stdout and holds what the next stage hasn't read yet, up to SIZE bytes,
+ * so that a bursty producer isn't stalled as soon as the pipe after it is
+ * full. Only when SIZE bytes are held does the stage stop reading.
+ *
+ * The first MEM bytes held are kept in a ring in a memfd, the rest spill
+ * to an unlinked file in $TMPDIR (or /tmp) and come back out of it in
+ * order. Data is moved with splice() between the pipes and the files, with
+ * read() and write() when a side isn't a pipe. The ring starts over from
+ * its beginning whenever it is empty, and gives its pages back once it has
+ * used more than BUFFER_KEEP of them.
+ *
+ * The stage reports into a shared mapping: jobs shows it under the job,
+ * and when the job is done a line tells the peak held (and spilled), the
+ * time the buffer was full (the producer stalled) and the time more than a
+ * pipe's worth was held (the producer would have stalled without it).
+ */
+
+#define BUFFER_SIZE     (1LL << 30)     /* default SIZE */
+#define BUFFER_MEM      (64LL << 20)    /* default MEM */
+#define BUFFER_KEEP     (1LL << 20)     /* pages of the ring kept when it is empty */
+#define BUFFER_PIPE     (64 * 1024)     /* what a pipe holds */
+#define BUFFER_CHUNK    (1 << 20)       /* bytes moved at once, at most */
+
+struct buffer_t {
+    bool started;
+    long long size;         /* SIZE */
+    long long mem;          /* MEM, at most SIZE */
+    long long bytes;        /* passed through */
+    long long held;         /* now */
+    long long peak;
+    long long spilled;      /* written to the spill file */
+    long long spill_peak;   /* held in the spill file, at most */
+    double full;            /* seconds SIZE bytes were held */
+    double absorbed;        /* seconds more than BUFFER_PIPE bytes were held */
+    bool done;
+    struct buffer_t * next; /* next buffer stage of the job, shell side only */
+};
+
+bool is_buffer(struct cmd_t * cmd);
+struct buffer_t * open_buffer();
+void attach_buffer(struct job_t * job, struct buffer_t * buf);
+void finish_buffer(struct job_t * job);
+void list_buffer(struct job_t * job);
+int exec_buffer(struct cmd_t * cmd, struct buffer_t * buf);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef BUILTIN_H
+#define BUILTIN_H
+
+#include "tsh.h"
+#include "tsh_plugin.h"
+#include <stdbool.h>
+
+/*
+ * The builtin registry: the core builtins are found with a perfect hash
+ * computed when they were listed (one strcmp per lookup), the ones loaded
+ * from plugins with enable -f in a short list searched after them. Words
+ * that are builtins by their shape (!n, name=value), functions and the
+ * fast-path utilities are not in the registry.
+ */
+
+#define BUILTIN_HASH    32      /* slots of the core table */
+#define MAXPLUGINS      32      /* max builtins loaded from plugins */
+
+typedef int builtin_fn(char ** argv);
+
+struct builtin_t {
+    const char * name;
+    builtin_fn * run;
+    int flags;                  /* TSH_BUILTIN_* */
+};
+
+const struct builtin_t * find_builtin(const char * name);
+bool is_pure_builtin(struct cmd_t * cmd);
+bool is_plugin_builtin(const char * name);
+int do_enable(char ** argv);
+
+#endif
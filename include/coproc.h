@@ -0,0 +1,63 @@
+#ifndef COPROC_H
+#define COPROC_H
+
+#include "tsh.h"
+#include "job.h"
+#include <stdbool.h>
+#include <time.h>
+
+/*
+ * coproc NAME cmd | cmd ...: a background job whose stdin and stdout are
+ * the shell's, through a socket, so that one long-lived process serves
+ * many small requests instead of a process being started for each:
+ *
+ *   cowrite NAME words...      writes the words and a newline
+ *   cowrite -e NAME            end of input: the coprocess reads EOF
+ *   coread [-n N | -u MARK] [-t SECONDS] NAME [VAR]
+ *                              reads a reply: one line, N lines, or the
+ *                              lines up to a line MARK; into VAR or to
+ *                              stdout. 1 at the end of the output, 124 if
+ *                              it timed out.
+ *
+ * A socket rather than two pipes: a write to a coprocess that has exited
+ * fails with EPIPE instead of killing the shell with SIGPIPE. The shell
+ * keeps what it read past a reply for the next coread, and can read what
+ * the coprocess wrote after it is gone, until the end of its output.
+ *
+ * jobs shows the requests, replies and bytes of each coprocess, how long
+ * coread waited for its replies and whether one is overdue. A request is
+ * a line written; a reply is a line read, or the lines up to a MARK, which
+ * answer one request.
+ */
+
+#define COPROC_NAME     32      /* max name length, '\0' included */
+#define COPROC_BUF      4096    /* initial read-ahead buffer of a coprocess */
+#define COPROC_TIMEOUT  124     /* exit status of coread -t that timed out */
+
+struct coproc_t {
+    char name[COPROC_NAME];     /* "" for a free slot */
+    pid_t pgid;                 /* its job, 0 once the job is done */
+    int fd;                     /* the shell's end */
+    bool input_closed;          /* cowrite -e */
+    bool output_closed;         /* coread reached the end of its output */
+    char * buf;                 /* read, not yet returned by coread */
+    int buf_len;
+    int buf_cap;
+    unsigned long requests;     /* lines written by cowrite */
+    unsigned long replies;      /* replies read by coread */
+    unsigned long reads;        /* complete coread calls */
+    unsigned long long bytes_out;
+    unsigned long long bytes_in;
+    struct timespec started;
+    struct timespec last_request;
+    double wait_sum;            /* seconds coread waited, over reads */
+    double wait_max;
+};
+
+int run_coproc(struct cmd_t * cmd, int cmd_num, char * cmdline);
+int do_cowrite(char ** argv);
+int do_coread(char ** argv);
+void coproc_job_done(struct job_t * job);
+void list_coproc(struct job_t * job);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef FASTPATH_H
+#define FASTPATH_H
+
+#include "tsh.h"
+#include <stdbool.h>
+
+/*
+ * The hottest utilities (echo, printf, true, false, test/[, cat, tee) are run
+ * inside the shell instead of forking and executing /bin/... . Setting
+ * TSH_FASTPATH=0 (as a variable, or as a prefix of one command) runs the
+ * external binaries again.
+ */
+
+#define FASTPATH_CHUNK  (1 << 20)   /* bytes moved by cat and tee per sendfile/splice/tee call */
+
+const char * fastpath_name(const char * cmd);
+bool is_fastpath(struct cmd_t * cmd);
+int exec_fastpath(char ** argv);
+int copy_fd(int in, int out);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef FEED_H
+#define FEED_H
+
+#include "job.h"
+
+/*
+ * Every job state change is published as one JSON line to the clients of
+ * a Unix socket (feed PATH, or TSH_FEED=PATH in the environment):
+ *
+ *   {"jid":1,"pgid":4242,"old":"none","new":"BG","time":1700000000.123456,"status":null}
+ *
+ * old is "none" when a job is added, new is "done" when it is deleted,
+ * with the exit status of its last process. Sockets are never waited on:
+ * a subscriber that can't keep up with FEED_BACKLOG bytes is dropped.
+ */
+
+#define DONE            5       /* pseudo state of a deleted job */
+#define FEED_MAXSUBS   16       /* max subscribers */
+#define FEED_BACKLOG 4096       /* bytes queued for a slow subscriber before dropping it */
+
+void init_feed();
+int open_feed(const char * path);
+void close_feed();
+void publish_job(struct job_t * job, int old_state, int new_state);
+int do_feed(char ** argv);
+
+#endif
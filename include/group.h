@@ -0,0 +1,28 @@
+#ifndef GROUP_H
+#define GROUP_H
+
+#include "tsh.h"
+#include <stdbool.h>
+
+/*
+ * ( list ) and { list; } as a stage of a pipeline, in the background or
+ * with redirections: the group is one word (like <(cmd), see procsub.h),
+ * and one process of the job, a child of the shell that compiles the list
+ * and runs it with the script interpreter. A { list; } on its own still
+ * runs in the shell (see script.c).
+ *
+ * In the child, fds 0-2 already are the stage's, so builtins just use
+ * them. Its foreground pipelines stay in the job's process group, so that
+ * ctrl-c and ctrl-z reach them; their jobs aren't the shell's and aren't
+ * published. The last command of the list, if it is a lone external one,
+ * is exec'd in place of the child instead of being forked.
+ */
+
+extern bool in_group;       /* this process is the child of a group */
+
+const char * group_end(const char * word);
+bool is_group(struct cmd_t * cmd);
+int run_group(const char * word);
+void exec_tail(struct cmd_t * cmd, int cmd_num, int bg);
+
+#endif
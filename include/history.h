@@ -2,16 +2,51 @@
 #define HISTORY_H
 
 #include "tsh.h"
+#include <stdint.h>
 
 #define MAXHISTORY   10   /* max records of history */ 
+#define HMETA_MAXSTAGES 255 /* statuses in a record, longer pipelines keep their last ones */
+
+/*
+ * .tsh_history.meta, next to .tsh_history, has a binary record per
+ * history entry: a struct hmeta_t, then stage_num exit statuses of one
+ * byte each (the stages of the entry's last pipeline), then the working
+ * directory, not terminated. Records are appended with a single write().
+ */
+struct hmeta_t {
+    uint64_t cmd_off;       /* offset of the command line in .tsh_history */
+    int64_t start;          /* microseconds since the epoch */
+    uint64_t duration;      /* microseconds */
+    uint16_t size;          /* bytes of the whole record */
+    uint8_t stage_num;
+    uint8_t reserved;
+};
+
+/*
+ * The ring as kept in the warm snapshot (WARM_HISTORY, see warm.h): the
+ * .tsh_history it was read from and up to where, then num records, the
+ * oldest first, each a uint16_t length and the command line without '\n'.
+ * A session that finds the same file reads only what was appended since.
+ */
+struct hwarm_t {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t off;           /* history_off when the ring was saved */
+    uint32_t num;
+    uint32_t reserved;
+};
 
 extern int history_idx;
 extern char history[MAXHISTORY][MAXLINE]; 
 
-void init_history();
+int save_history_warm(void * buf, int cap);
+void sync_history();
 int history_start();
 void add_history(char * cmdline);
 void list_history();
+void note_history_status(const int * status, int num);
+void finish_history();
+int do_history(char ** argv);
 char * nth_history(int n);
 void exec_nth_cmd(char ** argv);
 
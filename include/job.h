@@ -12,23 +12,36 @@
 #define FG 1    /* running in foreground */
 #define BG 2    /* running in background */
 #define ST 3    /* stopped */
+#define WT 4    /* waiting for other jobs to start (after) */
 /* 
- * Jobs states: FG (foreground), BG (background), ST (stopped)
+ * Jobs states: FG (foreground), BG (background), ST (stopped), WT (waiting)
  * Job state transitions and enabling actions:
  *     FG -> ST  : ctrl-z
  *     ST -> FG  : fg command
  *     ST -> BG  : bg command
  *     BG -> FG  : fg command
+ *     WT -> BG  : the jobs it waits for are done
+ *     WT -> FG  : fg command, it still waits
  * At most 1 job can be in the FG state.
  */
 
+struct joblog_t;
+struct parallel_t;
+struct buffer_t;
+
 struct job_t {              /* the job struct */
     pid_t pgid;             /* PGID */  // 
     int jid;                /* job ID [1, 2, ...] */
-    pid_t pids[MAXPIPES];   /* PIDs in this job */         
+    pid_t * pids;           /* PIDs in this job */         
     int proc_num;           /* length of arrary pids */
+    int proc_cap;           /* room in pids and pipestatus, kept when the slot is cleared */
     int terminated_proc_num;/* already terminated processes in this job */
     int state;              /* UNDEF, BG, FG, or ST */
+    int status;             /* exit status of the last process in the pipeline */
+    int * pipestatus;       /* exit status of each process, in the order of pids */
+    struct joblog_t * log;  /* captured output, NULL if it goes to the terminal */
+    struct parallel_t * par;/* stats of its parallel stages, NULL if none */
+    struct buffer_t * buf;  /* stats of its buffer stages, NULL if none */
     char cmdline[MAXLINE];  /* command line */
 };
 
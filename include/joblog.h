@@ -0,0 +1,40 @@
+#ifndef JOBLOG_H
+#define JOBLOG_H
+
+#include "tsh.h"
+#include "job.h"
+#include <stdbool.h>
+
+/*
+ * With TSH_JOBLOG=1, the stdout and stderr of background jobs go to a pipe
+ * owned by the shell instead of the terminal. The pipe is non-blocking and
+ * signal-driven (O_ASYNC): sigio_handler drains it into a per-job ring, and
+ * when the ring is full its oldest bytes are spilled to an unlinked
+ * temporary file. A log stays around for a while after its job is done.
+ */
+
+#define JOBLOG_RING   (1 << 16)     /* bytes of a job's output kept in memory */
+#define JOBLOG_DONE   (2 * MAXJOBS) /* logs of finished jobs, at most */
+
+struct joblog_t {
+    int fd;                 /* read end of the job's output pipe, -1 once closed */
+    int spill_fd;           /* temporary file with bytes [0, spilled), -1 if none or lost */
+    char * ring;            /* bytes [spilled, total), byte n is at ring[n % JOBLOG_RING] */
+    long long total;        /* bytes received */
+    long long spilled;      /* bytes that left the ring */
+    long long lost;         /* bytes that could not be spilled */
+    long long seen;         /* bytes already shown by joblog or fg */
+    bool done;              /* the job is done */
+    int jid;
+    char cmdline[MAXLINE];
+};
+
+bool joblog_enabled();
+struct joblog_t * open_joblog(int * write_fd);
+void attach_joblog(struct job_t * job, struct joblog_t * log);
+void finish_joblog(struct job_t * job);
+void replay_joblog(struct job_t * job);
+int do_joblog(char ** argv);
+void sigio_handler(int sig);
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * The audit journal: a binary record of every process the shell starts
+ * and of how it ended, in ./home/<user>/.tsh_journal/<start>-<pid>.<n>,
+ * one series of files per session. tools/tsh-journal decodes and queries
+ * them.
+ *
+ * A file is preallocated (JOURNAL_SIZE) and mapped at the first exec of
+ * the session. Writing a record is a fetch-and-add on the header's used
+ * offset, which reserves its bytes, then stores into the mapping: no
+ * syscall, no lock, and the SIGCHLD handler (or a child of the shell,
+ * the mapping is shared) can write while a record is half written. The
+ * record's type is stored last; a record of type 0 was torn and is
+ * skipped, a size of 0 is the end. The shell opens the next file when
+ * one is full.
+ *
+ * The child of a group (see group.h) writes the processes it starts to
+ * the shell's file, with a jid of 0: they are part of the group's job.
+ * An exec in place of the child is recorded with the child's pid again.
+ *
+ *   struct journal_head_t       JOURNAL_MAGIC, JOURNAL_VERSION, the session
+ *   struct journal_rec_t        JOURNAL_EXEC: pid, pgid, then argc strings (argv)
+ *                               JOURNAL_JOB: pgid is job jid, then the command line
+ *                               JOURNAL_EXIT: pid, pgid, jid, exit status (128 + signal)
+ *   ...
+ *
+ * Records are JOURNAL_ALIGN aligned, strings are '\0'-terminated and cut
+ * to fit JOURNAL_MAXREC.
+ */
+
+#define JOURNAL_MAGIC       0x726a7374  /* "tsjr" */
+#define JOURNAL_VERSION     1
+#define JOURNAL_SIZE        (1 << 20)   /* bytes of a file */
+#define JOURNAL_MAXREC      4096
+#define JOURNAL_ALIGN       8
+#define JOURNAL_USER        32
+
+#define JOURNAL_EXEC        1
+#define JOURNAL_JOB         2
+#define JOURNAL_EXIT        3
+
+struct journal_head_t {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;              /* of the file */
+    uint64_t used;              /* reserved so far, may pass size */
+    int64_t start;              /* of the session, microseconds since the epoch */
+    int32_t shell_pid;
+    uint32_t seq;               /* files of the session before this one */
+    char user[JOURNAL_USER];
+};
+
+struct journal_rec_t {
+    uint16_t size;              /* of the record, strings included */
+    uint8_t type;               /* 0 until the record is complete */
+    uint8_t argc;               /* strings that follow */
+    int32_t pid;
+    int32_t pgid;
+    int32_t jid;
+    int32_t status;
+    int32_t reserved;
+    int64_t time;               /* microseconds since the epoch */
+};
+
+#ifndef JOURNAL_DECODER
+struct job_t;
+
+void prepare_journal();
+void journal_exec(pid_t pid, pid_t pgid, char ** argv);
+void journal_job(struct job_t * job);
+void journal_exit(pid_t pid, struct job_t * job, int status);
+#endif
+
+#endif
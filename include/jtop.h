@@ -0,0 +1,45 @@
+#ifndef JTOP_H
+#define JTOP_H
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+/*
+ * jtop [-d SECONDS] [-n COUNT]: the jobs with the CPU%, resident memory,
+ * bytes read and written (rchar/wchar, pipes included) and state of each
+ * of their processes, refreshed every SECONDS (default 1) until q, ctrl-c
+ * or COUNT screens. On a terminal it runs until stopped, otherwise it
+ * prints one screen.
+ *
+ * /proc/<pid>/stat, statm and io of a process are opened once and read
+ * again with pread() at each refresh, into fixed buffers: a refresh costs
+ * three syscalls per process and no allocation. They are closed when the
+ * process leaves the jobs and when jtop returns. The table of processes
+ * only grows when there are more processes than ever before. A file that
+ * can't be opened (out of fds, another user's process) is reported on the
+ * process's line instead of its figures.
+ */
+
+#define JTOP_BUF    512     /* enough for /proc/<pid>/stat and io */
+
+struct jtop_proc_t {        /* a monitored process */
+    pid_t pid;
+    int stat_fd;            /* -1 once the process is gone */
+    int statm_fd;
+    int io_fd;              /* -1 if not readable (another user's process) */
+    int err;                /* errno of the first file that couldn't be opened, 0 if none */
+    const char * err_file;
+    bool seen;              /* still in a job at this refresh */
+    bool sampled;           /* prev_ticks is from an earlier refresh */
+    unsigned long long prev_ticks;  /* utime + stime */
+    char state;
+    char comm[16];
+    double cpu;             /* percent of one CPU */
+    unsigned long long rss; /* bytes */
+    unsigned long long rchar;
+    unsigned long long wchar;
+};
+
+int do_jtop(char ** argv);
+
+#endif
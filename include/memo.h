@@ -0,0 +1,34 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include "tsh.h"
+#include <stdint.h>
+
+/*
+ * memo cmd args < in > out: the stdout of a pipeline is cached under
+ * ./home/<user>/.tsh_memo, keyed on the working directory, the argv and
+ * the binary (device, inode, size, mtime) of every stage, and the content
+ * of the files read through '<' redirections (their identity instead, if
+ * they are larger than MEMO_HASH_MAX). A hit replays the stored output into
+ * the stdout target without running anything. Only successful runs are
+ * stored; the cache is bounded by TSH_MEMO_MAX bytes, least recently used
+ * entries are evicted first.
+ */
+
+#define MEMO_MAX       (64 << 20)    /* default size bound of the cache */
+#define MEMO_HASH_MAX (256 << 20)    /* larger input files are keyed on their identity */
+
+struct sha256_t {
+    uint32_t state[8];
+    uint64_t len;           /* bytes hashed */
+    unsigned char buf[64];
+    int buf_len;
+};
+
+void sha256_init(struct sha256_t * ctx);
+void sha256_update(struct sha256_t * ctx, const void * data, size_t len);
+void sha256_final(struct sha256_t * ctx, unsigned char digest[32]);
+
+int run_memo(struct cmd_t * cmd, int cmd_num, int bg, char * cmdline);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "tsh.h"
+#include "job.h"
+#include <stdbool.h>
+
+/*
+ * parallel [-j N] [-k] [-b SIZE] cmd args: a pipeline stage run by N copies
+ * of cmd. The stage process reads its stdin in chunks of about SIZE bytes,
+ * cut after a newline, and hands them round-robin to the workers that are
+ * idle. Without -k the workers live as long as the stage and their output
+ * is forwarded a whole line at a time, in no particular order; with -k each
+ * chunk gets a worker of its own and the outputs come out in input order.
+ *
+ * The workers are children of the stage, in the job's process group, so the
+ * job is stopped, continued and killed as one. They report to the shell
+ * through a shared mapping, which jobs shows under the job.
+ */
+
+#define PARALLEL_MAXJOBS    64          /* max workers of a stage */
+#define PARALLEL_CHUNK  (1 << 20)       /* default chunk size */
+
+struct par_worker_t {       /* written by the stage, read by the shell */
+    pid_t pid;              /* current process, 0 if none */
+    int chunks;             /* chunks handed to it */
+    long long bytes_in;
+    long long bytes_out;
+    int status;             /* exit status of its last process, -1 while running */
+};
+
+struct parallel_t {
+    int worker_num;         /* 0 until the stage has started */
+    bool ordered;
+    struct par_worker_t workers[PARALLEL_MAXJOBS];
+    struct parallel_t * next;   /* next parallel stage of the job, shell side only */
+};
+
+bool is_parallel(struct cmd_t * cmd);
+struct parallel_t * open_parallel();
+void attach_parallel(struct job_t * job, struct parallel_t * par);
+void finish_parallel(struct job_t * job);
+void list_parallel(struct job_t * job);
+int exec_parallel(struct cmd_t * cmd, struct parallel_t * par);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * History-driven prefetch. At login, and at a prompt once PREFETCH_IDLE
+ * seconds have passed since the last run, a low-priority child (nice 19,
+ * idle I/O class) reads the end of .tsh_history, ranks the executables
+ * found there by frequency with a decay per command line since (the
+ * weight halves every PREFETCH_HALFLIFE lines), and pulls the top ones
+ * into the page cache: each binary, its ELF interpreter and DT_NEEDED
+ * libraries, found like ld.so does through DT_RUNPATH and the standard
+ * directories, and theirs in turn.
+ *
+ * mincore() tells what is already cached, only the rest is read, with
+ * readahead() in chunks: at most PREFETCH_MAXBYTES a run, at most
+ * PREFETCH_RATE bytes a second.
+ *
+ * The child reports into a shared page. prefetch shows the last run (how
+ * much was cold) and how many of the commands run since were prefetched;
+ * prefetch -l the ranking, prefetch -r runs it now. tsh --no-prefetch
+ * turns it off, to compare.
+ */
+
+#define PREFETCH_TOP        16              /* executables prefetched */
+#define PREFETCH_PATH       256
+#define PREFETCH_SCAN       (256 * 1024)    /* bytes of history ranked, from its end */
+#define PREFETCH_HALFLIFE   50              /* command lines */
+#define PREFETCH_MAXFILES   256             /* binaries and libraries a run */
+#define PREFETCH_MAXBYTES   (64LL << 20)
+#define PREFETCH_RATE       (16LL << 20)    /* bytes a second */
+#define PREFETCH_CHUNK      (1 << 20)
+#define PREFETCH_IDLE       600             /* seconds between runs */
+
+struct prefetch_stat_t {    /* shared with the child of the last run */
+    int runs;
+    int done;               /* runs finished */
+    double started;         /* CLOCK_MONOTONIC seconds of the last run */
+    double seconds;         /* time the last finished run took */
+    int commands;           /* executables ranked */
+    int files;              /* ... with their libraries */
+    unsigned long long bytes;
+    unsigned long long cached;  /* of bytes, in the page cache before */
+    unsigned long long read;    /* read ahead */
+    bool capped;            /* stopped at PREFETCH_MAXBYTES */
+    char top[PREFETCH_TOP][PREFETCH_PATH];
+    double score[PREFETCH_TOP];
+};
+
+void init_prefetch(bool enabled);
+void start_prefetch();
+void idle_prefetch();
+void note_exec(const char * path);
+int do_prefetch(char ** argv);
+
+#endif
@@ -4,6 +4,7 @@
 #include <sys/types.h>
 
 void add_proc(char * name, pid_t pid, pid_t ppid, char * stat);
+void add_shell_proc(pid_t ppid);
 void remove_proc(pid_t pid);
 void write_proc(char * name, pid_t pid, pid_t ppid, char * stat);
 void change_proc_stat(pid_t pid, char * stat);
@@ -0,0 +1,64 @@
+#ifndef PROCSUB_H
+#define PROCSUB_H
+
+#include "tsh.h"
+#include <stdbool.h>
+#include <signal.h>
+#include <sys/types.h>
+
+/*
+ * Process substitution: a word <(pipeline) is replaced by /dev/fd/N, the
+ * read end of a pipe the pipeline writes to; >(pipeline) by the write end
+ * of a pipe it reads from. diff <(sort a) <(sort b) compares two outputs
+ * without a temporary file.
+ *
+ * The inner pipelines are parsed and expanded before the job starts. Their
+ * processes are started by the shell, in the process group of the job and
+ * in its pids, right before the stage whose word they are: ctrl-c, fg, jobs
+ * and jtop see one job. Every stage of an inner pipeline runs in a child,
+ * builtins too, and it may have substitutions of its own.
+ *
+ * N is PROCSUB_FD or above, out of the way of redirections. The shell
+ * holds the fd (close-on-exec) until the stage is started, the stage keeps
+ * it across exec, nothing else gets it.
+ */
+
+#define PROCSUB_FD      60      /* the lowest fd a substitution gets */
+#define PROCSUB_MAXFD   64      /* substitutions open at the same time */
+
+struct procsub_t {
+    char dir;                   /* '<': the stage reads the output, '>': writes the input */
+    int stage;                  /* the command it is a word of */
+    int arg;                    /* ... and its index in argv */
+    char * word;                /* the word, put back once the stage is started */
+    char * line;                /* the inner pipeline: its words point here, */
+    char * marked;              /* ... here */
+    char * pool;                /* ... and here once expanded */
+    struct cmd_t * cmd;
+    int cmd_num;
+    struct procsub_t * subs;    /* substitutions of the inner pipeline */
+    int fd;                     /* the end the stage gets, -1 */
+    char path[24];              /* /dev/fd/<fd> */
+    struct procsub_t * next;
+};
+
+struct spawn_t {                /* where run_pipeline keeps the processes of the job */
+    pid_t * pgid;               /* 0 until the first process is started */
+    pid_t * pids;
+    int * pid_num;
+    char * stat;
+    const sigset_t * mask;      /* the signal mask of a child */
+    int * gate;                 /* after: the gate to wait at, -1 */
+    int log_fd;                 /* a background job's log, -1 */
+};
+
+const char * procsub_end(const char * word);
+bool is_procsub(const char * word);
+bool has_procsub(struct cmd_t * cmd);
+int parse_procsubs(struct cmd_t * cmd, int cmd_num, struct procsub_t ** subs);
+void start_procsubs(struct procsub_t * subs, struct cmd_t * cmd, int stage, struct spawn_t * sp);
+void keep_procsubs(struct procsub_t * subs, int stage);
+void close_procsubs(struct procsub_t * subs, struct cmd_t * cmd, int stage);
+void free_procsubs(struct procsub_t * subs);
+
+#endif
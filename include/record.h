@@ -0,0 +1,38 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include "job.h"
+
+/*
+ * tsh --record FILE writes the session to FILE, one event per line, each
+ * prefixed with the seconds since the recording started:
+ *
+ *   #tsh-record 1 1700000000
+ *   0.000000 in /bin/echo hi
+ *   0.000812 status 0
+ *   1.250310 in /usr/bin/sleep 3 &
+ *   1.251002 job 1 4242 none BG -
+ *   1.251120 status 0
+ *   4.252891 job 1 4242 BG done 0
+ *
+ * in is a command line as eval gets it (a compound command is a single
+ * line, '\n' and '\\' escaped), status is $? after it, job is a job state
+ * change as in the feed (jid, pgid, old, new, exit status or -). The login
+ * is not recorded.
+ *
+ * tsh --replay FILE evals the in lines again, each at its recorded time
+ * (--speed Nx: N times faster, --max: without waiting), then reports how
+ * far behind the schedule the shell was and how many exit statuses differ
+ * from the recording. Both options together record the replay.
+ */
+
+#define RECORD_VERSION  1
+
+int open_record(const char * path);
+void record_input(const char * cmdline);
+void record_status(int status);
+void record_job(struct job_t * job, const char * old_state, const char * new_state);
+void close_record();
+int replay_session(const char * path, double speed);
+
+#endif
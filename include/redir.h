@@ -0,0 +1,68 @@
+#ifndef REDIR_H
+#define REDIR_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/*
+ * Redirections are compiled once, when the command is parsed (again after
+ * expansion if a redirection word has a '$'), into a plan: one struct
+ * redir_t per operator, in the order they were written.
+ *
+ *   [n]<file  [n]>file  [n]>>file  [n]<>file  [n]>&m  [n]<&m  [n]>&-  &>file  &>>file
+ *
+ * Running a plan first works out, symbolically, what each fd ends up
+ * referring to: an fd of the parent, a file, or nothing. Only then are the
+ * files opened (O_CLOEXEC, in the written order, so that every one of
+ * them is created or truncated) and the fds set, each with at most one
+ * dup2(): moves are ordered so that no source is overwritten before it is
+ * read, a cycle (3>&1 1>&2 2>&3 3>&-) costs one F_DUPFD_CLOEXEC. A file
+ * that is already at its target fd isn't moved at all.
+ *
+ * A builtin doesn't get its fds swapped: it is given a per-invocation
+ * handle instead, struct bio_t. builtin_fd(n) is the fd it reads or writes
+ * as n, and stdout and stderr are FILEs on those fds for the duration of
+ * the call. Functions, !n and plugins run things that expect fds 0-2 to be
+ * set up, they still get the real thing, and their fds back afterwards.
+ */
+
+#define MAXREDIR    16      /* redirections per command */
+#define MAXMAP      (MAXREDIR * 2 + 2)  /* fds a plan may set */
+
+#define REDIR_OPEN  0       /* fd = open(path) */
+#define REDIR_DUP   1       /* fd = src */
+#define REDIR_CLOSE 2       /* fd closed */
+
+struct redir_t {
+    int op;
+    int fd;                 /* the fd it sets, -1 for both stdout and stderr (&>) */
+    int src;                /* REDIR_DUP */
+    int flags;              /* REDIR_OPEN: open() flags */
+    int word;               /* REDIR_OPEN: the path is redirection_str[word] + off, which */
+    int off;                /* survives expansion and the copies made by the script compiler */
+};
+
+struct cmd_t;
+
+struct bio_t {              /* the fds of a builtin invocation */
+    int fd[3];              /* what it uses as stdin, stdout, stderr, -1 if closed */
+    int opened[MAXREDIR];   /* files opened for it */
+    int opened_num;
+    bool real;
+    int saved_fd[MAXMAP];   /* real mode: the fds it sets, */
+    int saved[MAXMAP];      /* ... a copy of what the shell had there, -1 if closed */
+    int saved_num;
+    int prev_fd[3];         /* builtin_fd of the enclosing builtin */
+    FILE * out, * err;      /* the handle's stdout and stderr, NULL if it is the shell's */
+    FILE * prev_out, * prev_err;
+};
+
+bool plan_redir(struct cmd_t * cmd, bool expanded);
+int apply_redir(struct cmd_t * cmd, int in_fd, int out_fd);
+int open_bio(struct cmd_t * cmd, int in_fd, int out_fd, bool real, struct bio_t * io);
+void close_bio(struct bio_t * io);
+int builtin_fd(int fd);
+bool redirects(struct cmd_t * cmd, int fd);
+const char * redir_path(struct cmd_t * cmd, struct redir_t * r);
+
+#endif
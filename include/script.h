@@ -0,0 +1,83 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include "tsh.h"
+#include <stdbool.h>
+
+/*
+ * Command lines with control flow are compiled once into bytecode. The
+ * pipelines in them are parsed by parseline at compile time and kept as
+ * struct cmd_t arrays, so running a loop body never lexes it again; only
+ * words containing '$' are expanded on each run.
+ */
+
+/* Bytecode instructions */
+#define OP_EXEC     1   /* run pipeline arg, sets last_status */
+#define OP_JMP      2   /* jump to arg */
+#define OP_JZ       3   /* jump to arg if last_status is 0 */
+#define OP_JNZ      4   /* jump to arg if last_status is not 0 */
+#define OP_NOT      5   /* negate last_status */
+#define OP_STATUS   6   /* set last_status to arg */
+#define OP_FOR      7   /* start a for loop over word list arg */
+#define OP_NEXT     8   /* assign the next word of the loop over word list arg2, jump to arg when done */
+#define OP_POP      9   /* end the innermost for loop */
+#define OP_DEFUN   10   /* define function named arg2, whose body follows, then jump to arg */
+#define OP_RET     11   /* return from a function (or the end of the script) */
+
+#define PARSE_OK          0
+#define PARSE_INCOMPLETE  1   /* the text ends inside a compound command */
+#define PARSE_ERROR       2
+
+struct inst_t {             /* a bytecode instruction */
+    int op;
+    int arg;
+    int arg2;
+};
+
+struct pipeline_t {         /* a pipeline, parsed once by parseline */
+    struct cmd_t * cmd;
+    int cmd_num;
+    int process_num;
+    int bg;
+    bool has_dollar;        /* some word must be expanded on each run */
+    char * cmdline;         /* for the job list */
+};
+
+struct wordlist_t {         /* the words of a for loop */
+    char * var;
+    char ** words;          /* as typed, quotes included */
+    int word_num;           /* -1: loop over the positional parameters */
+};
+
+struct script_t {           /* a compiled command line */
+    struct inst_t * code;
+    int code_num, code_cap;
+    struct pipeline_t * pipes;
+    int pipe_num, pipe_cap;
+    struct wordlist_t * lists;
+    int list_num, list_cap;
+    char ** names;          /* function names */
+    int name_num, name_cap;
+    bool keep;              /* defines functions, must not be freed */
+    bool tail;              /* its last command may replace the process (a group's child) */
+};
+
+struct func_t {             /* a shell function */
+    char * name;
+    struct script_t * script;
+    int pc;                 /* first instruction of the body */
+    struct func_t * next;
+};
+
+bool is_script(const char * text);
+char * read_script(char * first_line, int emit_prompt);
+struct script_t * compile_script(const char * text, int * result);
+void free_script(struct script_t * script);
+void run_script(struct script_t * script, int pc);
+void eval_script(char * text);
+int run_list(const char * text, bool tail);
+
+struct func_t * get_function(const char * name);
+int call_function(char ** argv);
+
+#endif
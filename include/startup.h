@@ -0,0 +1,23 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <stdbool.h>
+
+/*
+ * Time to the first prompt, phase by phase (tsh --startup-profile). Each
+ * phase is the time since the end of the previous one, from the start of
+ * main(). Time spent waiting for the user (the login prompts) is not
+ * startup: it is left out of the phases and shown on its own line.
+ * What is deferred to its first use (the history, the shell's ./proc
+ * entry) isn't on the way to the prompt any more, it's not in the profile.
+ */
+
+#define MAXPHASES   16
+
+void startup_begin();
+void startup_phase(const char * name);
+void startup_pause();
+void startup_resume();
+void startup_report();
+
+#endif
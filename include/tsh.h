@@ -3,34 +3,44 @@
 
 #include <stdbool.h>
 #include <sys/types.h>
+#include <signal.h>
+#include "redir.h"
 
 #define MAXLINE    1024   /* max line size */
 #define MAXARGS     128   /* max args on a command line */
-#define MAXPIPES     16   /* max pipes per command line */
-#define UNUSEDFD     36   /* fd number that is guaranteed not to be used */  
 
 extern int verbose;
 extern int shell_pid;
 extern char * username;
+extern int last_status;
+extern pid_t last_job_pgid;
+extern volatile sig_atomic_t sigint_received;
 
 struct cmd_t {
     char * argv[MAXARGS];
     char * redirection_str[MAXARGS];
+    char * assign_str[MAXARGS];     /* name=value prefixes, only for this command */
+    struct redir_t redir[MAXREDIR]; /* redirection_str compiled, see redir.h */
+    int redir_num;                  /* -1: not compiled yet (a '$' in it), or bad */
     bool is_builtin;
 };
 
 void eval(char * cmdline);
+int run_pipeline(struct cmd_t * cmd, int cmd_num, int process_num, int bg, char * cmdline);
+void gate_next_pipeline(int gate[2]);
+void connect_next_pipeline(int in_fd, int out_fd);
+int max_stages(const char * cmdline);
 int parseline(const char * cmdline, struct cmd_t * cmd, int * cmd_num, int * process_num, bool * should_add_history); 
+int parse_words(char * buf, char * marked, struct cmd_t * cmd, int * cmd_num, int * process_num, bool * should_add_history);
 void set_is_builtin(struct cmd_t * cmd);
 void collect_redir_str(struct cmd_t * cmd);
+void collect_assign_str(struct cmd_t * cmd);
+bool expand_cmds(struct cmd_t * cmd, int cmd_num, int * process_num, char * pool, int size);
+void copy_cmds(struct cmd_t * dst, const struct cmd_t * src, int cmd_num);
 
-void setup_pipe_and_redir(int cmd_num, int cmd_idx, struct cmd_t * cmd, int pipes[][2]);
-void setup_redir(struct cmd_t * cmd);
-void save_fd();
-void restore_fd();
-void close_all_pipes(int pipes[][2], int num);
+void close_pipe_ends(int * in_fd, int * out_fd);
 
-void exec_builtin_cmd(char ** argv);
+int exec_builtin_cmd(char ** argv);
 void do_bgfg(char ** argv);
 void waitfg(pid_t pid);
 void do_quit();
@@ -0,0 +1,28 @@
+#ifndef TSH_PLUGIN_H
+#define TSH_PLUGIN_H
+
+/*
+ * The interface of loadable builtins. A plugin is a shared object that
+ * exports, for each builtin NAME it provides,
+ *
+ *     struct tsh_builtin tsh_builtin_NAME = {TSH_PLUGIN_ABI, "NAME", flags, run};
+ *
+ * and is loaded with enable -f lib.so NAME. run is called with the words
+ * of the command, stdin, stdout and stderr already set up for pipes and
+ * redirections, and returns the exit status. This header only grows:
+ * TSH_PLUGIN_ABI changes when an existing field does.
+ */
+
+#define TSH_PLUGIN_ABI      1
+
+#define TSH_BUILTIN_PURE    1   /* doesn't change the shell's state: in a pipeline or in the
+                                   background it runs in a child of its own, like echo or cat */
+
+struct tsh_builtin {
+    int abi;                    /* TSH_PLUGIN_ABI the plugin was built against */
+    const char * name;
+    int flags;                  /* TSH_BUILTIN_* */
+    int (*run)(char ** argv);
+};
+
+#endif
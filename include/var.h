@@ -0,0 +1,42 @@
+#ifndef VAR_H
+#define VAR_H
+
+#include <stdbool.h>
+
+#define VAR_BUCKETS    64   /* initial number of buckets of the symbol table */
+#define LITERAL_MARK '\001' /* precedes a '$' that must not be expanded */
+
+struct var_t {              /* a shell variable */
+    char * name;
+    char * value;
+    char * env_str;         /* "name=value", only kept for exported variables */
+    unsigned int hash;      /* cached hash of name */
+    bool exported;          /* passed to the environment of executed commands */
+    struct var_t * next;    /* next variable in the same bucket */
+};
+
+void init_vars(char ** envp);
+char * get_var(const char * name);
+char * get_var_n(const char * name, int len);
+void set_var(const char * name, const char * value, bool exported);
+void unset_var(const char * name);
+
+bool is_valid_name(const char * st, const char * end);
+bool is_assignment(const char * word);
+void assign_var(const char * word, bool exported);
+
+char ** var_envp();
+char ** var_envp_with(char ** assign_str);
+
+char ** swap_positional(char ** argv);
+int positional_num();
+char ** get_positional();
+int expand_word(const char * word, char * dst, int size);
+const char * arith_skip(const char * p);
+
+void do_assign(char ** argv);
+void do_export(char ** argv);
+void do_unset(char ** argv);
+void list_vars(bool exported_only);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef WARM_H
+#define WARM_H
+
+#include <stdint.h>
+
+/*
+ * ./home/<user>/.tsh_warm keeps caches that are slow to rebuild, so that
+ * a session starts with them warm. It is mapped read-only at login, and
+ * a cache is taken from it only if what it was built from hasn't changed,
+ * which the cache's owner checks itself with a stat() or so. The file is
+ * a header then sections, each an 8-byte aligned header and its data:
+ *
+ *   struct warm_head_t   WARM_MAGIC, WARM_VERSION, bytes of the file
+ *   struct warm_sect_t   id, bytes of data
+ *   data
+ *   ...
+ *
+ * A file of another version, or torn, is ignored as a whole. It is
+ * written again when the shell exits, to a temporary file renamed over it.
+ */
+
+#define WARM_MAGIC      0x6d726177  /* "warm" */
+#define WARM_VERSION    1
+#define WARM_MAXSIZE    (1 << 20)   /* larger files are not mapped */
+
+#define WARM_HISTORY    1           /* section: the history ring, see history.c */
+
+struct warm_head_t {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;
+};
+
+struct warm_sect_t {
+    uint32_t id;
+    uint32_t len;
+};
+
+void open_warm();
+const void * warm_section(uint32_t id, uint32_t * len);
+void save_warm();
+
+#endif
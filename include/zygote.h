@@ -0,0 +1,32 @@
+#ifndef ZYGOTE_H
+#define ZYGOTE_H
+
+#include "tsh.h"
+#include <stdbool.h>
+#include <sys/types.h>
+
+/*
+ * With -z, a helper process is forked before the shell has grown (no
+ * variables, history or job state yet) and external commands are spawned
+ * by it: the shell sends argv, envp, the redirections, the process group
+ * and the command's stdin, stdout and stderr (SCM_RIGHTS) over a
+ * socketpair, the helper clones the child with CLONE_PARENT and replies
+ * with its pid. The child is still the shell's child: SIGCHLD, waitpid
+ * and job control don't change. The cost of a spawn no longer depends on
+ * the size of the shell.
+ */
+
+#define ZYGOTE_MSG  (1 << 17)   /* max bytes of a request, larger ones are forked by the shell */
+
+struct zreq_t {             /* header of a request, followed by the strings, each '\0'-terminated */
+    pid_t pgid;             /* 0: the child leads a new process group */
+    int argc;
+    int envc;
+    int redirc;
+};
+
+void start_zygote();
+bool zygote_enabled();
+pid_t zygote_spawn(struct cmd_t * cmd, char ** envp, int fds[3], pid_t pgid);
+
+#endif
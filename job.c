@@ -1,7 +1,16 @@
 #include "job.h"
 #include "tsh.h"
+#include "joblog.h"
+#include "feed.h"
+#include "parallel.h"
+#include "buffer.h"
+#include "after.h"
+#include "coproc.h"
+#include "helper.h"
+#include "journal.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 struct job_t jobs[MAXJOBS]; /* The job list */
 int nextjid = 1;            /* next job ID to allocate */
@@ -17,6 +26,10 @@ void clearjob(struct job_t * job) {
     job->proc_num = 0;
     job->terminated_proc_num = 0;
     job->state = UNDEF;
+    job->status = 0;
+    job->log = NULL;
+    job->par = NULL;
+    job->buf = NULL;
     job->cmdline[0] = '\0';
 }
 
@@ -38,7 +51,11 @@ int maxjid(struct job_t * jobs) {
     return max;
 }
 
-/* addjob - Add a job to the job list */
+/*
+ * addjob - Add a job to the job list. Called with signals blocked: the
+ *     arrays of a slot are grown here and never freed, so that the SIGCHLD
+ *     handler doesn't have to call free().
+ */
 int addjob(struct job_t * jobs, pid_t pgid, int proc_num, int state, char * cmdline, pid_t * child_pid) {
     int i;
     
@@ -47,21 +64,43 @@ int addjob(struct job_t * jobs, pid_t pgid, int proc_num, int state, char * cmdl
 
     for (i = 0; i < MAXJOBS; i++) {  
         if (jobs[i].pgid == 0) {    // find an empty slot
+            if (proc_num > jobs[i].proc_cap) {
+                pid_t * pids = realloc(jobs[i].pids, sizeof(pid_t) * proc_num);
+                if (pids != NULL)
+                    jobs[i].pids = pids;
+                int * pipestatus = realloc(jobs[i].pipestatus, sizeof(int) * proc_num);
+                if (pipestatus != NULL)
+                    jobs[i].pipestatus = pipestatus;
+                if (pids == NULL || pipestatus == NULL) {
+                    print_error("addjob: out of memory\n");
+                    return 0;
+                }
+                jobs[i].proc_cap = proc_num;
+            }
             jobs[i].pgid = pgid;
             jobs[i].proc_num = proc_num;
             jobs[i].state = state;
             jobs[i].jid = nextjid++; 
             if (nextjid > MAXJOBS) 
                 nextjid = 1;
-            strcpy(jobs[i].cmdline, cmdline);
+            int len = strlen(cmdline);
+            if (len < MAXLINE) {
+                strcpy(jobs[i].cmdline, cmdline);
+            } else {    // only shown by jobs, cut it
+                memcpy(jobs[i].cmdline, cmdline, MAXLINE - 5);
+                strcpy(jobs[i].cmdline + MAXLINE - 5, "...\n");
+            }
 
             for(int child_idx = 0; child_idx < proc_num; child_idx++) {
                 jobs[i].pids[child_idx] = child_pid[child_idx]; 
+                jobs[i].pipestatus[child_idx] = 0;
             }
 
             if(verbose){
                 printf("Added job [%d] pgid: %d %s\n", jobs[i].jid, jobs[i].pgid, jobs[i].cmdline);
             }
+            publish_job(&jobs[i], UNDEF, state);
+            journal_job(&jobs[i]);
             return 1;
         }
     }
@@ -78,6 +117,15 @@ int deletejob(struct job_t * jobs, pid_t pgid) {
 
     for (i = 0; i < MAXJOBS; i++) {
         if (jobs[i].pgid == pgid) {
+            publish_job(&jobs[i], jobs[i].state, DONE);
+            if (jobs[i].log != NULL)
+                finish_joblog(&jobs[i]);
+            if (jobs[i].par != NULL)
+                finish_parallel(&jobs[i]);
+            if (jobs[i].buf != NULL)
+                finish_buffer(&jobs[i]);
+            after_job_done(&jobs[i]);
+            coproc_job_done(&jobs[i]);
             clearjob(&jobs[i]);
             nextjid = maxjid(jobs)+1; 
             return 1;
@@ -187,11 +235,18 @@ void listjobs(struct job_t * jobs) {
             case ST: 
                 printf("Stopped ");
                 break;
+            case WT: 
+                printf("Waiting ");
+                break;
             default:
                 printf("listjobs: Internal error: job[%d].state=%d ", 
                 i, jobs[i].state);
             }
             printf("%s", jobs[i].cmdline);
+            list_parallel(&jobs[i]);
+            list_buffer(&jobs[i]);
+            list_after(&jobs[i]);
+            list_coproc(&jobs[i]);
         }
     }
 }
@@ -207,7 +262,7 @@ pid_t check_suspend() {
 pid_t check_run() {
     int i;
     for (i = 0; i < MAXJOBS; i++)
-        if (jobs[i].state == FG || jobs[i].state == BG )
+        if (jobs[i].state == FG || jobs[i].state == BG || jobs[i].state == WT)
             return jobs[i].pgid;
     return 0;
 }
@@ -0,0 +1,313 @@
+#define _GNU_SOURCE
+
+#include "joblog.h"
+#include "job.h"
+#include "tsh.h"
+#include "var.h"
+#include "helper.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+
+static struct joblog_t * done_logs[JOBLOG_DONE];   /* logs of finished jobs, oldest first */
+static int done_num = 0;
+
+/* joblog_enabled - New background jobs get their output captured */
+bool joblog_enabled() {
+    char * value = get_var("TSH_JOBLOG");
+    return value != NULL && strcmp(value, "1") == 0;
+}
+
+static void write_all(int fd, const char * buf, long long n) {
+    while(n > 0) {
+        ssize_t w = write(fd, buf, n);
+        if(w < 0) {
+            if(errno == EINTR)
+                continue;
+            return;
+        }
+        buf += w;
+        n -= w;
+    }
+}
+
+static int open_spill() {
+    int fd = open("/tmp", O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if(fd < 0) {
+        char path[] = "/tmp/tsh-joblog-XXXXXX";
+        fd = mkstemp(path);
+        if(fd >= 0) {
+            unlink(path);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+    }
+    return fd;
+}
+
+/*
+ * spill - Move the n oldest bytes of the ring to the spill file. If the
+ *     file can't be written, everything spilled so far is lost.
+ */
+static void spill(struct joblog_t * log, long long n) {
+    if(log->spill_fd < 0 && log->lost == 0) {
+        log->spill_fd = open_spill();
+    }
+
+    while(n > 0) {
+        int pos = log->spilled % JOBLOG_RING;
+        long long seg = JOBLOG_RING - pos < n ? JOBLOG_RING - pos : n;
+
+        if(log->spill_fd >= 0 && pwrite(log->spill_fd, log->ring + pos, seg, log->spilled) != seg) {
+            close(log->spill_fd);
+            log->spill_fd = -1;
+        }
+        log->spilled += seg;
+        if(log->spill_fd < 0) {
+            log->lost = log->spilled;
+        }
+        n -= seg;
+    }
+}
+
+static void append_log(struct joblog_t * log, const char * data, int n) {
+    long long over = log->total + n - log->spilled - JOBLOG_RING;
+    if(over > 0) {
+        spill(log, over);
+    }
+
+    while(n > 0) {
+        int pos = log->total % JOBLOG_RING;
+        int seg = JOBLOG_RING - pos < n ? JOBLOG_RING - pos : n;
+        memcpy(log->ring + pos, data, seg);
+        log->total += seg;
+        data += seg;
+        n -= seg;
+    }
+}
+
+/* show_log - Write bytes [from, total) of the log to stdout */
+static void show_log(struct joblog_t * log, long long from) {
+    char buf[4096];
+
+    fflush(stdout);
+    if(from < log->lost) {
+        printf("[... %lld bytes lost]\n", log->lost - from);
+        fflush(stdout);
+        from = log->lost;
+    }
+
+    while(from < log->spilled) {
+        long long want = log->spilled - from < (long long)sizeof(buf) ? log->spilled - from : (long long)sizeof(buf);
+        ssize_t n = pread(log->spill_fd, buf, want, from);
+        if(n <= 0) {
+            from = log->spilled;
+            break;
+        }
+        write_all(builtin_fd(STDOUT_FILENO), buf, n);
+        from += n;
+    }
+
+    while(from < log->total) {
+        int pos = from % JOBLOG_RING;
+        long long seg = JOBLOG_RING - pos < log->total - from ? JOBLOG_RING - pos : log->total - from;
+        write_all(builtin_fd(STDOUT_FILENO), log->ring + pos, seg);
+        from += seg;
+    }
+}
+
+/*
+ * drain_joblog - Read everything the job has written so far. A job in the
+ *     foreground is connected to the terminal again: its output is shown
+ *     as well.
+ */
+static void drain_joblog(struct joblog_t * log, bool echo) {
+    char buf[4096];
+
+    while(log->fd >= 0) {
+        ssize_t n = read(log->fd, buf, sizeof(buf));
+        if(n > 0) {
+            append_log(log, buf, n);
+            if(echo) {
+                write_all(builtin_fd(STDOUT_FILENO), buf, n);
+                log->seen = log->total;
+            }
+        } else if(n == 0) {     // no writer left
+            close(log->fd);
+            log->fd = -1;
+        } else if(errno != EINTR) {
+            break;  // EAGAIN: nothing more for now
+        }
+    }
+}
+
+/*
+ * open_joblog - Create the log of a background job about to start, and
+ *     the pipe it writes to. Must be called with signals blocked.
+ */
+struct joblog_t * open_joblog(int * write_fd) {
+    int fds[2];
+
+    // forget the oldest finished logs, here rather than in the signal handlers
+    while(done_num > MAXJOBS) {
+        struct joblog_t * old = done_logs[0];
+        if(old->spill_fd >= 0)
+            close(old->spill_fd);
+        free(old->ring);
+        free(old);
+        memmove(done_logs, done_logs + 1, sizeof(done_logs[0]) * (--done_num));
+    }
+
+    if(pipe2(fds, O_CLOEXEC) < 0) {
+        print_error("joblog: cannot create a pipe, output goes to the terminal\n");
+        return NULL;
+    }
+    fcntl(fds[0], F_SETOWN, getpid());
+    fcntl(fds[0], F_SETFL, O_NONBLOCK | O_ASYNC);
+
+    struct joblog_t * log = calloc(1, sizeof(struct joblog_t));
+    if(log == NULL || (log->ring = malloc(JOBLOG_RING)) == NULL) {
+        unix_error("malloc");
+    }
+    log->fd = fds[0];
+    log->spill_fd = -1;
+
+    *write_fd = fds[1];
+    return log;
+}
+
+/* attach_joblog - Give the log to its job, once the job is in the job list */
+void attach_joblog(struct job_t * job, struct joblog_t * log) {
+    if(job == NULL) {
+        close(log->fd);
+        free(log->ring);
+        free(log);
+        return;
+    }
+
+    job->log = log;
+    log->jid = job->jid;
+    strcpy(log->cmdline, job->cmdline);
+}
+
+/*
+ * finish_joblog - The job is done: take what is left in the pipe and keep
+ *     the log among the finished ones. Called from deletejob.
+ */
+void finish_joblog(struct job_t * job) {
+    struct joblog_t * log = job->log;
+
+    drain_joblog(log, job->state == FG);
+    if(log->fd >= 0) {
+        close(log->fd);
+        log->fd = -1;
+    }
+
+    log->done = true;
+    done_logs[done_num++] = log;    // open_joblog keeps room for MAXJOBS more
+    job->log = NULL;
+}
+
+/* replay_joblog - fg: show what the job wrote since it was last looked at */
+void replay_joblog(struct job_t * job) {
+    if(job->log == NULL)
+        return;
+
+    drain_joblog(job->log, false);
+    show_log(job->log, job->log->seen);
+    job->log->seen = job->log->total;
+}
+
+/* find_log - The log of a running job (%jid or pgid), or of a finished one (%jid) */
+static struct joblog_t * find_log(char * str) {
+    struct job_t * job = pgidjid_str2job(str);
+
+    if(job != NULL && job->state != UNDEF)
+        return job->log;
+
+    if(str[0] == '%') {
+        int jid = atoi(str + 1);
+        for(int i = done_num - 1; i >= 0; i--) {
+            if(done_logs[i]->jid == jid)
+                return done_logs[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * do_joblog - joblog %jid [-f]: show the captured output of a job, and
+ *     with -f keep showing it until the job is done (or ctrl-c)
+ */
+int do_joblog(char ** argv) {
+    char * which = NULL;
+    bool follow = false;
+
+    for(int i = 1; argv[i] != NULL; i++) {
+        if(strcmp(argv[i], "-f") == 0) {
+            follow = true;
+        } else if(which == NULL) {
+            which = argv[i];
+        } else {
+            print_error("too many arguments\n");
+            return 1;
+        }
+    }
+    if(which == NULL) {
+        print_error("need more arguments\n");
+        return 1;
+    }
+
+    sigset_t mask, prev;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGIO);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigprocmask(SIG_BLOCK, &mask, &prev);
+
+    struct joblog_t * log = find_log(which);
+    if(log == NULL) {
+        print_error("no captured output for this job\n");
+        sigprocmask(SIG_SETMASK, &prev, NULL);
+        return 1;
+    }
+
+    drain_joblog(log, false);
+    show_log(log, 0);
+    log->seen = log->total;
+
+    // the log is freed by open_joblog only, it stays valid while we wait
+    while(follow && !log->done && !sigint_received) {
+        sigsuspend(&prev);
+        show_log(log, log->seen);
+        log->seen = log->total;
+    }
+
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+    return 0;
+}
+
+/*
+ * sigio_handler - Some job has written to its log pipe (or closed it).
+ *     Drain all of them.
+ */
+void sigio_handler(int sig) {
+    int olderrno = errno;
+    sigset_t mask_all, prev;
+
+    sigfillset(&mask_all);
+    sigprocmask(SIG_BLOCK, &mask_all, &prev);
+
+    for(int i = 0; i < MAXJOBS; i++) {
+        if(jobs[i].pgid != 0 && jobs[i].log != NULL) {
+            drain_joblog(jobs[i].log, jobs[i].state == FG);
+        }
+    }
+
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+    errno = olderrno;
+}
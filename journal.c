@@ -0,0 +1,169 @@
+#define _GNU_SOURCE
+
+#include "journal.h"
+#include "tsh.h"
+#include "job.h"
+#include "group.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static struct journal_head_t * head;    /* the file being written, NULL until the first exec */
+static struct journal_head_t * old;     /* the one before, still mapped for a writer that was interrupted */
+static int64_t session_start;
+static uint32_t seq = 0;
+static bool failed = false;             /* no journal can be written, don't try on every exec */
+static volatile int rotating = 0;
+
+static int64_t now_usec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* open_journal - Create, preallocate and map the next file of the session */
+static bool open_journal() {
+    char path[MAXLINE];
+
+    if(seq == 0) {
+        session_start = now_usec();
+        snprintf(path, sizeof(path), "./home/%s/.tsh_journal", username);
+        mkdir(path, 0700);
+    }
+    snprintf(path, sizeof(path), "./home/%s/.tsh_journal/%lld-%d.%u", username,
+             (long long)(session_start / 1000000), shell_pid, seq);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if(fd < 0)
+        return false;
+    if(posix_fallocate(fd, 0, JOURNAL_SIZE) != 0) {
+        close(fd);
+        unlink(path);
+        return false;
+    }
+    struct journal_head_t * h = mmap(NULL, JOURNAL_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(h == MAP_FAILED)
+        return false;
+
+    h->magic = JOURNAL_MAGIC;
+    h->version = JOURNAL_VERSION;
+    h->size = JOURNAL_SIZE;
+    h->used = (sizeof(struct journal_head_t) + JOURNAL_ALIGN - 1) & ~(uint64_t)(JOURNAL_ALIGN - 1);
+    h->start = session_start;
+    h->shell_pid = shell_pid;
+    h->seq = seq++;
+    snprintf(h->user, sizeof(h->user), "%s", username);
+
+    if(old != NULL)
+        munmap(old, JOURNAL_SIZE);
+    old = head;
+    __atomic_store_n(&head, h, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*
+ * reserve - Reserve size bytes for a record and set its size. NULL if
+ *     there is no journal, or the record is lost to a rotation going on.
+ */
+static struct journal_rec_t * reserve(int size) {
+    for(int tries = 0; tries < 2; tries++) {
+        struct journal_head_t * h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+        if(h == NULL)
+            return NULL;
+
+        uint64_t off = __atomic_fetch_add(&h->used, size, __ATOMIC_ACQ_REL);
+        if(off + size <= h->size) {
+            struct journal_rec_t * rec = (struct journal_rec_t *)((char *)h + off);
+            rec->size = size;
+            return rec;
+        }
+
+        // full: the shell opens the next file, unless it is already doing so (this
+        // interrupted it); a group's child gives up until its end, the file isn't its own
+        if(in_group || __atomic_exchange_n(&rotating, 1, __ATOMIC_ACQ_REL))
+            return NULL;
+        bool rotated = head != h || open_journal();
+        __atomic_store_n(&rotating, 0, __ATOMIC_RELEASE);
+        if(!rotated)
+            return NULL;
+    }
+    return NULL;
+}
+
+/* put - Append a record with strings, cut to fit */
+static void put(int type, pid_t pid, pid_t pgid, int jid, int status, char ** strs, int str_num) {
+    int len[256];
+    int size = sizeof(struct journal_rec_t);
+
+    if(str_num > 255)
+        str_num = 255;
+    for(int i = 0; i < str_num; i++) {
+        len[i] = strlen(strs[i]);
+        if(size + len[i] + 1 > JOURNAL_MAXREC)
+            len[i] = JOURNAL_MAXREC - size - 1 > 0 ? JOURNAL_MAXREC - size - 1 : 0;
+        size += len[i] + 1;
+    }
+    size = (size + JOURNAL_ALIGN - 1) & ~(JOURNAL_ALIGN - 1);
+
+    struct journal_rec_t * rec = reserve(size);
+    if(rec == NULL)
+        return;
+    rec->argc = str_num;
+    rec->pid = pid;
+    rec->pgid = pgid;
+    rec->jid = jid;
+    rec->status = status;
+    rec->reserved = 0;
+    rec->time = now_usec();
+
+    char * p = (char *)(rec + 1);
+    for(int i = 0; i < str_num; i++) {
+        memcpy(p, strs[i], len[i]);
+        p[len[i]] = '\0';
+        p += len[i] + 1;
+    }
+    __atomic_store_n(&rec->type, type, __ATOMIC_RELEASE);
+}
+
+/* prepare_journal - Create the journal now if it isn't yet, before forking a child that starts processes */
+void prepare_journal() {
+    if(head == NULL && !failed && !in_group && !open_journal())
+        failed = true;
+}
+
+/* journal_exec - A process has been started. The first one of the session creates the journal. */
+void journal_exec(pid_t pid, pid_t pgid, char ** argv) {
+    prepare_journal();
+    if(head == NULL)
+        return;
+
+    int argc = 0;
+    while(argv[argc] != NULL)
+        argc++;
+    put(JOURNAL_EXEC, pid, pgid, 0, 0, argv, argc);
+}
+
+/* journal_job - The processes of pgid are job jid. Called with signals blocked. */
+void journal_job(struct job_t * job) {
+    char cmdline[MAXLINE];
+    char * strs[1] = {cmdline};
+
+    if(head == NULL || in_group)   // the jobs of a group's child are part of the shell's
+        return;
+    snprintf(cmdline, sizeof(cmdline), "%s", job->cmdline);
+    cmdline[strcspn(cmdline, "\n")] = '\0';
+    put(JOURNAL_JOB, 0, job->pgid, job->jid, 0, strs, 1);
+}
+
+/* journal_exit - A process of a job has ended. Called in the SIGCHLD handler. */
+void journal_exit(pid_t pid, struct job_t * job, int status) {
+    put(JOURNAL_EXIT, pid, job->pgid, in_group ? 0 : job->jid, status, NULL, 0);
+}
@@ -0,0 +1,344 @@
+#define _GNU_SOURCE
+
+#include "jtop.h"
+#include "tsh.h"
+#include "job.h"
+#include "helper.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/resource.h>
+
+static struct jtop_proc_t * procs;  /* kept between refreshes, its files closed when jtop returns */
+static int proc_num = 0;
+static int proc_cap = 0;
+static long clk_tck;
+static long page_size;
+
+static double now_seconds(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void close_proc(struct jtop_proc_t * p) {
+    if(p->stat_fd >= 0)
+        close(p->stat_fd);
+    if(p->statm_fd >= 0)
+        close(p->statm_fd);
+    if(p->io_fd >= 0)
+        close(p->io_fd);
+    p->stat_fd = p->statm_fd = p->io_fd = -1;
+}
+
+/* open_proc_file - Open /proc/<pid>/name, noting in p why it can't be (but not that the process is gone) */
+static int open_proc_file(struct jtop_proc_t * p, const char * name) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/%s", (int)p->pid, name);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0 && errno != ENOENT && errno != ESRCH && p->err == 0) {
+        p->err = errno;
+        p->err_file = name;
+    }
+    return fd;
+}
+
+/* find_proc - The entry of pid, added with its files opened if it's new. NULL if out of memory. */
+static struct jtop_proc_t * find_proc(pid_t pid) {
+    for(int i = 0; i < proc_num; i++) {
+        if(procs[i].pid == pid)
+            return &procs[i];
+    }
+
+    if(proc_num == proc_cap) {
+        int cap = proc_cap == 0 ? 64 : proc_cap * 2;
+        struct jtop_proc_t * grown = realloc(procs, sizeof(*procs) * cap);
+        if(grown == NULL)
+            return NULL;
+        procs = grown;
+        proc_cap = cap;
+    }
+
+    struct jtop_proc_t * p = &procs[proc_num++];
+    memset(p, 0, sizeof(*p));
+    p->pid = pid;
+    p->stat_fd = open_proc_file(p, "stat");
+    p->statm_fd = open_proc_file(p, "statm");
+    p->io_fd = open_proc_file(p, "io");
+    return p;
+}
+
+/* close_procs - Close the files of every process, a stopped jtop doesn't hold any */
+static void close_procs() {
+    for(int i = 0; i < proc_num; i++) {
+        close_proc(&procs[i]);
+    }
+    proc_num = 0;
+}
+
+/* drop_unseen - Forget the processes that left the jobs */
+static void drop_unseen() {
+    for(int i = proc_num - 1; i >= 0; i--) {
+        if(!procs[i].seen) {
+            close_proc(&procs[i]);
+            procs[i] = procs[--proc_num];
+        }
+    }
+}
+
+/* pread_text - Read a /proc file from its start, '\0'-terminated. Return false if the process is gone. */
+static bool pread_text(int fd, char * buf, int size) {
+    if(fd < 0)
+        return false;
+    ssize_t n = pread(fd, buf, size - 1, 0);
+    if(n <= 0)
+        return false;
+    buf[n] = '\0';
+    return true;
+}
+
+/* sample - Read p's counters; interval is the time since the last refresh, 0 for the first one */
+static void sample(struct jtop_proc_t * p, double interval, double uptime) {
+    char buf[JTOP_BUF];
+    unsigned long long utime, stime, start;
+
+    if(p->stat_fd < 0 && p->err != 0)
+        return;             // not gone, just not readable
+    if(!pread_text(p->stat_fd, buf, sizeof(buf))) {
+        close_proc(p);      // reaped: /proc/<pid> is gone for good
+        p->state = '-';
+        p->cpu = 0;
+        return;
+    }
+
+    // comm is in parentheses and may contain anything, even ')'
+    char * open_paren = strchr(buf, '(');
+    char * close_paren = strrchr(buf, ')');
+    if(open_paren == NULL || close_paren == NULL || close_paren < open_paren)
+        return;
+    int len = close_paren - open_paren - 1;
+    if(len >= (int)sizeof(p->comm))
+        len = sizeof(p->comm) - 1;
+    memcpy(p->comm, open_paren + 1, len);
+    p->comm[len] = '\0';
+
+    if(sscanf(close_paren + 2, "%c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %*d %*d %*d %*d %*d %*d %llu",
+              &p->state, &utime, &stime, &start) != 4)
+        return;
+
+    unsigned long long ticks = utime + stime;
+    if(p->sampled && interval > 0) {
+        p->cpu = (ticks - p->prev_ticks) * 100.0 / clk_tck / interval;
+    } else {
+        // first look at it: the average over its lifetime, as ps does
+        double age = uptime - (double)start / clk_tck;
+        p->cpu = age > 0 ? ticks * 100.0 / clk_tck / age : 0;
+    }
+    p->prev_ticks = ticks;
+    p->sampled = true;
+
+    unsigned long long resident;
+    if(pread_text(p->statm_fd, buf, sizeof(buf)) && sscanf(buf, "%*u %llu", &resident) == 1)
+        p->rss = resident * page_size;
+
+    if(pread_text(p->io_fd, buf, sizeof(buf))) {
+        char * r = strstr(buf, "rchar:");
+        char * w = strstr(buf, "wchar:");
+        if(r != NULL)
+            p->rchar = strtoull(r + 6, NULL, 10);
+        if(w != NULL)
+            p->wchar = strtoull(w + 6, NULL, 10);
+    }
+}
+
+/* human - Format bytes as 512, 1.5K, 20.0M, 3.1G */
+static char * human(char * buf, unsigned long long bytes) {
+    const char * units = "KMGT";
+    double v = bytes;
+
+    if(bytes < 1024) {
+        sprintf(buf, "%llu", bytes);
+        return buf;
+    }
+    int u = -1;
+    while(v >= 1024 && u < 3) {
+        v /= 1024;
+        u++;
+    }
+    sprintf(buf, "%.1f%c", v, units[u]);
+    return buf;
+}
+
+static const char * job_state(int state) {
+    switch(state) {
+    case FG: return "FG";
+    case BG: return "BG";
+    case ST: return "ST";
+    case WT: return "WT";
+    default: return "?";
+    }
+}
+
+/* refresh - Sample every process of every job and print a screen */
+static void refresh(double interval, double cost, double every, bool clear) {
+    char rss[16], rd[16], wr[16];
+    double uptime = now_seconds(CLOCK_BOOTTIME);
+    int job_num = 0, total = 0;
+
+    for(int i = 0; i < proc_num; i++) {
+        procs[i].seen = false;
+    }
+
+    if(clear)
+        printf("\033[H\033[2J");
+    for(int i = 0; i < MAXJOBS; i++) {
+        if(jobs[i].pgid != 0) {
+            job_num++;
+            total += jobs[i].proc_num;
+        }
+    }
+    printf("jtop: %d jobs, %d processes, every %.1fs, sampling %.2f%% CPU\n", job_num, total, every, cost);
+    printf("%-12s %-3s %6s %8s %8s %8s  %s\n", "JOB/PID", "S", "CPU%", "RSS", "READ", "WRITE", "COMMAND");
+
+    for(int i = 0; i < MAXJOBS; i++) {
+        struct job_t * job = &jobs[i];
+        double cpu = 0;
+        unsigned long long rss_sum = 0, rd_sum = 0, wr_sum = 0;
+
+        if(job->pgid == 0)
+            continue;
+
+        for(int k = 0; k < job->proc_num; k++) {
+            struct jtop_proc_t * p = find_proc(job->pids[k]);
+            if(p == NULL)
+                continue;
+            p->seen = true;
+            sample(p, interval, uptime);
+            cpu += p->cpu;
+            rss_sum += p->rss;
+            rd_sum += p->rchar;
+            wr_sum += p->wchar;
+        }
+
+        char head[32];
+        snprintf(head, sizeof(head), "[%d] %d", job->jid, (int)job->pgid);
+        printf("%-12s %-3s %6.1f %8s %8s %8s  %s", head, job_state(job->state), cpu,
+               human(rss, rss_sum), human(rd, rd_sum), human(wr, wr_sum), job->cmdline);
+
+        for(int k = 0; k < job->proc_num; k++) {
+            struct jtop_proc_t * p = find_proc(job->pids[k]);
+            if(p == NULL)
+                continue;
+            if(p->err != 0) {
+                printf("    %-8d %-3c can't open /proc/%d/%s: %s\n", (int)p->pid, p->state ? p->state : '?',
+                       (int)p->pid, p->err_file, strerror(p->err));
+                continue;
+            }
+            printf("    %-8d %-3c %6.1f %8s %8s %8s  %s\n", (int)p->pid, p->state, p->cpu,
+                   human(rss, p->rss), human(rd, p->rchar), human(wr, p->wchar), p->comm);
+        }
+    }
+
+    drop_unseen();
+    fflush(stdout);
+}
+
+/* wait_key - Wait up to seconds for a key on the terminal. Return true to stop. */
+static bool wait_key(double seconds, bool tty) {
+    double until = now_seconds(CLOCK_MONOTONIC) + seconds;
+
+    for(;;) {
+        if(sigint_received)
+            return true;
+        double left = until - now_seconds(CLOCK_MONOTONIC);
+        if(left <= 0)
+            return false;
+
+        struct pollfd pfd = {builtin_fd(STDIN_FILENO), POLLIN, 0};
+        int n = poll(&pfd, tty ? 1 : 0, (int)(left * 1000) + 1);
+        if(n > 0) {
+            char key;
+            if(read(builtin_fd(STDIN_FILENO), &key, 1) == 1 && (key == 'q' || key == 'Q'))
+                return true;
+        }
+        // EINTR: a job changed state (SIGCHLD) or ctrl-c, look again
+    }
+}
+
+static double cpu_seconds() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+/* do_jtop - jtop [-d SECONDS] [-n COUNT] */
+int do_jtop(char ** argv) {
+    double every = 1;
+    bool tty_out = isatty(builtin_fd(STDOUT_FILENO));
+    bool tty_in = isatty(builtin_fd(STDIN_FILENO));
+    int count = tty_out ? 0 : 1;    // 0: until stopped
+
+    for(int i = 1; argv[i] != NULL; i++) {
+        if(strcmp(argv[i], "-d") == 0 && argv[i + 1] != NULL && strtod(argv[i + 1], NULL) > 0) {
+            every = strtod(argv[++i], NULL);
+        } else if(strcmp(argv[i], "-n") == 0 && argv[i + 1] != NULL && atoi(argv[i + 1]) > 0) {
+            count = atoi(argv[++i]);
+        } else {
+            print_error("usage: jtop [-d SECONDS] [-n COUNT]\n");
+            return 2;
+        }
+    }
+
+    if(clk_tck == 0) {
+        clk_tck = sysconf(_SC_CLK_TCK);
+        page_size = sysconf(_SC_PAGESIZE);
+    }
+
+    // q stops it without waiting for enter
+    struct termios saved;
+    if(tty_in && tcgetattr(builtin_fd(STDIN_FILENO), &saved) == 0) {
+        struct termios raw = saved;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(builtin_fd(STDIN_FILENO), TCSANOW, &raw);
+    } else {
+        tty_in = false;
+    }
+
+    sigset_t mask, prev;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+
+    double last = 0, last_cpu = cpu_seconds(), cost = 0;
+    for(int n = 0; count == 0 || n < count; n++) {
+        double now = now_seconds(CLOCK_MONOTONIC);
+
+        sigprocmask(SIG_BLOCK, &mask, &prev);   // the job list changes in the SIGCHLD handler
+        refresh(last > 0 ? now - last : 0, cost, every, tty_out);
+        sigprocmask(SIG_SETMASK, &prev, NULL);
+
+        // what the refreshes cost the shell, shown on the next screen
+        double cpu = cpu_seconds();
+        if(last > 0)
+            cost = (cpu - last_cpu) * 100 / (now - last);
+        last = now;
+        last_cpu = cpu;
+
+        if((count == 0 || n + 1 < count) && wait_key(every, tty_in))
+            break;
+    }
+
+    if(tty_in)
+        tcsetattr(builtin_fd(STDIN_FILENO), TCSANOW, &saved);
+    close_procs();
+    return 0;
+}
@@ -0,0 +1,424 @@
+#define _GNU_SOURCE
+
+#include "memo.h"
+#include "tsh.h"
+#include "var.h"
+#include "helper.h"
+#include "fastpath.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/***********************************************
+ * SHA-256
+ **********************************************/
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(struct sha256_t * ctx, const unsigned char * p) {
+    uint32_t w[64];
+    uint32_t s[8];
+
+    for(int i = 0; i < 16; i++)
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    for(int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    memcpy(s, ctx->state, sizeof(s));
+    for(int i = 0; i < 64; i++) {
+        uint32_t t1 = s[7] + (ROTR(s[4], 6) ^ ROTR(s[4], 11) ^ ROTR(s[4], 25)) + ((s[4] & s[5]) ^ (~s[4] & s[6])) + sha256_k[i] + w[i];
+        uint32_t t2 = (ROTR(s[0], 2) ^ ROTR(s[0], 13) ^ ROTR(s[0], 22)) + ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+        memmove(s + 1, s, sizeof(uint32_t) * 7);
+        s[4] += t1;
+        s[0] = t1 + t2;
+    }
+    for(int i = 0; i < 8; i++)
+        ctx->state[i] += s[i];
+}
+
+void sha256_init(struct sha256_t * ctx) {
+    static const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                     0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(ctx->state, init, sizeof(init));
+    ctx->len = 0;
+    ctx->buf_len = 0;
+}
+
+void sha256_update(struct sha256_t * ctx, const void * data, size_t len) {
+    const unsigned char * p = data;
+
+    ctx->len += len;
+    if(ctx->buf_len > 0) {
+        while(len > 0 && ctx->buf_len < 64) {
+            ctx->buf[ctx->buf_len++] = *p++;
+            len--;
+        }
+        if(ctx->buf_len < 64)
+            return;
+        sha256_block(ctx, ctx->buf);
+        ctx->buf_len = 0;
+    }
+    for(; len >= 64; p += 64, len -= 64)
+        sha256_block(ctx, p);
+    memcpy(ctx->buf, p, len);
+    ctx->buf_len = len;
+}
+
+void sha256_final(struct sha256_t * ctx, unsigned char digest[32]) {
+    uint64_t bits = ctx->len * 8;
+    unsigned char pad[72] = {0x80};
+    int pad_len = (ctx->buf_len < 56 ? 56 : 120) - ctx->buf_len;
+
+    for(int i = 0; i < 8; i++)
+        pad[pad_len + i] = bits >> (56 - 8 * i);
+    sha256_update(ctx, pad, pad_len + 8);
+
+    for(int i = 0; i < 8; i++) {
+        digest[4 * i] = ctx->state[i] >> 24;
+        digest[4 * i + 1] = ctx->state[i] >> 16;
+        digest[4 * i + 2] = ctx->state[i] >> 8;
+        digest[4 * i + 3] = ctx->state[i];
+    }
+}
+
+/***********************************************
+ * The cache
+ **********************************************/
+
+struct entry_t {            /* a cache entry, for eviction */
+    char name[72];
+    off_t size;
+    struct timespec used;   /* mtime, set on every hit */
+};
+
+static void memo_dir(char * path) {
+    sprintf(path, "./home/%s/.tsh_memo", username);
+}
+
+/* memo_max - The size bound of the cache: TSH_MEMO_MAX bytes, K, M or G suffixes allowed */
+static long long memo_max() {
+    char * value = get_var("TSH_MEMO_MAX");
+    char * end;
+
+    if(value == NULL || value[0] == '\0')
+        return MEMO_MAX;
+
+    long long max = strtoll(value, &end, 10);
+    switch(*end) {
+    case 'G': case 'g': max <<= 10;     // fall through
+    case 'M': case 'm': max <<= 10;     // fall through
+    case 'K': case 'k': max <<= 10;
+    }
+    return max;
+}
+
+static void hash_str(struct sha256_t * ctx, const char * s) {
+    sha256_update(ctx, s, strlen(s) + 1);
+}
+
+static void hash_identity(struct sha256_t * ctx, struct stat * st) {
+    char id[128];
+    sprintf(id, "%llu:%llu:%lld:%lld.%09ld", (unsigned long long)st->st_dev, (unsigned long long)st->st_ino,
+            (long long)st->st_size, (long long)st->st_mtim.tv_sec, st->st_mtim.tv_nsec);
+    hash_str(ctx, id);
+}
+
+/* hash_input - Key an input file on its content, or on its identity if it is large */
+static void hash_input(struct sha256_t * ctx, const char * path) {
+    struct stat st;
+    char buf[1 << 16];
+
+    hash_str(ctx, path);
+    if(stat(path, &st) != 0) {
+        hash_str(ctx, "missing");
+        return;
+    }
+    if(!S_ISREG(st.st_mode) || st.st_size > MEMO_HASH_MAX) {
+        hash_identity(ctx, &st);
+        return;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    ssize_t n;
+    if(fd < 0) {
+        hash_str(ctx, "unreadable");
+        return;
+    }
+    while((n = read(fd, buf, sizeof(buf))) > 0)
+        sha256_update(ctx, buf, n);
+    close(fd);
+}
+
+/*
+ * memo_key - The hex key of a pipeline: working directory, and for each
+ *     command its argv, environment prefixes, binary and redirections,
+ *     except the stdout target of the last command (out_idx)
+ */
+static void memo_key(struct cmd_t * cmd, int cmd_num, int out_idx, char * hex) {
+    struct sha256_t ctx;
+    unsigned char digest[32];
+    char cwd[MAXLINE];
+    struct stat st;
+
+    sha256_init(&ctx);
+    hash_str(&ctx, "tsh-memo-1");
+    hash_str(&ctx, getcwd(cwd, sizeof(cwd)) != NULL ? cwd : "");
+
+    for(int i = 0; i < cmd_num; i++) {
+        hash_str(&ctx, "|");
+        for(char ** w = cmd[i].argv; *w != NULL; w++)
+            hash_str(&ctx, *w);
+        hash_str(&ctx, "env");
+        for(char ** w = cmd[i].assign_str; *w != NULL; w++)
+            hash_str(&ctx, *w);
+
+        hash_str(&ctx, "bin");
+        if(cmd[i].argv[0] != NULL && stat(cmd[i].argv[0], &st) == 0) {
+            hash_identity(&ctx, &st);
+        }
+
+        for(int j = 0; j < cmd[i].redir_num; j++) {
+            struct redir_t * r = &cmd[i].redir[j];
+            char op[64];
+
+            if(i == cmd_num - 1 && j == out_idx)
+                continue;
+            sprintf(op, "%d %d %d %o", r->op, r->fd, r->src, r->flags);
+            hash_str(&ctx, op);
+            if(r->op != REDIR_OPEN)
+                continue;
+            hash_str(&ctx, redir_path(&cmd[i], r));
+            if((r->flags & O_ACCMODE) != O_WRONLY)
+                hash_input(&ctx, redir_path(&cmd[i], r));
+        }
+    }
+
+    sha256_final(&ctx, digest);
+    for(int i = 0; i < 32; i++)
+        sprintf(hex + 2 * i, "%02x", digest[i]);
+}
+
+/* replay - Copy a cached output to the stdout target: a file opened with flags, or our stdout */
+static int replay(int fd, const char * target, int flags) {
+    int out = STDOUT_FILENO;
+
+    fflush(stdout);
+    if(target != NULL) {
+        out = open(target, flags, 0666);   // as the redirection would
+        if(out < 0) {
+            char msg[MAXLINE + 50];
+            snprintf(msg, sizeof(msg), "memo: %s: %s\n", target, strerror(errno));
+            print_error(msg);
+            return 1;
+        }
+    }
+
+    int status = copy_fd(fd, out) < 0 ? 1 : 0;
+    if(out != STDOUT_FILENO)
+        close(out);
+    return status;
+}
+
+static int cmp_used(const void * a, const void * b) {
+    const struct entry_t * x = a, * y = b;
+    if(x->used.tv_sec != y->used.tv_sec)
+        return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+    return x->used.tv_nsec < y->used.tv_nsec ? -1 : x->used.tv_nsec > y->used.tv_nsec;
+}
+
+/*
+ * scan_cache - List the entries of the cache into *entries (to be freed),
+ *     return their number and their total size in *total
+ */
+static int scan_cache(const char * dir, struct entry_t ** entries, long long * total) {
+    DIR * d = opendir(dir);
+    struct dirent * de;
+    int num = 0, cap = 0;
+
+    *entries = NULL;
+    *total = 0;
+    if(d == NULL)
+        return 0;
+
+    while((de = readdir(d)) != NULL) {
+        struct stat st;
+        if(de->d_name[0] == '.' || strlen(de->d_name) >= sizeof((*entries)->name))
+            continue;
+        if(fstatat(dirfd(d), de->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode))
+            continue;
+
+        if(num == cap) {
+            cap = cap == 0 ? 64 : cap * 2;
+            *entries = realloc(*entries, sizeof(struct entry_t) * cap);
+            if(*entries == NULL) {
+                unix_error("realloc");
+            }
+        }
+        strcpy((*entries)[num].name, de->d_name);
+        (*entries)[num].size = st.st_size;
+        (*entries)[num].used = st.st_mtim;
+        *total += st.st_size;
+        num++;
+    }
+    closedir(d);
+    return num;
+}
+
+/* evict - Remove the least recently used entries until the cache fits in max bytes */
+static void evict(const char * dir, long long max) {
+    struct entry_t * entries;
+    long long total;
+    int num = scan_cache(dir, &entries, &total);
+
+    if(total > max) {
+        qsort(entries, num, sizeof(struct entry_t), cmp_used);
+        for(int i = 0; i < num && total > max; i++) {
+            char path[MAXLINE];
+            snprintf(path, sizeof(path), "%s/%s", dir, entries[i].name);
+            if(unlink(path) == 0)
+                total -= entries[i].size;
+        }
+    }
+    free(entries);
+}
+
+/* memo_info - memo without a command: describe the cache */
+static int memo_info(const char * dir) {
+    struct entry_t * entries;
+    long long total;
+    int num = scan_cache(dir, &entries, &total);
+
+    printf("memo: %d entries, %lld of %lld bytes in %s\n", num, total, memo_max(), dir);
+    free(entries);
+    return 0;
+}
+
+/*
+ * run_memo - Run a pipeline whose first word is memo: replay its cached
+ *     output, or run it with its stdout going to a new cache entry, then
+ *     copy the entry to where the stdout was meant to go
+ */
+int run_memo(struct cmd_t * cmd, int cmd_num, int bg, char * cmdline) {
+    char dir[MAXLINE], entry[MAXLINE], tmp[MAXLINE];
+    char hex[65];
+    struct cmd_t * last = &cmd[cmd_num - 1];
+    const char * target = NULL;   /* stdout target, NULL for our stdout */
+    int flags = 0;
+    int out_idx = -1;             /* its redirection in the plan */
+
+    memo_dir(dir);
+
+    // drop "memo"
+    char ** argv = cmd[0].argv;
+    for(int i = 0; argv[i] != NULL; i++)
+        argv[i] = argv[i + 1];
+    if(argv[0] == NULL) {
+        return last_status = memo_info(dir);
+    }
+    if(bg) {
+        print_error("memo: cannot run in the background\n");
+        return last_status = 1;
+    }
+
+    for(int i = 0; i < last->redir_num; i++) {
+        if(last->redir[i].fd == STDOUT_FILENO || last->redir[i].fd == -1)
+            out_idx = i;
+    }
+    if(out_idx >= 0 && last->redir[out_idx].op == REDIR_OPEN && last->redir[out_idx].fd == STDOUT_FILENO) {
+        target = redir_path(last, &last->redir[out_idx]);
+        flags = last->redir[out_idx].flags;
+    }
+
+    int process_num = 0;
+    for(int i = 0; i < cmd_num; i++) {
+        set_is_builtin(&cmd[i]);
+        if(!cmd[i].is_builtin)
+            process_num++;
+    }
+
+    if(out_idx >= 0 && target == NULL) {   // stdout is another fd (or with stderr), nothing we can replay into
+        return run_pipeline(cmd, cmd_num, process_num, bg, cmdline);
+    }
+
+    memo_key(cmd, cmd_num, out_idx, hex);
+    snprintf(entry, sizeof(entry), "%s/%s", dir, hex);
+
+    int fd = open(entry, O_RDONLY | O_CLOEXEC);
+    if(fd >= 0) {   // hit: mark it as recently used and replay it
+        utimensat(AT_FDCWD, entry, NULL, 0);
+        last_status = replay(fd, target, flags);
+        close(fd);
+        if(verbose) {
+            printf("memo: hit %s\n", hex);
+        }
+        return last_status;
+    }
+
+    // miss: the stdout of the pipeline goes to a new entry
+    mkdir(dir, 0755);
+    snprintf(tmp, sizeof(tmp), "%s/.tmp-%d", dir, (int)getpid());
+    char ** r = last->redirection_str;
+    if(out_idx < 0) {
+        // a first redirection, so that the others (2>&1) see it
+        int n = 0;
+        while(r[n] != NULL)
+            n++;
+        if(n + 1 >= MAXARGS || last->redir_num == MAXREDIR) {
+            print_error("memo: too many redirections\n");
+            return last_status = 1;
+        }
+        r[n] = tmp;
+        r[n + 1] = NULL;
+        memmove(last->redir + 1, last->redir, sizeof(struct redir_t) * last->redir_num);
+        last->redir_num++;
+        out_idx = 0;
+        last->redir[0].op = REDIR_OPEN;
+        last->redir[0].fd = STDOUT_FILENO;
+        last->redir[0].word = n;
+    } else {
+        r[last->redir[out_idx].word] = tmp;
+    }
+    last->redir[out_idx].off = 0;
+    last->redir[out_idx].flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+    int status = run_pipeline(cmd, cmd_num, process_num, 0, cmdline);
+
+    fd = open(tmp, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return last_status = status;
+    }
+    int replay_status = replay(fd, target, flags);
+
+    struct stat st;
+    if(status == 0 && replay_status == 0 && fstat(fd, &st) == 0 && st.st_size <= memo_max() && rename(tmp, entry) == 0) {
+        evict(dir, memo_max());
+    } else {
+        unlink(tmp);
+    }
+    close(fd);
+
+    if(verbose) {
+        printf("memo: miss %s\n", hex);
+    }
+    return last_status = status != 0 ? status : replay_status;
+}
@@ -0,0 +1,522 @@
+#define _GNU_SOURCE
+
+#include "parallel.h"
+#include "job.h"
+#include "tsh.h"
+#include "var.h"
+#include "helper.h"
+#include "fastpath.h"
+#include "builtin.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/***********************************************
+ * Shell side: the stats of the job's stages
+ **********************************************/
+
+bool is_parallel(struct cmd_t * cmd) {
+    return cmd->argv[0] != NULL && strcmp(cmd->argv[0], "parallel") == 0;
+}
+
+/* open_parallel - Stats shared with a parallel stage, to be created before forking it */
+struct parallel_t * open_parallel() {
+    struct parallel_t * par = mmap(NULL, sizeof(struct parallel_t), PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(par == MAP_FAILED) {
+        unix_error("mmap");
+    }
+    return par;     // zero-filled
+}
+
+static void close_parallel(struct parallel_t * par) {
+    while(par != NULL) {
+        struct parallel_t * next = par->next;
+        munmap(par, sizeof(struct parallel_t));
+        par = next;
+    }
+}
+
+/* attach_parallel - Give the stats of its stages to the job, once it is in the job list */
+void attach_parallel(struct job_t * job, struct parallel_t * par) {
+    if(job == NULL) {
+        close_parallel(par);
+        return;
+    }
+    job->par = par;
+}
+
+/* finish_parallel - The job is done, drop its stats. Called from deletejob. */
+void finish_parallel(struct job_t * job) {
+    if(verbose) {
+        list_parallel(job);
+    }
+    close_parallel(job->par);
+    job->par = NULL;
+}
+
+/* list_parallel - Print a line per worker of the job's parallel stages */
+void list_parallel(struct job_t * job) {
+    for(struct parallel_t * par = job->par; par != NULL; par = par->next) {
+        for(int i = 0; i < par->worker_num; i++) {
+            struct par_worker_t * w = &par->workers[i];
+            printf("    worker %d (%d): %d chunks, %lld bytes in, %lld bytes out, ",
+                   i + 1, (int)w->pid, w->chunks, w->bytes_in, w->bytes_out);
+            if(w->status < 0) {
+                printf("running\n");
+            } else {
+                printf("exit %d\n", w->status);
+            }
+        }
+    }
+}
+
+/***********************************************
+ * The stage
+ **********************************************/
+
+struct slot_t {             /* a worker, as seen by the stage */
+    pid_t pid;              /* 0 if none */
+    int in_fd;              /* its stdin, -1 once closed */
+    int out_fd;             /* its stdout, -1 at EOF */
+    char * in_buf;          /* chunk being written to it, NULL if none */
+    size_t in_len;
+    size_t in_off;
+    char * out_buf;         /* its output, not forwarded yet */
+    size_t out_len;
+    size_t out_cap;
+    long seq;               /* -k: number of its chunk */
+};
+
+static struct slot_t slots[PARALLEL_MAXJOBS];
+static int slot_num;
+static bool ordered;
+static struct parallel_t * stats;
+static int failure;         /* status of the first worker that failed */
+
+static char * pending;      /* input not handed out yet */
+static size_t pending_len;
+static size_t pending_cap;
+static bool in_eof;
+
+static long long parse_size(const char * s) {
+    char * end;
+    long long size = strtoll(s, &end, 10);
+
+    switch(*end) {
+    case 'G': case 'g': size <<= 10;    // fall through
+    case 'M': case 'm': size <<= 10;    // fall through
+    case 'K': case 'k': size <<= 10;
+    }
+    return size;
+}
+
+/* emit - Write to the stage's stdout. A closed reader ends the stage, as SIGPIPE would. */
+static void emit(const char * buf, size_t len) {
+    while(len > 0) {
+        ssize_t n = write(STDOUT_FILENO, buf, len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0)
+            exit(128 + SIGPIPE);
+        buf += n;
+        len -= n;
+    }
+}
+
+/* spawn - Start a worker in slot s, with pipes to its stdin and stdout */
+static bool spawn(struct cmd_t * cmd, char ** envp, int s) {
+    struct slot_t * slot = &slots[s];
+    int in[2], out[2];
+
+    if(pipe2(in, O_CLOEXEC) < 0)
+        return false;
+    if(pipe2(out, O_CLOEXEC) < 0) {
+        close(in[0]);
+        close(in[1]);
+        return false;
+    }
+
+    pid_t pid = fork();
+    if(pid < 0) {
+        close(in[0]);
+        close(in[1]);
+        close(out[0]);
+        close(out[1]);
+        return false;
+    }
+
+    if(pid == 0) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        // a worker run without exec must not hold the other workers' pipes open
+        for(int i = 0; i < slot_num; i++) {
+            if(slots[i].in_fd >= 0)
+                close(slots[i].in_fd);
+            if(slots[i].out_fd >= 0)
+                close(slots[i].out_fd);
+        }
+        close(in[0]);
+        close(in[1]);
+        close(out[0]);
+        close(out[1]);
+        Signal(SIGPIPE, SIG_DFL);
+
+        if(is_fastpath(cmd)) {
+            exit(exec_fastpath(cmd->argv));
+        }
+        if(is_pure_builtin(cmd)) {
+            int status = exec_builtin_cmd(cmd->argv);
+            fflush(stdout);
+            exit(status);
+        }
+        execve(cmd->argv[0], cmd->argv, envp);
+        char msg[MAXLINE + 30];
+        snprintf(msg, sizeof(msg), "%s: Command not found.\n", cmd->argv[0]);
+        print_error(msg);
+        exit(1);
+    }
+
+    close(in[0]);
+    close(out[1]);
+    fcntl(in[1], F_SETFL, O_NONBLOCK);
+    fcntl(out[0], F_SETFL, O_NONBLOCK);
+    slot->pid = pid;
+    slot->in_fd = in[1];
+    slot->out_fd = out[0];
+    stats->workers[s].pid = pid;
+    stats->workers[s].status = -1;
+    return true;
+}
+
+/* reap - Wait for the worker of slot s, which closed its stdout */
+static void reap(int s) {
+    struct slot_t * slot = &slots[s];
+    int status;
+
+    if(slot->in_fd >= 0) {
+        close(slot->in_fd);
+        slot->in_fd = -1;
+    }
+    free(slot->in_buf);
+    slot->in_buf = NULL;
+
+    while(waitpid(slot->pid, &status, 0) < 0 && errno == EINTR)
+        ;
+    int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    stats->workers[s].status = code;
+    if(code != 0 && failure == 0) {
+        failure = code;
+    }
+    slot->pid = 0;
+}
+
+/* feed - Write as much of its chunk as the worker of slot s takes */
+static void feed(int s) {
+    struct slot_t * slot = &slots[s];
+
+    while(slot->in_off < slot->in_len) {
+        ssize_t n = write(slot->in_fd, slot->in_buf + slot->in_off, slot->in_len - slot->in_off);
+        if(n > 0) {
+            slot->in_off += n;
+        } else if(n < 0 && errno == EINTR) {
+            continue;
+        } else if(n < 0 && errno == EAGAIN) {
+            return;
+        } else {    // the worker doesn't read anymore, drop the rest
+            close(slot->in_fd);
+            slot->in_fd = -1;
+            break;
+        }
+    }
+
+    free(slot->in_buf);
+    slot->in_buf = NULL;
+    if(ordered && slot->in_fd >= 0) {   // one chunk per worker
+        close(slot->in_fd);
+        slot->in_fd = -1;
+    }
+}
+
+/* drain - Read what the worker of slot s has written */
+static void drain(int s) {
+    struct slot_t * slot = &slots[s];
+
+    for(;;) {
+        if(slot->out_cap - slot->out_len < (1 << 16)) {
+            slot->out_cap = slot->out_cap == 0 ? (1 << 17) : slot->out_cap * 2;
+            slot->out_buf = realloc(slot->out_buf, slot->out_cap);
+            if(slot->out_buf == NULL) {
+                unix_error("realloc");
+            }
+        }
+
+        ssize_t n = read(slot->out_fd, slot->out_buf + slot->out_len, slot->out_cap - slot->out_len);
+        if(n > 0) {
+            slot->out_len += n;
+            stats->workers[s].bytes_out += n;
+        } else if(n == 0) {
+            close(slot->out_fd);
+            slot->out_fd = -1;
+            return;
+        } else if(errno != EINTR) {
+            return;
+        }
+    }
+}
+
+/* forward - Pass on the output of slot s: whole lines only, unless all */
+static void forward(int s, bool all) {
+    struct slot_t * slot = &slots[s];
+    size_t len = slot->out_len;
+
+    if(!all) {
+        while(len > 0 && slot->out_buf[len - 1] != '\n')
+            len--;
+    }
+    if(len == 0)
+        return;
+
+    emit(slot->out_buf, len);
+    memmove(slot->out_buf, slot->out_buf + len, slot->out_len - len);
+    slot->out_len -= len;
+}
+
+/*
+ * next_chunk - The length of the chunk at the head of the pending input:
+ *     about size bytes, cut after a newline. 0 if it needs more input.
+ */
+static size_t next_chunk(size_t size) {
+    if(pending_len == 0 || (pending_len < size && !in_eof))
+        return 0;
+    if(in_eof && pending_len <= size)
+        return pending_len;     // the end of the input
+
+    size_t limit = pending_len < size ? pending_len : size;
+    char * nl = memrchr(pending, '\n', limit);
+    if(nl == NULL)              // a record longer than a chunk
+        nl = memchr(pending + limit, '\n', pending_len - limit);
+    if(nl != NULL)
+        return nl - pending + 1;
+    return in_eof ? pending_len : 0;
+}
+
+/* read_input - Read the stage's stdin into the pending input */
+static void read_input() {
+    if(pending_len == pending_cap) {
+        pending_cap *= 2;
+        pending = realloc(pending, pending_cap);
+        if(pending == NULL) {
+            unix_error("realloc");
+        }
+    }
+
+    ssize_t n = read(STDIN_FILENO, pending + pending_len, pending_cap - pending_len);
+    if(n > 0) {
+        pending_len += n;
+    } else if(n == 0 || errno != EINTR) {
+        in_eof = true;
+    }
+}
+
+/* idle_slot - The next worker that can take a chunk, from slot from on, -1 if none */
+static int idle_slot(int from) {
+    for(int i = 0; i < slot_num; i++) {
+        int s = (from + i) % slot_num;
+        if(ordered ? slots[s].pid == 0 : slots[s].in_fd >= 0 && slots[s].in_buf == NULL)
+            return s;
+    }
+    return -1;
+}
+
+/* give - Hand the chunk at the head of the pending input to slot s */
+static void give(int s, size_t len, long seq) {
+    struct slot_t * slot = &slots[s];
+
+    slot->in_buf = malloc(len);
+    if(slot->in_buf == NULL) {
+        unix_error("malloc");
+    }
+    memcpy(slot->in_buf, pending, len);
+    slot->in_len = len;
+    slot->in_off = 0;
+    slot->seq = seq;
+    memmove(pending, pending + len, pending_len - len);
+    pending_len -= len;
+
+    stats->workers[s].chunks++;
+    stats->workers[s].bytes_in += len;
+    feed(s);
+}
+
+/* emit_ordered - -k: pass on the outputs of the chunks that are next in order */
+static void emit_ordered(long * next_seq) {
+    for(;;) {
+        int s;
+        for(s = 0; s < slot_num; s++) {
+            if(slots[s].pid != 0 && slots[s].seq == *next_seq)
+                break;
+        }
+        if(s == slot_num)
+            return;
+
+        forward(s, true);   // the oldest chunk streams out as it comes
+        if(slots[s].out_fd >= 0)
+            return;
+        reap(s);
+        (*next_seq)++;
+    }
+}
+
+/*
+ * exec_parallel - Run the parallel stage cmd in the current (child) process,
+ *     reporting to par. Return the exit status of the first worker that
+ *     failed, 0 if none did.
+ */
+int exec_parallel(struct cmd_t * cmd, struct parallel_t * par) {
+    char ** argv = cmd->argv;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int n = cpus > 0 ? cpus : 1;
+    long long size = PARALLEL_CHUNK;
+    int i;
+
+    for(i = 1; argv[i] != NULL && argv[i][0] == '-'; i++) {
+        if(strcmp(argv[i], "-k") == 0) {
+            ordered = true;
+        } else if(strcmp(argv[i], "-j") == 0 && argv[i + 1] != NULL) {
+            n = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "-b") == 0 && argv[i + 1] != NULL) {
+            size = parse_size(argv[++i]);
+        } else if(strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        } else {
+            n = 0;
+            break;
+        }
+    }
+    if(argv[i] == NULL || n < 1 || size < 1) {
+        print_error("usage: parallel [-j N] [-k] [-b SIZE] cmd [args]\n");
+        return 2;
+    }
+    if(n > PARALLEL_MAXJOBS) {
+        n = PARALLEL_MAXJOBS;
+    }
+
+    // the workers run the rest of the words; the stage's redirections are already in place
+    memmove(argv, argv + i, sizeof(char *) * (MAXARGS - i));
+    cmd->redirection_str[0] = NULL;
+    cmd->redir_num = 0;
+    char ** envp = cmd->assign_str[0] == NULL ? var_envp() : var_envp_with(cmd->assign_str);
+
+    Signal(SIGPIPE, SIG_IGN);   // a worker that quits early is handled by feed
+    stats = par;
+    stats->worker_num = n;
+    stats->ordered = ordered;
+    slot_num = n;
+    for(int s = 0; s < n; s++) {
+        slots[s].in_fd = slots[s].out_fd = -1;
+    }
+    for(int s = 0; s < n; s++) {
+        if(!ordered && !spawn(cmd, envp, s)) {
+            unix_error("parallel: fork");
+        }
+    }
+
+    pending_cap = 2 * size;
+    pending = malloc(pending_cap);
+    if(pending == NULL) {
+        unix_error("malloc");
+    }
+
+    struct pollfd fds[2 * PARALLEL_MAXJOBS + 1];
+    int fd_slot[2 * PARALLEL_MAXJOBS + 1];
+    long seq = 0, next_seq = 0;
+    int rr = 0;
+
+    for(;;) {
+        size_t len;
+        int s;
+        while((len = next_chunk(size)) > 0 && (s = idle_slot(rr)) >= 0) {
+            if(ordered && !spawn(cmd, envp, s)) {
+                unix_error("parallel: fork");
+            }
+            give(s, len, seq++);
+            rr = (s + 1) % slot_num;
+        }
+
+        // at the end of the input, the workers get EOF once their last chunk is written
+        if(in_eof && pending_len == 0 && !ordered) {
+            for(s = 0; s < slot_num; s++) {
+                if(slots[s].in_fd >= 0 && slots[s].in_buf == NULL) {
+                    close(slots[s].in_fd);
+                    slots[s].in_fd = -1;
+                }
+            }
+        }
+
+        int nfds = 0;
+        if(!in_eof && next_chunk(size) == 0) {
+            fds[nfds].fd = STDIN_FILENO;
+            fds[nfds].events = POLLIN;
+            fd_slot[nfds++] = -1;
+        }
+        for(s = 0; s < slot_num; s++) {
+            if(slots[s].in_buf != NULL && slots[s].in_fd >= 0) {
+                fds[nfds].fd = slots[s].in_fd;
+                fds[nfds].events = POLLOUT;
+                fd_slot[nfds++] = s;
+            }
+            if(slots[s].out_fd >= 0) {
+                fds[nfds].fd = slots[s].out_fd;
+                fds[nfds].events = POLLIN;
+                fd_slot[nfds++] = s;
+            }
+        }
+        if(nfds == 0)
+            break;
+
+        if(poll(fds, nfds, -1) < 0) {
+            if(errno == EINTR)
+                continue;
+            unix_error("parallel: poll");
+        }
+
+        for(int j = 0; j < nfds; j++) {
+            if(fds[j].revents == 0)
+                continue;
+            s = fd_slot[j];
+            if(s < 0) {
+                read_input();
+            } else if(fds[j].events == POLLOUT) {
+                feed(s);
+            } else {
+                drain(s);
+                if(!ordered) {
+                    forward(s, slots[s].out_fd < 0);
+                    if(slots[s].out_fd < 0)
+                        reap(s);
+                }
+            }
+        }
+        if(ordered) {
+            emit_ordered(&next_seq);
+        }
+    }
+
+    for(int s = 0; s < slot_num; s++) {
+        if(slots[s].pid != 0) {
+            forward(s, true);
+            reap(s);
+        }
+    }
+    return failure;
+}
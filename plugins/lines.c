@@ -0,0 +1,48 @@
+/*
+ * lines - count the lines of stdin, or of the files given, in the shell
+ *
+ *     make plugins
+ *     enable -f ./plugins/lines.so lines
+ *     /usr/bin/seq 1 1000 | lines
+ */
+#include "tsh_plugin.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static int count(int fd, long long * lines) {
+    char buf[1 << 16];
+    ssize_t n;
+
+    while((n = read(fd, buf, sizeof(buf))) > 0) {
+        for(char * p = buf; (p = memchr(p, '\n', buf + n - p)) != NULL; p++)
+            (*lines)++;
+    }
+    return n < 0 ? 1 : 0;
+}
+
+static int run(char ** argv) {
+    long long lines = 0;
+    int status = 0;
+
+    if(argv[1] == NULL) {
+        status = count(STDIN_FILENO, &lines);
+    }
+    for(int i = 1; argv[i] != NULL; i++) {
+        int fd = open(argv[i], O_RDONLY);
+        if(fd < 0) {
+            fprintf(stderr, "lines: cannot open %s\n", argv[i]);
+            status = 1;
+            continue;
+        }
+        status |= count(fd, &lines);
+        close(fd);
+    }
+
+    printf("%lld\n", lines);
+    return status;
+}
+
+struct tsh_builtin tsh_builtin_lines = {TSH_PLUGIN_ABI, "lines", TSH_BUILTIN_PURE, run};
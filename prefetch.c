@@ -0,0 +1,520 @@
+#define _GNU_SOURCE
+
+#include "prefetch.h"
+#include "tsh.h"
+#include "helper.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <elf.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#define RANKS           512     /* distinct executables ranked */
+#define DECAY           (1 - 0.693147 / PREFETCH_HALFLIFE)  /* halves in PREFETCH_HALFLIFE lines */
+#define IOPRIO_IDLE     ((3 << 13) | 7)     /* IOPRIO_CLASS_IDLE, for ioprio_set() */
+
+static struct prefetch_stat_t * pf;     /* NULL if off */
+static pid_t prefetch_pid = 0;
+static int execs = 0;   /* commands run since the first run finished */
+static int hits = 0;    /* ... that were in it */
+
+static const char * lib_dirs[] = {
+    "/lib/x86_64-linux-gnu", "/usr/lib/x86_64-linux-gnu", "/lib/aarch64-linux-gnu", "/usr/lib/aarch64-linux-gnu",
+    "/lib64", "/usr/lib64", "/lib", "/usr/lib", "/usr/local/lib", NULL
+};
+
+struct rank_t {
+    char path[PREFETCH_PATH];
+    double score;
+};
+
+struct run_t {              /* the state of a run, in the child */
+    struct rank_t * ranks;
+    int rank_num;
+    char (* queue)[PREFETCH_PATH];  /* files to fetch, binaries first, then libraries as they are found */
+    int queue_num;
+    dev_t dev[PREFETCH_MAXFILES];   /* files fetched, a library may have several names */
+    ino_t ino[PREFETCH_MAXFILES];
+    int file_num;
+    struct timespec start;
+    long page_size;
+};
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/***********************************************
+ * Ranking
+ **********************************************/
+
+static void add_rank(struct run_t * r, const char * path, int len, double w) {
+    if(len >= PREFETCH_PATH)
+        return;
+    for(int i = 0; i < r->rank_num; i++) {
+        if(strncmp(r->ranks[i].path, path, len) == 0 && r->ranks[i].path[len] == '\0') {
+            r->ranks[i].score += w;
+            return;
+        }
+    }
+    if(r->rank_num == RANKS)
+        return;
+    memcpy(r->ranks[r->rank_num].path, path, len);
+    r->ranks[r->rank_num].path[len] = '\0';
+    r->ranks[r->rank_num++].score = w;
+}
+
+/*
+ * rank_line - Count the executables a command line runs: the words in
+ *     command position (first, after | ; && || and keywords, in <(...),
+ *     after the words of memo, after ... -- and coproc NAME). tsh runs
+ *     commands by their path, only those starting with '/' are files.
+ */
+static void rank_line(struct run_t * r, const char * line, int len, double w) {
+    const char * seps = " \t";
+    bool command = true;
+    int skip = 0;           /* words to skip: 1 for coproc NAME, -1 up to -- */
+
+    for(int i = 0; i < len; ) {
+        while(i < len && strchr(seps, line[i]) != NULL)
+            i++;
+        int st = i;
+        while(i < len && strchr(seps, line[i]) == NULL)
+            i++;
+        const char * word = line + st;
+        int n = i - st;
+        if(n == 0)
+            break;
+
+        if(skip < 0) {
+            if(n == 2 && strncmp(word, "--", 2) == 0) {
+                skip = 0;
+                command = true;
+            }
+            continue;
+        }
+        if(skip > 0) {
+            skip--;
+            continue;
+        }
+
+        if((word[0] == '<' || word[0] == '>') && n > 2 && word[1] == '(') {
+            word += 2;
+            n -= 2;
+            command = true;
+        }
+        while(n > 0 && (word[n - 1] == ';' || word[n - 1] == ')'))
+            n--;
+
+        const char * keywords[] = {"|", ";", "&", "&&", "||", "then", "do", "else", "{", "(", "!", NULL};
+        bool keyword = false;
+        for(int k = 0; keywords[k] != NULL && !keyword; k++) {
+            keyword = (int)strlen(keywords[k]) == n && strncmp(word, keywords[k], n) == 0;
+        }
+        if(keyword) {
+            command = true;
+        } else if(command) {
+            const char * eq = memchr(word, '=', n);
+            if(eq != NULL && memchr(word, '/', eq - word) == NULL) {
+                continue;   // name=value prefix
+            }
+            if(n == 4 && strncmp(word, "memo", 4) == 0)
+                continue;
+            if((n == 5 && strncmp(word, "after", 5) == 0) || (n == 8 && strncmp(word, "after-ok", 8) == 0)) {
+                skip = -1;
+            } else if(n == 6 && strncmp(word, "coproc", 6) == 0) {
+                skip = 1;
+                continue;
+            } else if(word[0] == '/') {
+                add_rank(r, word, n, w);
+            }
+            command = false;
+        }
+        if(i < len && line[i - 1] == ';')
+            command = true;
+    }
+}
+
+/* rank_history - Rank the executables of the last PREFETCH_SCAN bytes of the history, the newest lines weigh most */
+static void rank_history(struct run_t * r) {
+    char path[MAXLINE];
+    struct stat st;
+
+    snprintf(path, sizeof(path), "./home/%s/.tsh_history", username);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0 || fstat(fd, &st) != 0) {
+        if(fd >= 0)
+            close(fd);
+        return;
+    }
+
+    off_t off = st.st_size > PREFETCH_SCAN ? st.st_size - PREFETCH_SCAN : 0;
+    char * buf = malloc(PREFETCH_SCAN);
+    ssize_t len = buf != NULL ? pread(fd, buf, PREFETCH_SCAN, off) : -1;
+    close(fd);
+    if(len <= 0) {
+        free(buf);
+        return;
+    }
+
+    char * first = buf;
+    if(off > 0) {   // starts in the middle of a line
+        char * nl = memchr(buf, '\n', len);
+        first = nl != NULL ? nl + 1 : buf + len;
+    }
+
+    // from the newest line back
+    double w = 1;
+    char * end = buf + len;
+    if(end > first && end[-1] == '\n')
+        end--;
+    while(end > first) {
+        char * nl = memrchr(first, '\n', end - first);
+        char * line = nl != NULL ? nl + 1 : first;
+        rank_line(r, line, end - line, w);
+        w *= DECAY;
+        end = nl != NULL ? nl : first;
+    }
+    free(buf);
+}
+
+static int cmp_score(const void * a, const void * b) {
+    const struct rank_t * x = a, * y = b;
+    return x->score < y->score ? 1 : x->score > y->score ? -1 : 0;
+}
+
+/***********************************************
+ * Fetching
+ **********************************************/
+
+static void push_file(struct run_t * r, const char * path) {
+    for(int i = 0; i < r->queue_num; i++) {
+        if(strcmp(r->queue[i], path) == 0)
+            return;
+    }
+    if(r->queue_num < PREFETCH_MAXFILES && strlen(path) < PREFETCH_PATH) {
+        strcpy(r->queue[r->queue_num++], path);
+    }
+}
+
+/* vaddr_off - The offset in the file of an address of its loaded image, 0 if it isn't in the file */
+static Elf64_Off vaddr_off(const Elf64_Phdr * ph, int ph_num, Elf64_Addr addr) {
+    for(int i = 0; i < ph_num; i++) {
+        if(ph[i].p_type == PT_LOAD && addr >= ph[i].p_vaddr && addr < ph[i].p_vaddr + ph[i].p_filesz)
+            return addr - ph[i].p_vaddr + ph[i].p_offset;
+    }
+    return 0;
+}
+
+/* find_lib - Resolve a DT_NEEDED name: the DT_RUNPATH directories, then the standard ones */
+static bool find_lib(const char * name, const char * runpath, const char * origin, char * path) {
+    struct stat st;
+
+    if(strchr(name, '/') != NULL) {
+        snprintf(path, PREFETCH_PATH, "%s", name);
+        return stat(path, &st) == 0;
+    }
+
+    const char * p = runpath;
+    while(p != NULL && *p != '\0') {
+        const char * colon = strchr(p, ':');
+        int n = colon != NULL ? colon - p : (int)strlen(p);
+        if(n > 7 && strncmp(p, "$ORIGIN", 7) == 0) {
+            snprintf(path, PREFETCH_PATH, "%s%.*s/%s", origin, n - 7, p + 7, name);
+        } else {
+            snprintf(path, PREFETCH_PATH, "%.*s/%s", n, p, name);
+        }
+        if(stat(path, &st) == 0)
+            return true;
+        p = colon != NULL ? colon + 1 : NULL;
+    }
+    for(int i = 0; lib_dirs[i] != NULL; i++) {
+        snprintf(path, PREFETCH_PATH, "%s/%s", lib_dirs[i], name);
+        if(stat(path, &st) == 0)
+            return true;
+    }
+    return false;
+}
+
+/* elf_deps - Queue the interpreter and the DT_NEEDED libraries of a mapped 64-bit ELF file */
+static void elf_deps(struct run_t * r, const unsigned char * map, size_t size, const char * file) {
+    const Elf64_Ehdr * eh = (const Elf64_Ehdr *)map;
+    char path[PREFETCH_PATH], origin[PREFETCH_PATH];
+
+    if(size < sizeof(Elf64_Ehdr) || memcmp(map, ELFMAG, SELFMAG) != 0 || map[EI_CLASS] != ELFCLASS64)
+        return;
+    if(eh->e_phentsize != sizeof(Elf64_Phdr) || eh->e_phoff + (size_t)eh->e_phnum * sizeof(Elf64_Phdr) > size)
+        return;
+
+    const Elf64_Phdr * ph = (const Elf64_Phdr *)(map + eh->e_phoff);
+    const Elf64_Phdr * dyn = NULL;
+    for(int i = 0; i < eh->e_phnum; i++) {
+        if(ph[i].p_type == PT_INTERP && ph[i].p_offset + ph[i].p_filesz <= size && ph[i].p_filesz > 0 &&
+           map[ph[i].p_offset + ph[i].p_filesz - 1] == '\0') {
+            push_file(r, (const char *)map + ph[i].p_offset);
+        } else if(ph[i].p_type == PT_DYNAMIC && ph[i].p_offset + ph[i].p_filesz <= size) {
+            dyn = &ph[i];
+        }
+    }
+    if(dyn == NULL)
+        return;
+
+    const Elf64_Dyn * d = (const Elf64_Dyn *)(map + dyn->p_offset);
+    int d_num = dyn->p_filesz / sizeof(Elf64_Dyn);
+    Elf64_Addr strtab = 0;
+    Elf64_Xword strsz = 0, runpath = 0;
+    bool has_runpath = false;
+    for(int i = 0; i < d_num && d[i].d_tag != DT_NULL; i++) {
+        if(d[i].d_tag == DT_STRTAB) {
+            strtab = d[i].d_un.d_ptr;
+        } else if(d[i].d_tag == DT_STRSZ) {
+            strsz = d[i].d_un.d_val;
+        } else if(d[i].d_tag == DT_RUNPATH || (d[i].d_tag == DT_RPATH && !has_runpath)) {
+            runpath = d[i].d_un.d_val;
+            has_runpath = true;
+        }
+    }
+    Elf64_Off str_off = vaddr_off(ph, eh->e_phnum, strtab);
+    if(str_off == 0 || str_off + strsz > size || strsz == 0 || map[str_off + strsz - 1] != '\0')
+        return;
+    const char * str = (const char *)map + str_off;
+
+    snprintf(origin, sizeof(origin), "%s", file);
+    char * slash = strrchr(origin, '/');
+    if(slash != NULL)
+        *slash = '\0';
+
+    for(int i = 0; i < d_num && d[i].d_tag != DT_NULL; i++) {
+        if(d[i].d_tag == DT_NEEDED && d[i].d_un.d_val < strsz &&
+           find_lib(str + d[i].d_un.d_val, has_runpath && runpath < strsz ? str + runpath : NULL, origin, path)) {
+            push_file(r, path);
+        }
+    }
+}
+
+/* pace - Sleep as long as reading ahead is ahead of PREFETCH_RATE */
+static void pace(struct run_t * r) {
+    double elapsed = now_seconds() - (r->start.tv_sec + r->start.tv_nsec / 1e9);
+    double ahead = (double)pf->read / PREFETCH_RATE - elapsed;
+    if(ahead > 0) {
+        struct timespec ts = {(time_t)ahead, (long)((ahead - (time_t)ahead) * 1e9)};
+        nanosleep(&ts, NULL);
+    }
+}
+
+/* fetch_file - Count what of a file is cached, read the rest ahead, queue its libraries */
+static void fetch_file(struct run_t * r, const char * path) {
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return;
+    }
+    for(int i = 0; i < r->file_num; i++) {
+        if(r->dev[i] == st.st_dev && r->ino[i] == st.st_ino) {
+            close(fd);
+            return;
+        }
+    }
+    r->dev[r->file_num] = st.st_dev;
+    r->ino[r->file_num++] = st.st_ino;
+
+    unsigned char * map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED) {
+        close(fd);
+        return;
+    }
+
+    size_t pages = (st.st_size + r->page_size - 1) / r->page_size;
+    unsigned char * vec = malloc(pages);
+    size_t cached = 0;
+    if(vec != NULL && mincore(map, st.st_size, vec) == 0) {
+        for(size_t i = 0; i < pages; i++) {
+            cached += vec[i] & 1;
+        }
+    }
+    free(vec);
+    unsigned long long cached_bytes = cached * r->page_size > (size_t)st.st_size ? (unsigned long long)st.st_size : cached * r->page_size;
+
+    pf->files++;
+    pf->bytes += st.st_size;
+    pf->cached += cached_bytes;
+
+    if(cached < pages) {
+        for(off_t off = 0; off < st.st_size; off += PREFETCH_CHUNK) {
+            if(pf->read >= PREFETCH_MAXBYTES) {
+                pf->capped = true;
+                break;
+            }
+            size_t n = st.st_size - off < PREFETCH_CHUNK ? st.st_size - off : PREFETCH_CHUNK;
+            readahead(fd, off, n);
+            pf->read += n;
+            pace(r);
+        }
+    }
+
+    elf_deps(r, map, st.st_size, path);
+    munmap(map, st.st_size);
+    close(fd);
+}
+
+/* run_prefetch - A run, in the child */
+static void run_prefetch() {
+    struct run_t * r = calloc(1, sizeof(struct run_t));
+    if(r == NULL || (r->ranks = malloc(sizeof(struct rank_t) * RANKS)) == NULL ||
+       (r->queue = malloc(PREFETCH_PATH * PREFETCH_MAXFILES)) == NULL) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &r->start);
+    r->page_size = sysconf(_SC_PAGESIZE);
+
+    rank_history(r);
+    qsort(r->ranks, r->rank_num, sizeof(struct rank_t), cmp_score);
+
+    struct prefetch_stat_t top;
+    int top_num = 0;
+    for(int i = 0; i < r->rank_num && top_num < PREFETCH_TOP; i++) {
+        struct stat st;
+        if(stat(r->ranks[i].path, &st) != 0 || !S_ISREG(st.st_mode) || access(r->ranks[i].path, X_OK) != 0)
+            continue;
+        strcpy(top.top[top_num], r->ranks[i].path);
+        top.score[top_num++] = r->ranks[i].score;
+        push_file(r, r->ranks[i].path);
+    }
+    pf->files = 0;
+    pf->bytes = pf->cached = pf->read = 0;
+    pf->capped = false;
+    pf->commands = top_num;
+    memcpy(pf->top, top.top, sizeof(top.top));
+    memcpy(pf->score, top.score, sizeof(top.score));
+    if(top_num < PREFETCH_TOP)
+        pf->top[top_num][0] = '\0';
+
+    // the queue grows with the libraries of what is fetched
+    for(int i = 0; i < r->queue_num; i++) {
+        fetch_file(r, r->queue[i]);
+    }
+}
+
+/***********************************************
+ * In the shell
+ **********************************************/
+
+/* init_prefetch - Map the page the children report into */
+void init_prefetch(bool enabled) {
+    if(!enabled)
+        return;
+    pf = mmap(NULL, sizeof(struct prefetch_stat_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(pf == MAP_FAILED) {
+        pf = NULL;
+    }
+}
+
+/* start_prefetch - Start a run in the background, unless one is going on */
+void start_prefetch() {
+    if(pf == NULL || (prefetch_pid > 0 && kill(prefetch_pid, 0) == 0))
+        return;
+
+    pf->runs++;
+    pf->started = now_seconds();
+    pid_t pid = fork();
+    if(pid < 0) {
+        return;     // it's only an optimization
+    }
+    if(pid > 0) {
+        prefetch_pid = pid;
+        return;
+    }
+
+    // out of the way of the jobs, the terminal and the user's I/O
+    setpgid(0, 0);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+    int null_fd = open("/dev/null", O_RDWR);
+    if(null_fd >= 0) {
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+    }
+    setpriority(PRIO_PROCESS, 0, 19);
+    syscall(SYS_ioprio_set, 1, 0, IOPRIO_IDLE);    // IOPRIO_WHO_PROCESS, this process
+
+    run_prefetch();
+    pf->seconds = now_seconds() - pf->started;
+    pf->done++;
+    _exit(0);
+}
+
+/* idle_prefetch - At a prompt: run again if the last run is old, the cache may have been dropped since */
+void idle_prefetch() {
+    if(pf != NULL && now_seconds() - pf->started >= PREFETCH_IDLE)
+        start_prefetch();
+}
+
+/* note_exec - A command is run: was it prefetched? */
+void note_exec(const char * path) {
+    if(pf == NULL || pf->done == 0 || path == NULL || path[0] != '/')
+        return;
+    execs++;
+    for(int i = 0; i < pf->commands && i < PREFETCH_TOP; i++) {
+        if(strcmp(pf->top[i], path) == 0) {
+            hits++;
+            return;
+        }
+    }
+}
+
+/* do_prefetch - prefetch [-l | -r] */
+int do_prefetch(char ** argv) {
+    if(pf == NULL) {
+        print_error("prefetch: off (--no-prefetch)\n");
+        return 1;
+    }
+
+    if(argv[1] != NULL && strcmp(argv[1], "-r") == 0 && argv[2] == NULL) {
+        start_prefetch();
+        return 0;
+    }
+    if(argv[1] != NULL && strcmp(argv[1], "-l") == 0 && argv[2] == NULL) {
+        for(int i = 0; i < pf->commands && i < PREFETCH_TOP; i++) {
+            printf("%8.2f  %s\n", pf->score[i], pf->top[i]);
+        }
+        return 0;
+    }
+    if(argv[1] != NULL) {
+        print_error("usage: prefetch [-l | -r]\n");
+        return 2;
+    }
+
+    double mb = 1024 * 1024;
+    if(pf->done < pf->runs) {
+        printf("prefetch: running for %.3fs\n", now_seconds() - pf->started);
+    }
+    if(pf->done == 0)
+        return 0;
+    printf("prefetch: %d runs, the last took %.3fs\n", pf->done, pf->seconds);
+    printf("prefetch: %d executables, %d files, %.1fM: %.1fM were cached (%.0f%%), %.1fM read ahead%s\n",
+           pf->commands, pf->files, pf->bytes / mb, pf->cached / mb,
+           pf->bytes > 0 ? pf->cached * 100.0 / pf->bytes : 100.0, pf->read / mb,
+           pf->capped ? " (capped)" : "");
+    printf("prefetch: %d of %d commands run since were prefetched (%.0f%%)\n",
+           hits, execs, execs > 0 ? hits * 100.0 / execs : 0.0);
+    return 0;
+}
@@ -3,6 +3,7 @@
 #include "job.h"
 #include "helper.h"
 #include <stdlib.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/stat.h>
@@ -28,8 +29,30 @@ void write_proc(char * name, pid_t pid, pid_t ppid, char * stat) {
     fclose(fp);
 }
 
+/*
+ * The shell's own entry is made when something first needs it: a job (its
+ * processes refer to it) or a change of its state, not before the first
+ * prompt.
+ */
+static bool shell_listed = false;
+static pid_t shell_ppid;
+
+void add_shell_proc(pid_t ppid) {
+    shell_ppid = ppid;
+}
+
+static void list_shell() {
+    if(!shell_listed) {
+        shell_listed = true;
+        add_proc("tsh", shell_pid, shell_ppid, "Rs+");
+    }
+}
+
 void change_proc_stat(pid_t pid, char * stat){
     char path[MAXLINE];
+    if(pid == shell_pid) {
+        list_shell();
+    }
     sprintf(path, "./proc/%d/status", pid);
 
     // check if the file exists (some processes in the process group may have terminated and their proc files have been removed)
@@ -55,6 +78,9 @@ void change_proc_stat(pid_t pid, char * stat){
 
 void add_proc(char * name, pid_t pid, pid_t ppid, char * stat){
     char path[MAXLINE];
+    if(pid != shell_pid) {
+        list_shell();
+    }
     sprintf(path, "./proc/%d", pid);
     if(mkdir(path, 0777)!=0){
         unix_error("mkdir error");
@@ -65,6 +91,9 @@ void add_proc(char * name, pid_t pid, pid_t ppid, char * stat){
 
 void remove_proc(pid_t pid){
     char path[MAXLINE];
+    if(pid == shell_pid && !shell_listed) {
+        return;
+    }
     sprintf(path, "./proc/%d/status", pid);
     if(remove(path) != 0){
         unix_error("remove error");
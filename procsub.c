@@ -0,0 +1,325 @@
+#define _GNU_SOURCE
+
+#include "procsub.h"
+#include "tsh.h"
+#include "helper.h"
+#include "proc.h"
+#include "var.h"
+#include "script.h"
+#include "after.h"
+#include "journal.h"
+#include "group.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+static int held[PROCSUB_MAXFD];     /* the pipe ends of substitutions the shell holds */
+static int held_num = 0;
+
+static void hold(int fd) {
+    if(held_num < PROCSUB_MAXFD)
+        held[held_num++] = fd;
+}
+
+/* release - Close a held fd */
+static void release(int fd) {
+    for(int i = 0; i < held_num; i++) {
+        if(held[i] == fd) {
+            held[i] = held[--held_num];
+            break;
+        }
+    }
+    close(fd);
+}
+
+/*
+ * procsub_end - Where the substitution word starts with ends: past the
+ *     ')' matching its '(', NULL if word doesn't start with <( or >( or
+ *     the ')' is missing.
+ */
+const char * procsub_end(const char * word) {
+    int depth = 0;
+
+    if((word[0] != '<' && word[0] != '>') || word[1] != '(')
+        return NULL;
+    for(const char * p = word + 1; *p != '\0'; p++) {
+        if(*p == '\'' || *p == '"') {
+            if((p = strchr(p + 1, *p)) == NULL)
+                return NULL;
+        } else if(*p == '(') {
+            depth++;
+        } else if(*p == ')' && --depth == 0) {
+            return p + 1;
+        }
+    }
+    return NULL;
+}
+
+/* is_procsub - word is <(...) or >(...) as a whole */
+bool is_procsub(const char * word) {
+    const char * end = procsub_end(word);
+    return end != NULL && *end == '\0';
+}
+
+bool has_procsub(struct cmd_t * cmd) {
+    for(char ** w = cmd->argv; *w != NULL; w++) {
+        if(is_procsub(*w))
+            return true;
+    }
+    return false;
+}
+
+/* parse_procsub - Parse and expand the pipeline of a substitution word. NULL if it can't run. */
+static struct procsub_t * parse_procsub(char * word, int * process_num) {
+    char msg[MAXLINE + 64];
+    int len = strlen(word) - 3;     // without <( and )
+    int pool_size = MAXLINE * 4 + len * 4;
+    struct procsub_t * s = calloc(1, sizeof(struct procsub_t));
+    if(s == NULL) {
+        unix_error("calloc");
+    }
+
+    s->dir = word[0];
+    s->word = word;
+    s->fd = -1;
+    s->line = malloc(len + 2);
+    s->marked = malloc((len + 2) * 2);
+    s->pool = malloc(pool_size);
+    if(s->line == NULL || s->marked == NULL || s->pool == NULL) {
+        unix_error("malloc");
+    }
+    memcpy(s->line, word + 2, len);
+    strcpy(s->line + len, "\n");
+    if((s->cmd = calloc(max_stages(s->line), sizeof(struct cmd_t))) == NULL) {
+        unix_error("calloc");
+    }
+
+    int inner_num = 0;
+    bool should_add_history;
+    msg[0] = '\0';
+    if(is_script(s->line)) {
+        snprintf(msg, sizeof(msg), "%.64s: only a pipeline can be substituted\n", word);
+    } else {
+        int bg = parse_words(s->line, s->marked, s->cmd, &s->cmd_num, &inner_num, &should_add_history);
+        if(s->cmd_num == 0) {
+            snprintf(msg, sizeof(msg), "%.64s: syntax error\n", word);
+        } else if(bg) {
+            snprintf(msg, sizeof(msg), "%.64s: can't run in the background\n", word);
+        } else if(!expand_cmds(s->cmd, s->cmd_num, &inner_num, s->pool, pool_size)) {
+            snprintf(msg, sizeof(msg), "%.64s: expansion failed\n", word);
+        } else if((inner_num = parse_procsubs(s->cmd, s->cmd_num, &s->subs)) < 0) {
+            free_procsubs(s);
+            return NULL;    // reported
+        }
+    }
+    if(msg[0] != '\0') {
+        print_error(msg);
+        free_procsubs(s);
+        return NULL;
+    }
+
+    // every stage gets a process, builtins too
+    *process_num = s->cmd_num + inner_num;
+    return s;
+}
+
+/*
+ * parse_procsubs - Parse the substitutions of a pipeline into a list. Return
+ *     how many processes they have, -1 if one of them can't run (reported).
+ */
+int parse_procsubs(struct cmd_t * cmd, int cmd_num, struct procsub_t ** subs) {
+    struct procsub_t ** tail = subs;
+    int process_num = 0;
+
+    *subs = NULL;
+    for(int i = 0; i < cmd_num; i++) {
+        for(int j = 0; cmd[i].argv[j] != NULL; j++) {
+            if(!is_procsub(cmd[i].argv[j]))
+                continue;
+
+            int n;
+            struct procsub_t * s = parse_procsub(cmd[i].argv[j], &n);
+            if(s == NULL) {
+                free_procsubs(*subs);
+                *subs = NULL;
+                return -1;
+            }
+            s->stage = i;
+            s->arg = j;
+            *tail = s;
+            tail = &s->next;
+            process_num += n;
+        }
+    }
+    return process_num;
+}
+
+/* close_held - In a child: close what the shell holds for other processes */
+static void close_held(int in_fd, int out_fd, struct procsub_t * own, int stage) {
+    for(int i = 0; i < held_num; i++) {
+        bool keep = held[i] == in_fd || held[i] == out_fd;
+        for(struct procsub_t * s = own; s != NULL && !keep; s = s->next) {
+            keep = s->stage == stage && s->fd == held[i];
+        }
+        if(!keep) {
+            close(held[i]);
+        }
+    }
+}
+
+/* start_inner - Start the pipeline of s, with end as its stdin (>) or stdout (<) */
+static void start_inner(struct procsub_t * s, int end, struct spawn_t * sp) {
+    int prev_in = -1;
+    char ** envp = var_envp();
+
+    for(int i = 0; i < s->cmd_num; i++) {
+        struct cmd_t * c = &s->cmd[i];
+
+        // the stage's own substitutions first, so that they don't get its pipe
+        start_procsubs(s->subs, s->cmd, i, sp);
+
+        int next[2] = {-1, -1};
+        if(i < s->cmd_num - 1 && pipe2(next, O_CLOEXEC)) {
+            unix_error("creating pipes failed");
+        }
+        int in_fd = (i == 0 && s->dir == '>') ? end : prev_in;
+        int out_fd = (i == s->cmd_num - 1 && s->dir == '<') ? end : next[1];
+
+        if(is_group(c)) {
+            prepare_journal();
+        }
+        pid_t pid = fork();
+        if(pid < 0) {
+            unix_error("fork");
+        }
+        if(pid == 0) {
+            sigprocmask(SIG_SETMASK, sp->mask, NULL);
+            if(sp->gate[0] >= 0) {
+                wait_gate(sp->gate);
+            }
+            if(sp->log_fd >= 0) {
+                if(s->dir == '>' && i == s->cmd_num - 1) {
+                    dup2(sp->log_fd, STDOUT_FILENO);
+                }
+                dup2(sp->log_fd, STDERR_FILENO);
+                close(sp->log_fd);
+            }
+            if(next[0] >= 0) {
+                close(next[0]);
+            }
+            close_held(in_fd, out_fd, s->subs, i);
+            if(apply_redir(c, in_fd, out_fd) < 0) {
+                exit(1);
+            }
+            keep_procsubs(s->subs, i);
+            setpgid(0, *sp->pgid);
+
+            if(is_group(c)) {
+                exit(run_group(c->argv[0]));
+            }
+
+            if(c->is_builtin) {
+                Signal(SIGINT, SIG_DFL);
+                Signal(SIGTSTP, SIG_DFL);
+                Signal(SIGQUIT, SIG_DFL);
+                Signal(SIGCHLD, SIG_DFL);
+                int status = exec_builtin_cmd(c->argv);
+                fflush(stdout);
+                exit(status);
+            }
+
+            char ** child_envp = c->assign_str[0] == NULL ? envp : var_envp_with(c->assign_str);
+            execve(c->argv[0], c->argv, child_envp);
+            char msg[MAXLINE + 30];
+            snprintf(msg, sizeof(msg), "%s: Command not found.\n", c->argv[0]);
+            print_error(msg);
+            exit(1);
+        }
+
+        if(*sp->pgid == 0) {
+            *sp->pgid = pid;
+        }
+        setpgid(pid, *sp->pgid);
+        sp->pids[(*sp->pid_num)++] = pid;
+        add_proc(c->argv[0] != NULL ? c->argv[0] : "tsh", pid, shell_pid, sp->stat);
+        journal_exec(pid, *sp->pgid, c->argv);
+
+        close_procsubs(s->subs, s->cmd, i);
+        if(prev_in >= 0) {
+            close(prev_in);
+        }
+        if(next[1] >= 0) {
+            close(next[1]);
+        }
+        prev_in = next[0];
+    }
+}
+
+/*
+ * start_procsubs - Start the substitutions of a stage, right before it,
+ *     and replace their words in its argv with /dev/fd/N. Called with
+ *     signals blocked.
+ */
+void start_procsubs(struct procsub_t * subs, struct cmd_t * cmd, int stage, struct spawn_t * sp) {
+    for(struct procsub_t * s = subs; s != NULL; s = s->next) {
+        if(s->stage != stage)
+            continue;
+
+        int p[2];
+        if(pipe2(p, O_CLOEXEC)) {
+            unix_error("creating pipes failed");
+        }
+        int mine = s->dir == '<' ? p[0] : p[1];
+        int end = s->dir == '<' ? p[1] : p[0];
+        if((s->fd = fcntl(mine, F_DUPFD_CLOEXEC, PROCSUB_FD)) < 0) {
+            unix_error("fcntl");
+        }
+        close(mine);
+        hold(s->fd);
+        hold(end);
+
+        start_inner(s, end, sp);
+        release(end);
+
+        snprintf(s->path, sizeof(s->path), "/dev/fd/%d", s->fd);
+        cmd[stage].argv[s->arg] = s->path;
+    }
+}
+
+/* keep_procsubs - In the child of a stage: keep its substitutions open across exec */
+void keep_procsubs(struct procsub_t * subs, int stage) {
+    for(struct procsub_t * s = subs; s != NULL; s = s->next) {
+        if(s->stage == stage && s->fd >= 0)
+            fcntl(s->fd, F_SETFD, 0);
+    }
+}
+
+/* close_procsubs - The stage has been started (or has run): close its ends, put its words back */
+void close_procsubs(struct procsub_t * subs, struct cmd_t * cmd, int stage) {
+    for(struct procsub_t * s = subs; s != NULL; s = s->next) {
+        if(s->stage != stage || s->fd < 0)
+            continue;
+        release(s->fd);
+        s->fd = -1;
+        cmd[stage].argv[s->arg] = s->word;
+    }
+}
+
+void free_procsubs(struct procsub_t * subs) {
+    while(subs != NULL) {
+        struct procsub_t * next = subs->next;
+        if(subs->fd >= 0) {
+            release(subs->fd);
+        }
+        free_procsubs(subs->subs);
+        free(subs->cmd);
+        free(subs->line);
+        free(subs->marked);
+        free(subs->pool);
+        free(subs);
+        subs = next;
+    }
+}
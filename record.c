@@ -0,0 +1,289 @@
+#define _GNU_SOURCE
+
+#include "record.h"
+#include "tsh.h"
+#include "helper.h"
+#include "history.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+static int record_fd = -1;          /* the recording, -1 if off */
+static struct timespec record_start;
+
+/* since - Seconds from start to now */
+static double since(const struct timespec * start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/***********************************************
+ * Recording
+ **********************************************/
+
+/* open_record - Start recording the session to path */
+int open_record(const char * path) {
+    char head[64];
+
+    record_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(record_fd < 0) {
+        char msg[MAXLINE + 64];
+        snprintf(msg, sizeof(msg), "record: %s: %s\n", path, strerror(errno));
+        print_error(msg);
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &record_start);
+
+    int len = snprintf(head, sizeof(head), "#tsh-record %d %ld\n", RECORD_VERSION, (long)time(NULL));
+    write(record_fd, head, len);
+    return 0;
+}
+
+/*
+ * put_event - Append "SECONDS kind text" as one line. A single write(), so
+ *     that the events written by the SIGCHLD handler never land in the
+ *     middle of a line.
+ */
+static void put_event(const char * kind, const char * text, int text_len) {
+    char stack[512];
+    char * line = stack;
+    int cap = 64 + text_len;
+
+    if(cap > (int)sizeof(stack) && (line = malloc(cap)) == NULL)
+        return;
+
+    int len = snprintf(line, 64, "%.6f %s ", since(&record_start), kind);
+    memcpy(line + len, text, text_len);
+    len += text_len;
+    line[len++] = '\n';
+    write(record_fd, line, len);
+
+    if(line != stack)
+        free(line);
+}
+
+/* record_input - Record a command line, before it is evaluated */
+void record_input(const char * cmdline) {
+    if(record_fd < 0)
+        return;
+
+    int len = strlen(cmdline);
+    if(len > 0 && cmdline[len - 1] == '\n')
+        len--;
+
+    char * text = malloc(len * 2 + 1);
+    if(text == NULL)
+        return;
+
+    int n = 0;
+    for(int i = 0; i < len; i++) {
+        if(cmdline[i] == '\n') {
+            text[n++] = '\\';
+            text[n++] = 'n';
+        } else if(cmdline[i] == '\\') {
+            text[n++] = '\\';
+            text[n++] = '\\';
+        } else {
+            text[n++] = cmdline[i];
+        }
+    }
+    put_event("in", text, n);
+    free(text);
+}
+
+/* record_status - Record $? after a command line */
+void record_status(int status) {
+    char text[16];
+
+    if(record_fd < 0)
+        return;
+    put_event("status", text, sprintf(text, "%d", status));
+}
+
+/* record_job - Record a job state change. Called with signals blocked. */
+void record_job(struct job_t * job, const char * old_state, const char * new_state) {
+    char text[64];
+    char status[16];
+
+    if(record_fd < 0)
+        return;
+
+    if(strcmp(new_state, "done") == 0) {
+        sprintf(status, "%d", job->status);
+    } else {
+        strcpy(status, "-");
+    }
+    put_event("job", text, snprintf(text, sizeof(text), "%d %d %s %s %s",
+                                    job->jid, (int)job->pgid, old_state, new_state, status));
+}
+
+void close_record() {
+    if(record_fd >= 0) {
+        close(record_fd);
+        record_fd = -1;
+    }
+}
+
+/***********************************************
+ * Replay
+ **********************************************/
+
+static struct {
+    pid_t pid;              /* the shell, children exit() too */
+    struct timespec start;
+    double speed;           /* 0: --max */
+    double recorded;        /* time of the last command line in the recording */
+    int commands;
+    int checked;            /* command lines with a recorded status */
+    int differ;             /* ... which was not $? of the replay */
+    double lag_max;
+    double lag_sum;
+    double lag_last;
+} replay;
+
+/* unescape - Undo the escaping of record_input in place */
+static void unescape(char * text) {
+    char * out = text;
+
+    for(char * p = text; *p != '\0'; p++) {
+        if(*p == '\\' && p[1] == 'n') {
+            *out++ = '\n';
+            p++;
+        } else if(*p == '\\' && p[1] == '\\') {
+            *out++ = '\\';
+            p++;
+        } else {
+            *out++ = *p;
+        }
+    }
+    *out = '\0';
+}
+
+/* wait_until - Sleep until seconds after the start of the replay */
+static void wait_until(double seconds) {
+    struct timespec at = replay.start;
+
+    at.tv_sec += (time_t)seconds;
+    at.tv_nsec += (long)((seconds - (time_t)seconds) * 1e9);
+    if(at.tv_nsec >= 1000000000) {
+        at.tv_sec++;
+        at.tv_nsec -= 1000000000;
+    }
+    // SIGCHLD of background jobs interrupts the sleep
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL) == EINTR)
+        ;
+}
+
+/* report_replay - Print how the replay kept up. Also runs if it ends with quit. */
+static void report_replay() {
+    if(getpid() != replay.pid)
+        return;
+
+    double wall = since(&replay.start);
+    if(replay.speed > 0) {
+        printf("replay: %d commands in %.3fs (recorded %.3fs, speed %gx)\n",
+               replay.commands, wall, replay.recorded, replay.speed);
+        printf("replay: behind schedule: max %.3fs, mean %.3fs, last %.3fs\n",
+               replay.lag_max, replay.commands > 0 ? replay.lag_sum / replay.commands : 0, replay.lag_last);
+    } else {
+        printf("replay: %d commands in %.3fs (recorded %.3fs, %.1fx real time, %.1f commands/s)\n",
+               replay.commands, wall, replay.recorded, wall > 0 ? replay.recorded / wall : 0,
+               wall > 0 ? replay.commands / wall : 0);
+    }
+    printf("replay: %d of %d exit statuses differ from the recording\n", replay.differ, replay.checked);
+    fflush(stdout);
+}
+
+/*
+ * replay_session - Eval the command lines recorded in path, speed times
+ *     faster than they were typed (0: one after the other), then report.
+ *     Return non-zero if the file can't be replayed.
+ */
+int replay_session(const char * path, double speed) {
+    char msg[MAXLINE + 64];
+    char * line = NULL;
+    size_t cap = 0;
+    int version = 0;
+    bool pending = false;   /* a command line ran, its status is next */
+
+    FILE * f = fopen(path, "r");
+    if(f == NULL) {
+        snprintf(msg, sizeof(msg), "replay: %s: %s\n", path, strerror(errno));
+        print_error(msg);
+        return 1;
+    }
+    if(getline(&line, &cap, f) < 0 || sscanf(line, "#tsh-record %d", &version) != 1 || version != RECORD_VERSION) {
+        snprintf(msg, sizeof(msg), "replay: %s: not a tsh recording of version %d\n", path, RECORD_VERSION);
+        print_error(msg);
+        free(line);
+        fclose(f);
+        return 1;
+    }
+
+    replay.pid = getpid();
+    replay.speed = speed;
+    clock_gettime(CLOCK_MONOTONIC, &replay.start);
+    atexit(report_replay);
+
+    ssize_t len;
+    while((len = getline(&line, &cap, f)) >= 0) {
+        double at;
+        int skip;
+
+        if(len > 0 && line[len - 1] == '\n') {
+            line[--len] = '\0';
+        } else if((size_t)len + 2 > cap) {  // the last line: make room for the '\n' eval wants
+            cap = len + 2;
+            if((line = realloc(line, cap)) == NULL)
+                unix_error("realloc");
+        }
+        if(line[0] == '#' || sscanf(line, "%lf %n", &at, &skip) != 1)
+            continue;
+        char * kind = line + skip;
+
+        if(strncmp(kind, "status ", 7) == 0) {
+            if(pending) {
+                replay.checked++;
+                if(atoi(kind + 7) != last_status)
+                    replay.differ++;
+            }
+            pending = false;
+        } else if(strncmp(kind, "in ", 3) == 0) {
+            char * cmdline = kind + 3;
+            unescape(cmdline);
+            strcat(cmdline, "\n");
+
+            replay.recorded = at;
+            if(speed > 0) {
+                wait_until(at / speed);
+                double lag = since(&replay.start) - at / speed;
+                if(lag < 0)
+                    lag = 0;
+                if(lag > replay.lag_max)
+                    replay.lag_max = lag;
+                replay.lag_sum += lag;
+                replay.lag_last = lag;
+            }
+
+            replay.commands++;     // before eval: quit doesn't come back
+            record_input(cmdline);
+            sigint_received = 0;
+            eval(cmdline);
+            finish_history();
+            record_status(last_status);
+            fflush(stdout);
+            pending = true;
+        }
+        // job lines are what the shell did, not input: nothing to replay
+    }
+
+    free(line);
+    fclose(f);
+    return 0;
+}
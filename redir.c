@@ -0,0 +1,487 @@
+#define _GNU_SOURCE
+
+#include "redir.h"
+#include "tsh.h"
+#include "var.h"
+#include "helper.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define CLOSED      INT_MIN         /* symbolic value of a closed fd */
+#define FILE_OF(k)  (-2 - (k))      /* ... of the file opened by redirection k */
+
+static int cur_fd[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};   /* builtin_fd */
+
+/***********************************************
+ * Compiling
+ **********************************************/
+
+/* has_dollar - Is w expanded later */
+static bool has_dollar(const char * w) {
+    return strchr(w, '$') != NULL || strchr(w, LITERAL_MARK) != NULL;
+}
+
+/*
+ * parse_one - Compile the redirection that starts at words[i] into r.
+ *     Return the index of the word after it, -1 on a syntax error, -2 if
+ *     it can only be compiled after expansion.
+ */
+static int parse_one(char ** words, int i, struct redir_t * r) {
+    char * p = words[i];
+    int fd = -2;            /* -2: the operator's default */
+    bool both = false, dup = false;
+    int def;
+
+    if(p[0] == '&' && p[1] == '>') {
+        both = true;
+        p++;
+    } else if(isdigit((unsigned char)*p)) {
+        fd = strtol(p, &p, 10);
+    }
+
+    memset(r, 0, sizeof(*r));
+    if(strncmp(p, "<>", 2) == 0 && !both) {
+        r->flags = O_RDWR | O_CREAT;
+        def = STDIN_FILENO;
+        p += 2;
+    } else if(strncmp(p, ">>", 2) == 0) {
+        r->flags = O_WRONLY | O_CREAT | O_APPEND;
+        def = STDOUT_FILENO;
+        p += 2;
+    } else if(strncmp(p, ">&", 2) == 0 && !both) {
+        dup = true;
+        def = STDOUT_FILENO;
+        p += 2;
+    } else if(strncmp(p, "<&", 2) == 0 && !both) {
+        dup = true;
+        def = STDIN_FILENO;
+        p += 2;
+    } else if(*p == '>') {
+        r->flags = O_WRONLY | O_CREAT | O_TRUNC;
+        def = STDOUT_FILENO;
+        p++;
+    } else if(*p == '<' && !both) {
+        r->flags = O_RDONLY;
+        def = STDIN_FILENO;
+        p++;
+    } else {
+        return -1;
+    }
+
+    // the target is the rest of the word, or the next word
+    int word = i, next = i + 1;
+    if(*p == '\0') {
+        if(words[i + 1] == NULL)
+            return -1;
+        word = next++;
+        p = words[word];
+    }
+    if(!dup && !both && *p == '&') {     // 2> &1, as it has always been accepted
+        dup = true;
+        p++;
+    }
+
+    r->fd = both ? -1 : (fd == -2 ? def : fd);
+    if(dup) {
+        if(has_dollar(p))
+            return -2;
+        if(strcmp(p, "-") == 0) {
+            r->op = REDIR_CLOSE;
+        } else {
+            char * end;
+            if(!isdigit((unsigned char)*p) || (r->src = strtol(p, &end, 10), *end != '\0'))
+                return -1;
+            r->op = REDIR_DUP;
+        }
+    } else {
+        if(*p == '\0')
+            return -1;
+        r->op = REDIR_OPEN;
+        r->flags |= O_CLOEXEC;
+        r->word = word;
+        r->off = p - words[word];
+    }
+    return next;
+}
+
+/*
+ * plan_redir - Compile the redirections of cmd. Before expansion
+ *     (expanded false), one that depends on a variable leaves the plan for
+ *     expand_cmds. Return false on a syntax error, which is reported.
+ */
+bool plan_redir(struct cmd_t * cmd, bool expanded) {
+    char ** words = cmd->redirection_str;
+    int n = 0;
+
+    cmd->redir_num = 0;
+    for(int i = 0; words[i] != NULL; ) {
+        int next = n < MAXREDIR ? parse_one(words, i, &cmd->redir[n]) : -1;
+        if(next == -2 && !expanded) {
+            cmd->redir_num = -1;
+            return true;
+        }
+        if(next < 0) {
+            char msg[MAXLINE];
+            snprintf(msg, sizeof(msg), n < MAXREDIR ? "syntax error near '%.64s'\n" : "too many redirections at '%.64s'\n", words[i]);
+            print_error(msg);
+            cmd->redir_num = -1;
+            return false;
+        }
+        n++;
+        i = next;
+    }
+    cmd->redir_num = n;
+    return true;
+}
+
+const char * redir_path(struct cmd_t * cmd, struct redir_t * r) {
+    return cmd->redirection_str[r->word] + r->off;
+}
+
+/* redirects - Does a redirection of cmd set fd */
+bool redirects(struct cmd_t * cmd, int fd) {
+    if(cmd->redir_num < 0)
+        return cmd->redirection_str[0] != NULL;
+    for(int i = 0; i < cmd->redir_num; i++) {
+        if(cmd->redir[i].fd == fd || (cmd->redir[i].fd == -1 && (fd == 1 || fd == 2)))
+            return true;
+    }
+    return false;
+}
+
+/***********************************************
+ * Resolving
+ **********************************************/
+
+struct fdmap_t {            /* what each fd refers to once the plan has run */
+    int fd[MAXMAP];
+    int val[MAXMAP];        /* an fd of the shell, FILE_OF(k) or CLOSED */
+    int num;
+};
+
+static int get_fd(struct fdmap_t * m, int fd) {
+    for(int i = 0; i < m->num; i++) {
+        if(m->fd[i] == fd)
+            return m->val[i];
+    }
+    return fd;
+}
+
+static void set_fd(struct fdmap_t * m, int fd, int val) {
+    for(int i = 0; i < m->num; i++) {
+        if(m->fd[i] == fd) {
+            m->val[i] = val;
+            return;
+        }
+    }
+    m->fd[m->num] = fd;
+    m->val[m->num++] = val;
+}
+
+static void report(const char * what, int err) {
+    char msg[MAXLINE + 64];
+    snprintf(msg, sizeof(msg), "tsh: %.*s: %s\n", MAXLINE, what, strerror(err));
+    print_error(msg);
+}
+
+/*
+ * resolve - Run the plan of cmd on the symbolic table m, starting from the
+ *     pipes in_fd and out_fd (-1 if none), then open its files in order.
+ *     files[k] is the fd of the file of redirection k, or -1. Return -1 if
+ *     a file can't be opened or a redirection copies a closed fd.
+ */
+static int resolve(struct cmd_t * cmd, int in_fd, int out_fd, struct fdmap_t * m, int * files) {
+    m->num = 0;
+    if(in_fd >= 0)
+        set_fd(m, STDIN_FILENO, in_fd);
+    if(out_fd >= 0)
+        set_fd(m, STDOUT_FILENO, out_fd);
+
+    for(int k = 0; k < cmd->redir_num; k++) {
+        struct redir_t * r = &cmd->redir[k];
+        int val = r->op == REDIR_OPEN ? FILE_OF(k) : r->op == REDIR_DUP ? get_fd(m, r->src) : CLOSED;
+
+        files[k] = -1;
+        if(r->op == REDIR_DUP && val >= 0 && val == r->src && fcntl(val, F_GETFD) < 0)
+            val = CLOSED;   // not open in the shell
+        if(val == CLOSED && r->op == REDIR_DUP) {
+            char what[16];
+            sprintf(what, "%d", r->src);
+            report(what, EBADF);
+            return -1;
+        }
+        if(r->fd == -1) {
+            set_fd(m, STDOUT_FILENO, val);
+            set_fd(m, STDERR_FILENO, val);
+        } else {
+            set_fd(m, r->fd, val);
+        }
+    }
+
+    // every file is opened, created or truncated, even if a later redirection replaces it
+    for(int k = 0; k < cmd->redir_num; k++) {
+        struct redir_t * r = &cmd->redir[k];
+        if(r->op != REDIR_OPEN)
+            continue;
+        files[k] = open(redir_path(cmd, r), r->flags, 0666);
+        if(files[k] < 0) {
+            report(redir_path(cmd, r), errno);
+            for(int j = 0; j < k; j++) {
+                if(files[j] >= 0)
+                    close(files[j]);
+            }
+            return -1;
+        }
+    }
+
+    bool used[MAXREDIR] = {false};
+    for(int i = 0; i < m->num; i++) {
+        if(m->val[i] != CLOSED && m->val[i] < -1) {
+            int k = -2 - m->val[i];
+            m->val[i] = files[k];
+            used[k] = true;
+        }
+    }
+    for(int k = 0; k < cmd->redir_num; k++) {
+        if(files[k] >= 0 && !used[k]) {
+            close(files[k]);
+            files[k] = -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * move_fds - Make every fd of m refer to its value: a parallel move, in
+ *     which an fd is only overwritten once no pending move reads it. When
+ *     all the remaining moves form cycles, one source is copied aside.
+ *     Then the fds of drop (files, pipes) that aren't kept are closed.
+ */
+static int move_fds(struct fdmap_t * m, int * drop, int drop_num) {
+    int dst[MAXMAP], src[MAXMAP], num = 0;
+    int aside[MAXMAP], aside_num = 0;
+    int ret = 0;
+
+    for(int i = 0; i < m->num; i++) {
+        if(m->val[i] == CLOSED)
+            continue;
+        if(m->val[i] == m->fd[i]) {
+            fcntl(m->fd[i], F_SETFD, 0);    // already in place: only keep it across exec
+            continue;
+        }
+        dst[num] = m->fd[i];
+        src[num++] = m->val[i];
+    }
+
+    while(num > 0) {
+        bool moved = false;
+        for(int j = 0; j < num; j++) {
+            bool read_later = false;
+            for(int k = 0; k < num; k++) {
+                if(k != j && src[k] == dst[j])
+                    read_later = true;
+            }
+            if(read_later)
+                continue;
+
+            if(dup2(src[j], dst[j]) < 0) {
+                char what[16];
+                sprintf(what, "%d", src[j]);
+                report(what, errno);
+                ret = -1;
+            }
+            dst[j] = dst[num - 1];
+            src[j] = src[--num];
+            moved = true;
+            j--;
+        }
+
+        if(!moved) {
+            int tmp = fcntl(dst[0], F_DUPFD_CLOEXEC, 10);
+            if(tmp < 0) {
+                report("dup", errno);
+                return -1;
+            }
+            aside[aside_num++] = tmp;
+            for(int k = 0; k < num; k++) {
+                if(src[k] == dst[0])
+                    src[k] = tmp;
+            }
+        }
+    }
+
+    for(int i = 0; i < m->num; i++) {
+        if(m->val[i] == CLOSED)
+            close(m->fd[i]);
+    }
+    for(int i = 0; i < aside_num; i++) {
+        close(aside[i]);
+    }
+    for(int k = 0; k < drop_num; k++) {
+        bool kept = drop[k] < 0;
+        for(int i = 0; i < m->num; i++) {
+            if(m->fd[i] == drop[k])
+                kept = true;
+        }
+        if(!kept)
+            close(drop[k]);
+    }
+    return ret;
+}
+
+/*
+ * apply_redir - Set the fds of a child: stdin from in_fd and stdout to
+ *     out_fd (-1 if not a pipe), then the redirections. The pipes end
+ *     up closed, unless a redirection sets their fd. Return -1 on
+ *     failure, which is reported.
+ */
+int apply_redir(struct cmd_t * cmd, int in_fd, int out_fd) {
+    struct fdmap_t m;
+    int drop[MAXREDIR + 2];
+
+    if(cmd->redir_num < 0 || resolve(cmd, in_fd, out_fd, &m, drop) < 0)
+        return -1;
+    drop[cmd->redir_num] = in_fd;
+    drop[cmd->redir_num + 1] = out_fd;
+    return move_fds(&m, drop, cmd->redir_num + 2);
+}
+
+/***********************************************
+ * Builtins
+ **********************************************/
+
+/* builtin_fd - The fd that the running builtin uses as fd */
+int builtin_fd(int fd) {
+    return fd >= 0 && fd <= 2 ? cur_fd[fd] : fd;
+}
+
+static ssize_t fd_write(void * cookie, const char * buf, size_t size) {
+    int fd = (int)(intptr_t)cookie;
+    size_t done = 0;
+
+    while(done < size) {
+        ssize_t n = write(fd, buf + done, size - done);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0)
+            return done > 0 ? (ssize_t)done : -1;
+        done += n;
+    }
+    return done;
+}
+
+/* fd_file - A FILE that writes to fd and doesn't close it */
+static FILE * fd_file(int fd) {
+    cookie_io_functions_t io = {NULL, fd_write, NULL, NULL};
+
+    FILE * f = fopencookie((void *)(intptr_t)fd, "w", io);
+    if(f != NULL)
+        setvbuf(f, NULL, fd >= 0 && isatty(fd) ? _IOLBF : _IOFBF, BUFSIZ);
+    return f;
+}
+
+/*
+ * open_bio - Set up the fds of a builtin invocation, as apply_redir does
+ *     for a child. Unless real, fds 0-2 of the shell are left alone: the
+ *     builtin finds its fds with builtin_fd, and stdout and stderr write
+ *     to them. close_bio must be called even if it fails (-1).
+ */
+int open_bio(struct cmd_t * cmd, int in_fd, int out_fd, bool real, struct bio_t * io) {
+    struct fdmap_t m;
+    int files[MAXREDIR];
+
+    memset(io, 0, sizeof(*io));
+    io->real = real;
+    memcpy(io->prev_fd, cur_fd, sizeof(cur_fd));
+    fflush(stdout);
+    fflush(stderr);
+
+    if(real) {
+        // keep a copy of what the shell has at each fd that the plan sets, before opening anything
+        int sets[MAXMAP], set_num = 0;
+        if(in_fd >= 0)
+            sets[set_num++] = STDIN_FILENO;
+        if(out_fd >= 0)
+            sets[set_num++] = STDOUT_FILENO;
+        for(int k = 0; k < cmd->redir_num; k++) {
+            if(cmd->redir[k].fd == -1) {
+                sets[set_num++] = STDOUT_FILENO;
+                sets[set_num++] = STDERR_FILENO;
+            } else {
+                sets[set_num++] = cmd->redir[k].fd;
+            }
+        }
+        for(int i = 0; i < set_num; i++) {
+            bool seen = false;
+            for(int j = 0; j < io->saved_num; j++) {
+                if(io->saved_fd[j] == sets[i])
+                    seen = true;
+            }
+            if(!seen) {
+                io->saved_fd[io->saved_num] = sets[i];
+                io->saved[io->saved_num++] = fcntl(sets[i], F_DUPFD_CLOEXEC, 10);
+            }
+        }
+    }
+
+    if(cmd->redir_num < 0 || resolve(cmd, in_fd, out_fd, &m, files) < 0)
+        return -1;
+
+    if(real)
+        return move_fds(&m, files, cmd->redir_num);
+
+    for(int k = 0; k < cmd->redir_num; k++) {
+        if(files[k] >= 0)
+            io->opened[io->opened_num++] = files[k];
+    }
+    for(int fd = 0; fd < 3; fd++) {
+        int val = get_fd(&m, fd);
+        cur_fd[fd] = val == CLOSED ? -1 : val;
+    }
+    if(cur_fd[STDOUT_FILENO] != io->prev_fd[STDOUT_FILENO] && (io->out = fd_file(cur_fd[STDOUT_FILENO])) != NULL) {
+        io->prev_out = stdout;
+        stdout = io->out;
+    }
+    if(cur_fd[STDERR_FILENO] != io->prev_fd[STDERR_FILENO] && (io->err = fd_file(cur_fd[STDERR_FILENO])) != NULL) {
+        io->prev_err = stderr;
+        stderr = io->err;
+    }
+    return 0;
+}
+
+/* close_bio - Give the shell its fds back after a builtin */
+void close_bio(struct bio_t * io) {
+    if(io->out != NULL) {
+        fclose(io->out);
+        stdout = io->prev_out;
+    }
+    if(io->err != NULL) {
+        fclose(io->err);
+        stderr = io->prev_err;
+    }
+    for(int i = 0; i < io->opened_num; i++) {
+        close(io->opened[i]);
+    }
+    memcpy(cur_fd, io->prev_fd, sizeof(cur_fd));
+
+    if(io->real) {
+        fflush(stdout);
+        fflush(stderr);
+        for(int i = 0; i < io->saved_num; i++) {
+            if(io->saved[i] >= 0) {
+                dup2(io->saved[i], io->saved_fd[i]);
+                close(io->saved[i]);
+            } else {
+                close(io->saved_fd[i]);     // it wasn't open
+            }
+        }
+    }
+}
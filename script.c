@@ -0,0 +1,1146 @@
+#include "script.h"
+#include "tsh.h"
+#include "var.h"
+#include "history.h"
+#include "helper.h"
+#include "procsub.h"
+#include "group.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MAXCALLDEPTH  1000    /* max nesting of function calls */
+
+/* token types */
+#define T_WORD   1
+#define T_SEMI   2  /* ; */
+#define T_NL     3  /* newline */
+#define T_AND    4  /* && */
+#define T_OR     5  /* || */
+#define T_AMP    6  /* & */
+#define T_PIPE   7  /* | */
+#define T_EOF    8
+
+struct token_t {
+    int type;
+    int st, end;            /* [st, end) in the text */
+};
+
+struct loopctx_t {          /* a loop being compiled */
+    int top;                /* continue jumps here */
+    int breaks;             /* chain of break jumps to patch, linked through their arg */
+    struct loopctx_t * outer;
+};
+
+struct parser_t {
+    const char * text;
+    struct token_t * tok;
+    int pos;
+    struct script_t * script;
+    int result;             /* PARSE_OK, PARSE_INCOMPLETE or PARSE_ERROR */
+    struct loopctx_t * loop;
+};
+
+struct loop_t {             /* a running for loop */
+    char ** words;
+    int word_num;
+    int next;
+};
+
+static const char * reserved[] = {"if", "then", "elif", "else", "fi", "while", "until", "do", "done",
+                                  "for", "{", "}", "!", "break", "continue", "function", NULL};
+
+static char parse_error[MAXLINE];   /* why the last compilation failed */
+
+static bool starts_group(const char * text, struct token_t * tok, int n, const char * p);
+
+static struct func_t * functions = NULL;
+static int call_depth = 0;
+
+static struct loop_t * loops = NULL;
+static int loop_num = 0, loop_cap = 0;
+
+/***********************************************
+ * Lexer
+ **********************************************/
+
+/*
+ * lex - Split text into words and operators. Quotes and $((...)) stay in
+ *     the words, since words are handed to parseline as they were typed.
+ *     Return the number of tokens, the last one is T_EOF. *incomplete is
+ *     set if a quote isn't closed.
+ */
+static int lex(const char * text, struct token_t ** tokens, bool * incomplete) {
+    int cap = 32, n = 0;
+    struct token_t * tok = malloc(sizeof(struct token_t) * cap);
+    const char * p = text;
+
+    if(tok == NULL) {
+        unix_error("malloc");
+    }
+    *incomplete = false;
+
+    while(1) {
+        while(*p == ' ' || *p == '\t' || *p == '\r')
+            p++;
+        if(*p == '#') {     // comment
+            while(*p && *p != '\n')
+                p++;
+            continue;
+        }
+
+        if(n == cap) {
+            cap *= 2;
+            tok = realloc(tok, sizeof(struct token_t) * cap);
+            if(tok == NULL) {
+                unix_error("realloc");
+            }
+        }
+        struct token_t * t = &tok[n++];
+        t->st = p - text;
+
+        if(*p == '\0') {
+            t->type = T_EOF;
+        } else if(*p == '\n') {
+            t->type = T_NL;
+            p++;
+        } else if(*p == ';') {
+            t->type = T_SEMI;
+            p++;
+        } else if(p[0] == '&' && p[1] == '&') {
+            t->type = T_AND;
+            p += 2;
+        } else if(p[0] == '|' && p[1] == '|') {
+            t->type = T_OR;
+            p += 2;
+        } else if(*p == '&') {
+            t->type = T_AMP;
+            p++;
+        } else if(*p == '|') {
+            t->type = T_PIPE;
+            p++;
+        } else {
+            t->type = T_WORD;
+            while(*p && strchr(" \t\r\n;|", *p) == NULL) {
+                if(*p == '&' && !(p > text + t->st && (p[-1] == '>' || p[-1] == '<'))) {
+                    break;  // '&' is part of a word only in redirections like 2>&1
+                }
+
+                if(*p == '\'' || *p == '"') {
+                    const char * q = strchr(p + 1, *p);
+                    if(q == NULL) {
+                        *incomplete = true;
+                        p += strlen(p);
+                        break;
+                    }
+                    p = q + 1;
+                } else if(p == text + t->st && (*p == '<' || *p == '>') && p[1] == '(') {
+                    const char * end = procsub_end(p);     // <(cmd) is one word, whatever is in it
+                    if(end == NULL) {
+                        *incomplete = true;
+                        p += strlen(p);
+                        break;
+                    }
+                    p = end;
+                } else if(p == text + t->st && starts_group(text, tok, n - 1, p)) {
+                    const char * end = group_end(p);       // so is ( list ) and { list; } in a pipeline
+                    if(end == NULL) {
+                        *incomplete = true;
+                        p += strlen(p);
+                        break;
+                    }
+                    p = end;
+                } else if(arith_skip(p) != NULL) {
+                    p = arith_skip(p);
+                } else {
+                    p++;
+                }
+            }
+        }
+        t->end = p - text;
+
+        if(t->type == T_EOF)
+            break;
+    }
+
+    *tokens = tok;
+    return n;
+}
+
+static bool tok_is(const char * text, struct token_t * t, const char * word) {
+    int len = strlen(word);
+    return t->type == T_WORD && t->end - t->st == len && strncmp(text + t->st, word, len) == 0;
+}
+
+static bool tok_is_any(const char * text, struct token_t * t, const char ** words) {
+    for(int i = 0; words[i] != NULL; i++) {
+        if(tok_is(text, t, words[i]))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * starts_group - The word at p, token i, is a group (see group.h): a '('
+ *     word, or a '{' command that is a stage of a pipeline, in the
+ *     background or redirected. Another '{' is a compound command.
+ */
+static bool starts_group(const char * text, struct token_t * tok, int i, const char * p) {
+    if(*p == '(')
+        return true;
+    if(*p != '{' || (i > 0 && tok[i - 1].type == T_WORD && !tok_is_any(text, &tok[i - 1], reserved)))
+        return false;
+
+    const char * end = group_end(p);
+    if(end == NULL)
+        return false;
+    if(i > 0 && tok[i - 1].type == T_PIPE)
+        return true;
+    while(*end == ' ' || *end == '\t')
+        end++;
+    while(isdigit(*end) && (isdigit(end[1]) || end[1] == '>' || end[1] == '<'))
+        end++;
+    return (end[0] == '|' && end[1] != '|') || (end[0] == '&' && end[1] != '&') || end[0] == '>' || end[0] == '<';
+}
+
+/* is_funcdef - tokens at t start a function definition: name() or name () */
+static bool is_funcdef(const char * text, struct token_t * t) {
+    if(t->type != T_WORD)
+        return false;
+    if(t->end - t->st > 2 && strncmp(text + t->end - 2, "()", 2) == 0)
+        return is_valid_name(text + t->st, text + t->end - 2);
+    return tok_is(text, t + 1, "()") && is_valid_name(text + t->st, text + t->end);
+}
+
+/*
+ * is_script - The command line needs the script interpreter: it has
+ *     control flow keywords, a function definition, or more than one
+ *     pipeline (; && || or several lines).
+ */
+bool is_script(const char * text) {
+    struct token_t * tok;
+    bool incomplete;
+    bool script = false;
+    int n = lex(text, &tok, &incomplete);
+
+    for(int i = 0; i < n && !script; i++) {
+        int type = tok[i].type;
+        if(type == T_SEMI || type == T_AND || type == T_OR) {
+            script = true;
+        } else if(type == T_NL && tok[i + 1].type != T_EOF) {
+            script = true;
+        } else if(type == T_WORD && text[tok[i].st] == '(' && group_end(text + tok[i].st) == NULL) {
+            script = true;  // a group that goes on on the next line
+        }
+    }
+
+    if(!script && tok[0].type == T_WORD) {
+        script = tok_is_any(text, &tok[0], reserved) || is_funcdef(text, &tok[0]);
+    }
+
+    free(tok);
+    return script;
+}
+
+/***********************************************
+ * Compiler
+ **********************************************/
+
+static void * grow_array(void * array, int * cap, int num, int size) {
+    if(num < *cap)
+        return array;
+    *cap = *cap == 0 ? 16 : *cap * 2;
+    array = realloc(array, (size_t)*cap * size);
+    if(array == NULL) {
+        unix_error("realloc");
+    }
+    return array;
+}
+
+static int emit(struct parser_t * p, int op, int arg, int arg2) {
+    struct script_t * s = p->script;
+    s->code = grow_array(s->code, &s->code_cap, s->code_num, sizeof(struct inst_t));
+    s->code[s->code_num].op = op;
+    s->code[s->code_num].arg = arg;
+    s->code[s->code_num].arg2 = arg2;
+    return s->code_num++;
+}
+
+/* patch_chain - Point a chain of jumps (linked through arg, -1 terminated) to target */
+static void patch_chain(struct parser_t * p, int chain, int target) {
+    while(chain >= 0) {
+        int next = p->script->code[chain].arg;
+        p->script->code[chain].arg = target;
+        chain = next;
+    }
+}
+
+static struct token_t * cur(struct parser_t * p) {
+    return &p->tok[p->pos];
+}
+
+static void syntax_error(struct parser_t * p, struct token_t * t) {
+    if(p->result != PARSE_OK)
+        return;
+    if(t->type == T_EOF) {
+        p->result = PARSE_INCOMPLETE;
+        sprintf(parse_error, "syntax error: unexpected end of input\n");
+        return;
+    }
+
+    int len = t->type == T_NL ? 0 : t->end - t->st;
+    if(len > 64)
+        len = 64;
+    p->result = PARSE_ERROR;
+    sprintf(parse_error, "syntax error near '%.*s'\n", len, t->type == T_NL ? "" : p->text + t->st);
+}
+
+static void expect(struct parser_t * p, const char * word) {
+    if(p->result != PARSE_OK)
+        return;
+    if(tok_is(p->text, cur(p), word)) {
+        p->pos++;
+    } else {
+        syntax_error(p, cur(p));
+    }
+}
+
+static void skip_newlines(struct parser_t * p) {
+    while(cur(p)->type == T_NL)
+        p->pos++;
+}
+
+/*
+ * add_pipeline - Parse the pipeline in text [st, end) with parseline, and
+ *     keep a copy of the result in the script. Return its index.
+ */
+static int add_pipeline(struct parser_t * p, int st, int end, int bg) {
+    struct script_t * s = p->script;
+    int len = end - st;
+    char * line = malloc(len + 4);
+    if(line == NULL) {
+        unix_error("malloc");
+    }
+
+    for(int i = 0; i < len; i++) {
+        char c = p->text[st + i];
+        const char * group;
+        if((c == '(' || c == '{') && (i == 0 || strchr(" \t\n", p->text[st + i - 1]) != NULL) &&
+           (group = group_end(p->text + st + i)) != NULL && group <= p->text + end) {
+            // a group keeps its lines, its child compiles them
+            int n = group - (p->text + st + i);
+            memcpy(line + i, p->text + st + i, n);
+            i += n - 1;
+            continue;
+        }
+        line[i] = (c == '\n' || c == '\t' || c == '\r') ? ' ' : c;    // a pipeline may continue after '|'
+    }
+    if(bg) {
+        line[len++] = ' ';
+        line[len++] = '&';
+    }
+    line[len++] = '\n';
+    line[len] = '\0';
+
+    struct cmd_t * cmd = calloc(max_stages(line), sizeof(struct cmd_t));
+    int cmd_num, process_num;
+    bool should_add_history;
+    if(cmd == NULL) {
+        unix_error("calloc");
+    }
+
+    int is_bg = parseline(line, cmd, &cmd_num, &process_num, &should_add_history);
+    if(cmd_num == 0) {
+        p->result = PARSE_ERROR;
+        sprintf(parse_error, "syntax error in '%.64s'\n", line);
+        free(cmd);
+        free(line);
+        return -1;
+    }
+
+    s->pipes = grow_array(s->pipes, &s->pipe_cap, s->pipe_num, sizeof(struct pipeline_t));
+    struct pipeline_t * pl = &s->pipes[s->pipe_num];
+
+    pl->cmd = malloc(sizeof(struct cmd_t) * cmd_num);
+    if(pl->cmd == NULL) {
+        unix_error("malloc");
+    }
+    copy_cmds(pl->cmd, cmd, cmd_num);
+    free(cmd);
+    pl->cmd_num = cmd_num;
+    pl->process_num = process_num;
+    pl->bg = is_bg;
+    pl->has_dollar = false;
+    pl->cmdline = line;
+
+    // parseline's words live in static buffers, keep our own copies
+    for(int i = 0; i < cmd_num; i++) {
+        char ** words[3] = {pl->cmd[i].argv, pl->cmd[i].redirection_str, pl->cmd[i].assign_str};
+        for(int j = 0; j < 3; j++) {
+            for(char ** w = words[j]; *w != NULL; w++) {
+                *w = strdup(*w);
+                if(strchr(*w, '$') != NULL || strchr(*w, LITERAL_MARK) != NULL)
+                    pl->has_dollar = true;
+            }
+        }
+    }
+
+    return s->pipe_num++;
+}
+
+static void parse_list(struct parser_t * p, const char ** stops);
+static void parse_and_or(struct parser_t * p);
+static void parse_brace(struct parser_t * p);
+
+/* parse_simple - A pipeline of simple commands, optionally followed by & */
+static void parse_simple(struct parser_t * p) {
+    int first = p->pos;
+    bool is_return = tok_is(p->text, cur(p), "return");
+
+    while(p->result == PARSE_OK) {
+        struct token_t * t = cur(p);
+        if(t->type == T_WORD) {
+            p->pos++;
+        } else if(t->type == T_PIPE) {
+            p->pos++;
+            skip_newlines(p);
+            if(cur(p)->type != T_WORD) {
+                syntax_error(p, cur(p));
+            }
+        } else {
+            break;
+        }
+    }
+    if(p->result != PARSE_OK)
+        return;
+
+    int last = p->pos - 1;
+    int bg = 0;
+    if(cur(p)->type == T_AMP) {
+        bg = 1;
+        p->pos++;
+    }
+
+    int idx = add_pipeline(p, p->tok[first].st, p->tok[last].end, bg);
+    if(idx < 0)
+        return;
+    emit(p, OP_EXEC, idx, 0);
+
+    if(is_return) {     // return [n] sets the status, then leaves the function
+        emit(p, OP_RET, 0, 0);
+    }
+}
+
+/* if list; then list; [elif list; then list;] ... [else list;] fi */
+static void parse_if(struct parser_t * p) {
+    static const char * then_stops[] = {"then", NULL};
+    static const char * body_stops[] = {"elif", "else", "fi", NULL};
+    static const char * fi_stops[] = {"fi", NULL};
+    int ends = -1;      // chain of jumps to the end of the if
+
+    p->pos++;
+    parse_list(p, then_stops);
+    expect(p, "then");
+    int jnz = emit(p, OP_JNZ, 0, 0);
+    parse_list(p, body_stops);
+
+    while(p->result == PARSE_OK) {
+        if(tok_is(p->text, cur(p), "elif")) {
+            p->pos++;
+            ends = emit(p, OP_JMP, ends, 0);
+            p->script->code[jnz].arg = p->script->code_num;
+            parse_list(p, then_stops);
+            expect(p, "then");
+            jnz = emit(p, OP_JNZ, 0, 0);
+            parse_list(p, body_stops);
+        } else if(tok_is(p->text, cur(p), "else")) {
+            p->pos++;
+            ends = emit(p, OP_JMP, ends, 0);
+            p->script->code[jnz].arg = p->script->code_num;
+            jnz = -1;
+            parse_list(p, fi_stops);
+            break;
+        } else {
+            break;
+        }
+    }
+    expect(p, "fi");
+    if(p->result != PARSE_OK)
+        return;
+
+    if(jnz >= 0) {  // no branch taken: the status is 0
+        ends = emit(p, OP_JMP, ends, 0);
+        p->script->code[jnz].arg = p->script->code_num;
+        emit(p, OP_STATUS, 0, 0);
+    }
+    patch_chain(p, ends, p->script->code_num);
+}
+
+/* while list; do list; done, until list; do list; done */
+static void parse_while(struct parser_t * p) {
+    static const char * do_stops[] = {"do", NULL};
+    static const char * done_stops[] = {"done", NULL};
+    bool until = tok_is(p->text, cur(p), "until");
+    struct loopctx_t ctx;
+
+    p->pos++;
+    ctx.top = p->script->code_num;
+    ctx.breaks = -1;
+    ctx.outer = p->loop;
+
+    parse_list(p, do_stops);
+    expect(p, "do");
+    int exit = emit(p, until ? OP_JZ : OP_JNZ, 0, 0);
+
+    p->loop = &ctx;
+    parse_list(p, done_stops);
+    expect(p, "done");
+    p->loop = ctx.outer;
+    if(p->result != PARSE_OK)
+        return;
+
+    emit(p, OP_JMP, ctx.top, 0);
+    int end = emit(p, OP_STATUS, 0, 0);
+    p->script->code[exit].arg = end;
+    patch_chain(p, ctx.breaks, end);
+}
+
+/* for name [in word ...]; do list; done */
+static void parse_for(struct parser_t * p) {
+    static const char * done_stops[] = {"done", NULL};
+    struct script_t * s = p->script;
+    struct loopctx_t ctx;
+    struct token_t * t;
+
+    p->pos++;
+    t = cur(p);
+    if(t->type != T_WORD || !is_valid_name(p->text + t->st, p->text + t->end)) {
+        syntax_error(p, t);
+        return;
+    }
+    p->pos++;
+
+    s->lists = grow_array(s->lists, &s->list_cap, s->list_num, sizeof(struct wordlist_t));
+    int list_idx = s->list_num++;
+    struct wordlist_t * list = &s->lists[list_idx];
+    list->var = strndup(p->text + t->st, t->end - t->st);
+    list->words = NULL;
+    list->word_num = -1;
+
+    skip_newlines(p);
+    if(tok_is(p->text, cur(p), "in")) {
+        int cap = 0;
+        p->pos++;
+        list->word_num = 0;
+        for(t = cur(p); t->type == T_WORD; t = cur(p)) {
+            list->words = grow_array(list->words, &cap, list->word_num, sizeof(char *));
+            list->words[list->word_num++] = strndup(p->text + t->st, t->end - t->st);
+            p->pos++;
+        }
+    }
+    while(cur(p)->type == T_SEMI || cur(p)->type == T_NL)
+        p->pos++;
+    expect(p, "do");
+
+    emit(p, OP_FOR, list_idx, 0);
+    ctx.top = emit(p, OP_NEXT, 0, list_idx);
+    ctx.breaks = -1;
+    ctx.outer = p->loop;
+
+    p->loop = &ctx;
+    parse_list(p, done_stops);
+    expect(p, "done");
+    p->loop = ctx.outer;
+    if(p->result != PARSE_OK)
+        return;
+
+    emit(p, OP_JMP, ctx.top, 0);
+    int exit = emit(p, OP_POP, 0, 0);
+    s->code[ctx.top].arg = exit;
+    patch_chain(p, ctx.breaks, exit);
+}
+
+/* { list; } */
+static void parse_brace(struct parser_t * p) {
+    static const char * brace_stops[] = {"}", NULL};
+
+    expect(p, "{");
+    parse_list(p, brace_stops);
+    expect(p, "}");
+}
+
+/* name() { list; }, function name [()] { list; } */
+static void parse_function(struct parser_t * p) {
+    struct script_t * s = p->script;
+
+    if(tok_is(p->text, cur(p), "function"))
+        p->pos++;
+
+    struct token_t * t = cur(p);
+    int len = t->end - t->st;
+    if(t->type == T_WORD && len > 2 && strncmp(p->text + t->end - 2, "()", 2) == 0)
+        len -= 2;
+    if(t->type != T_WORD || !is_valid_name(p->text + t->st, p->text + t->st + len)) {
+        syntax_error(p, t);
+        return;
+    }
+    p->pos++;
+    if(tok_is(p->text, cur(p), "()"))
+        p->pos++;
+    skip_newlines(p);
+
+    s->names = grow_array(s->names, &s->name_cap, s->name_num, sizeof(char *));
+    s->names[s->name_num] = strndup(p->text + t->st, len);
+    int defun = emit(p, OP_DEFUN, 0, s->name_num++);
+
+    struct loopctx_t * outer = p->loop;    // break doesn't cross a function
+    p->loop = NULL;
+    parse_brace(p);
+    p->loop = outer;
+
+    emit(p, OP_RET, 0, 0);
+    s->code[defun].arg = s->code_num;
+}
+
+/* break, continue */
+static void parse_break(struct parser_t * p) {
+    bool is_break = tok_is(p->text, cur(p), "break");
+
+    p->pos++;
+    if(p->loop == NULL) {
+        p->result = PARSE_ERROR;
+        sprintf(parse_error, "%s: only meaningful in a loop\n", is_break ? "break" : "continue");
+        return;
+    }
+
+    if(is_break) {
+        p->loop->breaks = emit(p, OP_JMP, p->loop->breaks, 0);
+    } else {
+        emit(p, OP_JMP, p->loop->top, 0);
+    }
+}
+
+static void parse_command(struct parser_t * p) {
+    struct token_t * t = cur(p);
+    const char * text = p->text;
+
+    if(t->type != T_WORD) {
+        syntax_error(p, t);
+    } else if(tok_is(text, t, "if")) {
+        parse_if(p);
+    } else if(tok_is(text, t, "while") || tok_is(text, t, "until")) {
+        parse_while(p);
+    } else if(tok_is(text, t, "for")) {
+        parse_for(p);
+    } else if(tok_is(text, t, "{")) {
+        parse_brace(p);
+    } else if(tok_is(text, t, "function") || is_funcdef(text, t)) {
+        parse_function(p);
+    } else if(tok_is(text, t, "break") || tok_is(text, t, "continue")) {
+        parse_break(p);
+    } else if(tok_is_any(text, t, reserved)) {
+        syntax_error(p, t);
+    } else {
+        parse_simple(p);
+    }
+}
+
+/* [!] command */
+static void parse_pipeline(struct parser_t * p) {
+    if(tok_is(p->text, cur(p), "!")) {
+        p->pos++;
+        parse_pipeline(p);
+        emit(p, OP_NOT, 0, 0);
+        return;
+    }
+    parse_command(p);
+}
+
+/* pipeline [&& pipeline | || pipeline] ... */
+static void parse_and_or(struct parser_t * p) {
+    parse_pipeline(p);
+
+    while(p->result == PARSE_OK && (cur(p)->type == T_AND || cur(p)->type == T_OR)) {
+        int op = cur(p)->type == T_AND ? OP_JNZ : OP_JZ;
+        p->pos++;
+        skip_newlines(p);
+
+        int skip = emit(p, op, 0, 0);
+        parse_pipeline(p);
+        p->script->code[skip].arg = p->script->code_num;
+    }
+}
+
+/*
+ * parse_list - Parse commands separated by ; & or newlines, until one of
+ *     the keywords in stops (NULL: until the end of the text)
+ */
+static void parse_list(struct parser_t * p, const char ** stops) {
+    while(p->result == PARSE_OK) {
+        struct token_t * t = cur(p);
+
+        if(t->type == T_SEMI || t->type == T_NL) {
+            p->pos++;
+            continue;
+        }
+        if(t->type == T_EOF) {
+            if(stops != NULL)
+                syntax_error(p, t);
+            return;
+        }
+        if(stops != NULL && tok_is_any(p->text, t, stops))
+            return;
+
+        parse_and_or(p);
+
+        t = cur(p);
+        if(t->type != T_SEMI && t->type != T_NL && t->type != T_EOF && !(stops != NULL && tok_is_any(p->text, t, stops))) {
+            syntax_error(p, t);
+        }
+    }
+}
+
+/*
+ * compile_script - Compile text into bytecode. *result is PARSE_OK,
+ *     PARSE_INCOMPLETE or PARSE_ERROR; NULL is returned unless it is PARSE_OK.
+ */
+struct script_t * compile_script(const char * text, int * result) {
+    struct parser_t p;
+    bool incomplete;
+
+    p.text = text;
+    p.pos = 0;
+    p.result = PARSE_OK;
+    p.loop = NULL;
+    p.script = calloc(1, sizeof(struct script_t));
+    if(p.script == NULL) {
+        unix_error("calloc");
+    }
+
+    lex(text, &p.tok, &incomplete);
+    parse_list(&p, NULL);
+    if(incomplete && p.result != PARSE_ERROR) {
+        p.result = PARSE_INCOMPLETE;
+        sprintf(parse_error, "syntax error: unterminated quote or group\n");
+    }
+    emit(&p, OP_RET, 0, 0);
+    free(p.tok);
+
+    *result = p.result;
+    if(p.result != PARSE_OK) {
+        free_script(p.script);
+        return NULL;
+    }
+    return p.script;
+}
+
+void free_script(struct script_t * s) {
+    if(s == NULL)
+        return;
+
+    for(int i = 0; i < s->pipe_num; i++) {
+        struct pipeline_t * pl = &s->pipes[i];
+        for(int j = 0; j < pl->cmd_num; j++) {
+            char ** words[3] = {pl->cmd[j].argv, pl->cmd[j].redirection_str, pl->cmd[j].assign_str};
+            for(int k = 0; k < 3; k++) {
+                for(char ** w = words[k]; *w != NULL; w++)
+                    free(*w);
+            }
+        }
+        free(pl->cmd);
+        free(pl->cmdline);
+    }
+    for(int i = 0; i < s->list_num; i++) {
+        for(int j = 0; j < s->lists[i].word_num; j++)
+            free(s->lists[i].words[j]);
+        free(s->lists[i].words);
+        free(s->lists[i].var);
+    }
+    for(int i = 0; i < s->name_num; i++)
+        free(s->names[i]);
+
+    free(s->code);
+    free(s->pipes);
+    free(s->lists);
+    free(s->names);
+    free(s);
+}
+
+/***********************************************
+ * Interpreter
+ **********************************************/
+
+struct func_t * get_function(const char * name) {
+    for(struct func_t * f = functions; f != NULL; f = f->next) {
+        if(strcmp(f->name, name) == 0)
+            return f;
+    }
+    return NULL;
+}
+
+static void define_function(char * name, struct script_t * script, int pc) {
+    struct func_t * f = get_function(name);
+
+    if(f == NULL) {
+        f = malloc(sizeof(struct func_t));
+        if(f == NULL) {
+            unix_error("malloc");
+        }
+        f->name = strdup(name);
+        f->next = functions;
+        functions = f;
+    }
+    f->script = script;
+    f->pc = pc;
+    script->keep = true;    // the body lives in this script
+}
+
+/* call_function - Run function argv[0] with positional parameters argv */
+int call_function(char ** argv) {
+    struct func_t * f = get_function(argv[0]);
+
+    if(call_depth >= MAXCALLDEPTH) {
+        print_error("maximum function nesting level exceeded\n");
+        return 1;
+    }
+
+    call_depth++;
+    char ** saved = swap_positional(argv);
+    run_script(f->script, f->pc);
+    swap_positional(saved);
+    call_depth--;
+
+    return last_status;
+}
+
+static void add_loop_word(struct loop_t * loop, int * cap, const char * word) {
+    loop->words = grow_array(loop->words, cap, loop->word_num, sizeof(char *));
+    loop->words[loop->word_num++] = strdup(word);
+}
+
+/*
+ * push_loop - Start a for loop: expand its words once. Unquoted words are
+ *     split on blanks after expansion, quoted ones are not.
+ */
+static void push_loop(struct wordlist_t * list) {
+    struct loop_t * loop;
+    int cap = 0;
+
+    loops = grow_array(loops, &loop_cap, loop_num, sizeof(struct loop_t));
+    loop = &loops[loop_num++];
+    loop->words = NULL;
+    loop->word_num = 0;
+    loop->next = 0;
+
+    if(list->word_num < 0) {    // for name; do ... loops over "$@"
+        char ** argv = get_positional();
+        for(int i = 1; i <= positional_num(); i++)
+            add_loop_word(loop, &cap, argv[i]);
+        return;
+    }
+
+    for(int i = 0; i < list->word_num; i++) {
+        char marked[MAXLINE * 2];
+        char expanded[MAXLINE * 4];
+        const char * w = list->words[i];
+        bool quoted = strchr(w, '\'') != NULL || strchr(w, '"') != NULL;
+        int len = 0;
+        char quote = '\0';
+
+        // drop the quotes, protect '$' in single quotes from expansion
+        for(; *w && len < (int)sizeof(marked) - 2; w++) {
+            if(quote == '\0' && (*w == '\'' || *w == '"')) {
+                quote = *w;
+            } else if(quote != '\0' && *w == quote) {
+                quote = '\0';
+            } else {
+                if(quote == '\'' && *w == '$')
+                    marked[len++] = LITERAL_MARK;
+                marked[len++] = *w;
+            }
+        }
+        marked[len] = '\0';
+
+        if(expand_word(marked, expanded, sizeof(expanded)) < 0) {
+            print_error("expansion failed\n");
+            continue;
+        }
+
+        if(quoted) {
+            add_loop_word(loop, &cap, expanded);
+            continue;
+        }
+        for(char * field = strtok(expanded, " \t\n"); field != NULL; field = strtok(NULL, " \t\n"))
+            add_loop_word(loop, &cap, field);
+    }
+}
+
+static void pop_loop() {
+    struct loop_t * loop = &loops[--loop_num];
+    for(int i = 0; i < loop->word_num; i++)
+        free(loop->words[i]);
+    free(loop->words);
+}
+
+/* exec_pipeline - Expand (if needed) and run a compiled pipeline, exec it if tail allows */
+static void exec_pipeline(struct pipeline_t * pl, bool tail) {
+    int process_num = 0;
+
+    if(!pl->has_dollar) {
+        // functions may have been defined since the pipeline was compiled
+        for(int i = 0; i < pl->cmd_num; i++) {
+            set_is_builtin(&pl->cmd[i]);
+            if(!pl->cmd[i].is_builtin)
+                process_num++;
+        }
+        if(tail) {
+            exec_tail(pl->cmd, pl->cmd_num, pl->bg);
+        }
+        run_pipeline(pl->cmd, pl->cmd_num, process_num, pl->bg, pl->cmdline);
+        return;
+    }
+
+    int pool_size = MAXLINE * 4 + strlen(pl->cmdline) * 4;
+    struct cmd_t * cmd = malloc(sizeof(struct cmd_t) * pl->cmd_num);
+    char * pool = malloc(pool_size);
+    if(cmd == NULL || pool == NULL) {
+        unix_error("malloc");
+    }
+
+    copy_cmds(cmd, pl->cmd, pl->cmd_num);
+    if(!expand_cmds(cmd, pl->cmd_num, &process_num, pool, pool_size)) {
+        print_error("expansion failed\n");
+        last_status = 1;
+    } else {
+        if(tail) {
+            exec_tail(cmd, pl->cmd_num, pl->bg);
+        }
+        run_pipeline(cmd, pl->cmd_num, process_num, pl->bg, pl->cmdline);
+    }
+    free(cmd);
+    free(pool);
+}
+
+/* is_last - Nothing but jumps is left to run from pc to the end of the script */
+static bool is_last(struct script_t * s, int pc) {
+    for(int hops = 0; s->code[pc].op == OP_JMP && hops < s->code_num; hops++)
+        pc = s->code[pc].arg;
+    return pc == s->code_num - 1;
+}
+
+/*
+ * run_script - Execute bytecode from pc until OP_RET. ctrl-c stops
+ *     the script.
+ */
+void run_script(struct script_t * s, int pc) {
+    int loop_base = loop_num;
+
+    while(!sigint_received) {
+        struct inst_t * in = &s->code[pc];
+
+        switch(in->op) {
+        case OP_EXEC:
+            exec_pipeline(&s->pipes[in->arg], s->tail && is_last(s, pc + 1));
+            pc++;
+            break;
+        case OP_JMP:
+            pc = in->arg;
+            break;
+        case OP_JZ:
+            pc = last_status == 0 ? in->arg : pc + 1;
+            break;
+        case OP_JNZ:
+            pc = last_status != 0 ? in->arg : pc + 1;
+            break;
+        case OP_NOT:
+            last_status = !last_status;
+            pc++;
+            break;
+        case OP_STATUS:
+            last_status = in->arg;
+            pc++;
+            break;
+        case OP_FOR:
+            push_loop(&s->lists[in->arg]);
+            pc++;
+            break;
+        case OP_NEXT: {
+            struct loop_t * loop = &loops[loop_num - 1];
+            if(loop->next < loop->word_num) {
+                set_var(s->lists[in->arg2].var, loop->words[loop->next++], false);
+                pc++;
+            } else {
+                pc = in->arg;
+            }
+            break;
+        }
+        case OP_POP:
+            pop_loop();
+            pc++;
+            break;
+        case OP_DEFUN:
+            define_function(s->names[in->arg2], s, pc + 1);
+            pc = in->arg;
+            break;
+        case OP_RET:
+        default:
+            goto done;
+        }
+    }
+
+done:
+    // return, or ctrl-c, from inside for loops
+    while(loop_num > loop_base)
+        pop_loop();
+}
+
+/* ends_with_opener - record[0, len) ends with a keyword that may not be followed by ';' */
+static bool ends_with_opener(const char * record, int len) {
+    static const char * openers[] = {"{", "then", "else", "do", NULL};
+
+    for(int i = 0; openers[i] != NULL; i++) {
+        int n = strlen(openers[i]);
+        if(len >= n && strncmp(record + len - n, openers[i], n) == 0 &&
+           (len == n || record[len - n - 1] == ' ' || record[len - n - 1] == ';'))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * flatten - Turn a multi-line script into one history record: newlines
+ *     become "; " (or a blank after | && ||), comments are dropped
+ */
+static void flatten(const char * text, char * record, int size) {
+    int len = 0;
+    char quote = '\0';
+
+    for(const char * p = text; *p && len < size - 3; p++) {
+        if(quote == '\0' && *p == '#' && (p == text || p[-1] == ' ' || p[-1] == '\t' || p[-1] == '\n')) {
+            while(p[1] && p[1] != '\n')
+                p++;
+            continue;
+        }
+        if(quote == '\0' && (*p == '\'' || *p == '"')) {
+            quote = *p;
+        } else if(*p == quote) {
+            quote = '\0';
+        }
+
+        if(*p != '\n' || quote != '\0') {
+            record[len++] = *p;
+            continue;
+        }
+
+        while(len > 0 && (record[len - 1] == ' ' || record[len - 1] == '\t'))
+            len--;
+        if(len > 0 && strchr("|&;", record[len - 1]) == NULL && !ends_with_opener(record, len)) {
+            record[len++] = ';';
+        }
+        if(len > 0) {
+            record[len++] = ' ';
+        }
+        while(p[1] == ' ' || p[1] == '\t')     // indentation
+            p++;
+    }
+
+    while(len > 0 && strchr(" \t;", record[len - 1]) != NULL)
+        len--;
+    record[len++] = '\n';
+    record[len] = '\0';
+}
+
+/* eval_script - Record, compile and run a command line with control flow */
+void eval_script(char * text) {
+    char record[MAXLINE];
+    int result;
+
+    flatten(text, record, sizeof(record));
+    if(!(record[0] == '!' && record[1] != ' '))  // not a history recall
+        add_history(record);
+
+    struct script_t * script = compile_script(text, &result);
+    if(script == NULL) {
+        print_error(parse_error);
+        last_status = 2;
+        return;
+    }
+
+    run_script(script, 0);
+
+    if(!script->keep)
+        free_script(script);
+}
+
+/*
+ * run_list - Compile and run text in a process of its own (the list of a
+ *     group); with tail, its last command may be exec'd. Return its status.
+ */
+int run_list(const char * text, bool tail) {
+    int result;
+
+    struct script_t * script = compile_script(text, &result);
+    if(script == NULL) {
+        print_error(parse_error);
+        last_status = 2;
+        return last_status;
+    }
+
+    script->tail = tail;
+    run_script(script, 0);
+
+    if(!script->keep)
+        free_script(script);
+    return last_status;
+}
+
+/*
+ * read_script - If first_line starts a compound command that isn't
+ *     complete, read lines from stdin until it is. Return the whole text
+ *     (to be freed by the caller), or NULL if first_line is complete.
+ */
+char * read_script(char * first_line, int emit_prompt) {
+    char * line = NULL;
+    size_t line_cap = 0;
+    int result;
+
+    if(!is_script(first_line))
+        return NULL;
+    free_script(compile_script(first_line, &result));
+    if(result != PARSE_INCOMPLETE)
+        return NULL;
+
+    int len = strlen(first_line);
+    int cap = len + MAXLINE;
+    char * text = malloc(cap);
+    if(text == NULL) {
+        unix_error("malloc");
+    }
+    strcpy(text, first_line);
+
+    while(result == PARSE_INCOMPLETE) {
+        if(emit_prompt) {
+            print_prompt("> ");
+        }
+        if(getline(&line, &line_cap, stdin) < 0)
+            break;  // end of input, eval reports the error
+
+        int line_len = strlen(line);
+        if(len + line_len + 1 > cap) {
+            cap = (len + line_len + 1) * 2;
+            text = realloc(text, cap);
+            if(text == NULL) {
+                unix_error("realloc");
+            }
+        }
+        strcpy(text + len, line);
+        len += line_len;
+
+        free_script(compile_script(text, &result));
+    }
+
+    free(line);
+    return text;
+}
@@ -0,0 +1,68 @@
+#include "startup.h"
+
+#include <stdio.h>
+#include <time.h>
+
+static struct {
+    double start;           /* main() */
+    double last;            /* end of the previous phase */
+    double paused_at;       /* 0 when not waiting for input */
+    double waited;          /* total time waiting for input */
+    double waited_in_phase;
+    const char * name[MAXPHASES];
+    double took[MAXPHASES];
+    int num;
+    bool done;              /* reported: later phases are not startup */
+} prof;
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+void startup_begin() {
+    prof.start = prof.last = now_ms();
+}
+
+/* startup_phase - The phase called name has just ended */
+void startup_phase(const char * name) {
+    if(prof.done || prof.num == MAXPHASES)
+        return;
+
+    double now = now_ms();
+    prof.name[prof.num] = name;
+    prof.took[prof.num++] = now - prof.last - prof.waited_in_phase;
+    prof.last = now;
+    prof.waited_in_phase = 0;
+}
+
+/* startup_pause - Waiting for the user starts */
+void startup_pause() {
+    if(!prof.done)
+        prof.paused_at = now_ms();
+}
+
+void startup_resume() {
+    if(prof.done || prof.paused_at == 0)
+        return;
+    double waited = now_ms() - prof.paused_at;
+    prof.waited += waited;
+    prof.waited_in_phase += waited;
+    prof.paused_at = 0;
+}
+
+/* startup_report - Print the profile, right before the first prompt */
+void startup_report() {
+    double total = now_ms() - prof.start - prof.waited;
+
+    prof.done = true;
+    printf("startup: %.3f ms to the first prompt\n", total);
+    for(int i = 0; i < prof.num; i++) {
+        printf("  %-10s %9.3f ms %5.1f%%\n", prof.name[i], prof.took[i], total > 0 ? prof.took[i] * 100 / total : 0);
+    }
+    if(prof.waited > 0) {
+        printf("  (waiting for input %.3f ms, not counted)\n", prof.waited);
+    }
+    fflush(stdout);
+}
@@ -0,0 +1,210 @@
+#!/bin/sh
+#
+# bench.sh - end-to-end benchmarks of the tiny shell
+#
+# Drives the built ./tsh non-interactively (logged in as the test user)
+# and prints one JSON object with all results, so that runs can be
+# compared across commits. Run it from the repository root: make bench
+#
+# Knobs (environment variables):
+#   BENCH_BYTES    bytes pushed through each pipeline      (default 2G)
+#   BENCH_STAGES   pipeline lengths to measure             (default "1 2 4 8 16")
+#   BENCH_SPAWNS   trivial commands for the spawn rate     (default 2000)
+#                  (/bin/true runs in the shell, spawn_external forces fork + exec)
+#   BENCH_HEAP     shell variables loaded before spawn_zygote (default 64M)
+#   BENCH_JOBS     background loop jobs for job churn      (default 256)
+#   BENCH_HISTORY  commands for the history workload       (default 2000)
+#   BENCH_REPEAT   repetitions of the startup measurement  (default 5)
+#   BENCH_LOOP_DEPTH  nesting of 10-word for loops, 10^depth iterations (default 6)
+#   BENCH_OUT      file that receives the JSON             (default bench_output.txt)
+
+TSH=${TSH:-./tsh}
+LOOP=${LOOP:-./testcase/loop}
+USERNAME=${BENCH_USER:-root}
+PASSWORD=${BENCH_PASS:-pass}
+
+BENCH_BYTES=${BENCH_BYTES:-2G}
+BENCH_STAGES=${BENCH_STAGES:-"1 2 4 8 16"}
+BENCH_SPAWNS=${BENCH_SPAWNS:-2000}
+BENCH_HEAP=${BENCH_HEAP:-64M}
+BENCH_JOBS=${BENCH_JOBS:-256}
+BENCH_HISTORY=${BENCH_HISTORY:-2000}
+BENCH_REPEAT=${BENCH_REPEAT:-5}
+BENCH_LOOP_DEPTH=${BENCH_LOOP_DEPTH:-6}
+BENCH_OUT=${BENCH_OUT:-bench_output.txt}
+
+JOBS_PER_SESSION=8      # stay well below MAXJOBS
+
+TMP=$(mktemp -d /tmp/tsh-bench.XXXXXX) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+if [ ! -x "$TSH" ] || [ ! -x "$LOOP" ]; then
+    echo "bench: build $TSH and $LOOP first (make bench)" >&2
+    exit 1
+fi
+touch "./home/$USERNAME/.tsh_history"
+
+now_ns() {
+    date +%s%N
+}
+
+# bytes - convert 2G, 512M, 64K, 100 to a number of bytes
+bytes() {
+    case "$1" in
+        *G) echo $(( ${1%G} * 1024 * 1024 * 1024 )) ;;
+        *M) echo $(( ${1%M} * 1024 * 1024 )) ;;
+        *K) echo $(( ${1%K} * 1024 )) ;;
+        *)  echo "$1" ;;
+    esac
+}
+
+# session FILE [FLAG...] - feed the login and the commands in FILE to tsh, print elapsed ns
+session() {
+    file=$1
+    shift
+    start=$(now_ns)
+    { printf '%s\n%s\n' "$USERNAME" "$PASSWORD"; cat "$file"; printf 'quit\n'; } \
+        | "$TSH" -p "$@" > "$TMP/out" 2>&1
+    end=$(now_ns)
+    echo $(( end - start ))
+}
+
+# median of the numbers on stdin
+median() {
+    sort -n | awk '{ v[NR] = $1 } END { if (NR % 2) print v[(NR + 1) / 2]; else print int((v[NR / 2] + v[NR / 2 + 1]) / 2) }'
+}
+
+# per_sec COUNT NS
+per_sec() {
+    awk -v n="$1" -v ns="$2" 'BEGIN { if (ns > 0) printf "%.1f", n * 1e9 / ns; else print 0 }'
+}
+
+# ms NS
+ms() {
+    awk -v ns="$1" 'BEGIN { printf "%.3f", ns / 1e6 }'
+}
+
+# time to first prompt: login, initialization and quit
+: > "$TMP/empty"
+i=0
+while [ $i -lt "$BENCH_REPEAT" ]; do
+    session "$TMP/empty"
+    i=$((i + 1))
+done | median > "$TMP/startup"
+startup_ns=$(cat "$TMP/startup")
+
+# spawn rate of trivial commands
+i=0
+while [ $i -lt "$BENCH_SPAWNS" ]; do
+    echo "/bin/true"
+    i=$((i + 1))
+done > "$TMP/spawn"
+spawn_ns=$(( $(session "$TMP/spawn") - startup_ns ))
+
+# the same with the in-shell utilities turned off: fork + exec for each
+{ echo "TSH_FASTPATH=0"; cat "$TMP/spawn"; } > "$TMP/spawn_ext"
+spawn_ext_ns=$(( $(session "$TMP/spawn_ext") - startup_ns ))
+
+# fork + exec from a big shell, then through the fork-server (-z): about
+# BENCH_HEAP bytes of variables (3600 bytes each) are set before the spawns
+heap=$(bytes "$BENCH_HEAP")
+value=$(awk 'BEGIN { while (n++ < 900) printf "x" }')
+{
+    echo "a=$value"
+    awk -v n=$((heap / 3600)) 'BEGIN { for (i = 0; i < n; i++) printf "b%d=$a$a$a$a\n", i }'
+} > "$TMP/heap"
+{ cat "$TMP/heap"; cat "$TMP/spawn_ext"; } > "$TMP/heap_spawn"
+fork_ns=$(( $(session "$TMP/heap_spawn") - $(session "$TMP/heap") ))
+zygote_ns=$(( $(session "$TMP/heap_spawn" -z) - $(session "$TMP/heap" -z) ))
+
+# pipeline throughput: head | cat ... | wc, with BENCH_STAGES stages in total (no upper bound)
+nbytes=$(bytes "$BENCH_BYTES")
+pipeline_json=""
+for stages in $BENCH_STAGES; do
+    line="/usr/bin/head -c $nbytes /dev/zero"
+    if [ "$stages" -ge 2 ]; then
+        k=2
+        while [ $k -lt "$stages" ]; do
+            line="$line | /bin/cat"
+            k=$((k + 1))
+        done
+        line="$line | /usr/bin/wc -c"
+    else
+        line="$line > /dev/null"
+    fi
+    echo "$line" > "$TMP/pipe"
+    ns=$(( $(session "$TMP/pipe") - startup_ns ))
+    mbps=$(awk -v b="$nbytes" -v ns="$ns" 'BEGIN { if (ns > 0) printf "%.1f", b / 1048576 * 1e9 / ns; else print 0 }')
+    pipeline_json="$pipeline_json${pipeline_json:+, }{\"stages\": $stages, \"ms\": $(ms $ns), \"mb_per_s\": $mbps}"
+done
+
+# job churn: start background loop jobs, quit kills and reaps all of them
+sessions=$(( (BENCH_JOBS + JOBS_PER_SESSION - 1) / JOBS_PER_SESSION ))
+i=0
+while [ $i -lt $JOBS_PER_SESSION ]; do
+    echo "$LOOP &"
+    i=$((i + 1))
+done > "$TMP/churn"
+churn_ns=0
+i=0
+while [ $i -lt $sessions ]; do
+    churn_ns=$(( churn_ns + $(session "$TMP/churn") - startup_ns ))
+    i=$((i + 1))
+done
+churn_jobs=$(( sessions * JOBS_PER_SESSION ))
+
+# history-heavy workload: every command is recorded, listed and recalled
+i=0
+while [ $i -lt "$BENCH_HISTORY" ]; do
+    echo "/bin/true $i"
+    if [ $((i % 10)) -eq 9 ]; then
+        echo "history"
+        echo "!5"
+    fi
+    i=$((i + 1))
+done > "$TMP/history"
+history_ns=$(( $(session "$TMP/history") - startup_ns ))
+history_cmds=$(wc -l < "$TMP/history")
+
+# interpreter overhead: nested for loops whose body only does arithmetic
+head="" tail=""
+k=0
+while [ $k -lt "$BENCH_LOOP_DEPTH" ]; do
+    head="${head}for v$k in 0 1 2 3 4 5 6 7 8 9; do "
+    tail="${tail}; done"
+    k=$((k + 1))
+done
+{ echo "i=0"; echo "${head}i=\$((i+1))${tail}"; } > "$TMP/loop"
+loop_iters=$(awk -v d="$BENCH_LOOP_DEPTH" 'BEGIN { printf "%d", 10 ^ d }')
+loop_ns=$(( $(session "$TMP/loop") - startup_ns ))
+loop_ns_per_iter=$(awk -v n="$loop_iters" -v ns="$loop_ns" 'BEGIN { printf "%.1f", ns / n }')
+
+# replay of the recorded sessions in testcase/replay, back to back (--max)
+replay_ns=0
+replay_cmds=0
+for rec in testcase/replay/*.rec; do
+    start=$(now_ns)
+    printf '%s\n%s\n' "$USERNAME" "$PASSWORD" | "$TSH" -p --replay "$rec" --max > "$TMP/out" 2>&1
+    end=$(now_ns)
+    replay_ns=$(( replay_ns + end - start - startup_ns ))
+    replay_cmds=$(( replay_cmds + $(grep -c '^[0-9.]* in ' "$rec") ))
+done
+
+commit=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+
+cat > "$BENCH_OUT" <<EOF
+{
+  "commit": "$commit",
+  "date": "$(date -u +%Y-%m-%dT%H:%M:%SZ)",
+  "startup": {"repeat": $BENCH_REPEAT, "median_ms": $(ms $startup_ns)},
+  "spawn": {"commands": $BENCH_SPAWNS, "ms": $(ms $spawn_ns), "per_s": $(per_sec $BENCH_SPAWNS $spawn_ns)},
+  "spawn_external": {"commands": $BENCH_SPAWNS, "ms": $(ms $spawn_ext_ns), "per_s": $(per_sec $BENCH_SPAWNS $spawn_ext_ns)},
+  "spawn_zygote": {"commands": $BENCH_SPAWNS, "heap_bytes": $heap, "fork_ms": $(ms $fork_ns), "fork_per_s": $(per_sec $BENCH_SPAWNS $fork_ns), "zygote_ms": $(ms $zygote_ns), "zygote_per_s": $(per_sec $BENCH_SPAWNS $zygote_ns)},
+  "pipeline": {"bytes": $nbytes, "runs": [$pipeline_json]},
+  "job_churn": {"jobs": $churn_jobs, "ms": $(ms $churn_ns), "per_s": $(per_sec $churn_jobs $churn_ns)},
+  "history": {"commands": $history_cmds, "ms": $(ms $history_ns), "per_s": $(per_sec $history_cmds $history_ns)},
+  "loop": {"iterations": $loop_iters, "ms": $(ms $loop_ns), "per_s": $(per_sec $loop_iters $loop_ns), "ns_per_iter": $loop_ns_per_iter},
+  "replay": {"commands": $replay_cmds, "ms": $(ms $replay_ns), "per_s": $(per_sec $replay_cmds $replay_ns)}
+}
+EOF
+cat "$BENCH_OUT"
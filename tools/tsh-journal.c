@@ -0,0 +1,283 @@
+/*
+ * tsh-journal - Decode and query the audit journals of tsh (see include/journal.h)
+ *
+ *   tools/tsh-journal [-u user] [-j jid] [-p pid] [-f] [-c text] [file | dir]...
+ *
+ * Without a file, ./home/<every user>/.tsh_journal. Prints a line for each
+ * process: user, start and end time, pid, pgid, jid, exit status and argv,
+ * the processes of a session in the order they were started. -f keeps the
+ * ones that failed (status not 0), -c the ones whose argv contains text.
+ */
+#define _GNU_SOURCE
+#define JOURNAL_DECODER
+
+#include "journal.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct file_t {
+    char * path;
+    int64_t start;
+    int shell_pid;
+    unsigned seq;
+};
+
+struct proc_t {
+    char user[JOURNAL_USER];
+    int pid, pgid, jid, status;
+    bool ended;
+    int64_t start, end;
+    char * argv;        /* joined with ' ' */
+};
+
+static struct file_t * files;
+static int file_num = 0, file_cap = 0;
+static struct proc_t * procs;
+static int proc_num = 0, proc_cap = 0;
+
+static const char * opt_user = NULL;
+static const char * opt_text = NULL;
+static int opt_jid = 0, opt_pid = 0;
+static bool opt_failed = false;
+
+/* add_file - Queue a journal file, if its header is one */
+static void add_file(const char * path) {
+    struct journal_head_t h;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        perror(path);
+        return;
+    }
+    ssize_t n = read(fd, &h, sizeof(h));
+    close(fd);
+    if(n != sizeof(h) || h.magic != JOURNAL_MAGIC || h.version != JOURNAL_VERSION) {
+        fprintf(stderr, "%s: not a tsh journal\n", path);
+        return;
+    }
+    if(file_num == file_cap) {
+        file_cap = file_cap ? file_cap * 2 : 16;
+        files = realloc(files, sizeof(struct file_t) * file_cap);
+    }
+    files[file_num++] = (struct file_t){strdup(path), h.start, h.shell_pid, h.seq};
+}
+
+static void add_dir(const char * path) {
+    DIR * dir = opendir(path);
+    if(dir == NULL) {
+        perror(path);
+        return;
+    }
+    struct dirent * de;
+    while((de = readdir(dir)) != NULL) {
+        if(de->d_name[0] == '.')
+            continue;
+        char sub[4096];
+        snprintf(sub, sizeof(sub), "%s/%s", path, de->d_name);
+        add_file(sub);
+    }
+    closedir(dir);
+}
+
+/* add_homes - Every ./home/<user>/.tsh_journal there is */
+static void add_homes() {
+    DIR * dir = opendir("./home");
+    if(dir == NULL) {
+        perror("./home");
+        return;
+    }
+    struct dirent * de;
+    while((de = readdir(dir)) != NULL) {
+        char sub[4096];
+        struct stat st;
+        if(de->d_name[0] == '.')
+            continue;
+        snprintf(sub, sizeof(sub), "./home/%s/.tsh_journal", de->d_name);
+        if(stat(sub, &st) == 0 && S_ISDIR(st.st_mode))
+            add_dir(sub);
+    }
+    closedir(dir);
+}
+
+/* by_session - Sessions by start time, the files of a session in sequence */
+static int by_session(const void * a, const void * b) {
+    const struct file_t * x = a, * y = b;
+    if(x->start != y->start)
+        return x->start < y->start ? -1 : 1;
+    if(x->shell_pid != y->shell_pid)
+        return x->shell_pid - y->shell_pid;
+    return (int)x->seq - (int)y->seq;
+}
+
+static struct proc_t * new_proc() {
+    if(proc_num == proc_cap) {
+        proc_cap = proc_cap ? proc_cap * 2 : 256;
+        procs = realloc(procs, sizeof(struct proc_t) * proc_cap);
+    }
+    memset(&procs[proc_num], 0, sizeof(struct proc_t));
+    return &procs[proc_num++];
+}
+
+/*
+ * read_file - Add the records of a journal file to the session whose
+ *     processes start at procs[first]. jids is indexed by pgid % 4096
+ *     with the pgid alongside.
+ */
+static void read_file(const char * path, int first, int jids[][2]) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        if(fd >= 0)
+            close(fd);
+        return;
+    }
+    char * map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        perror(path);
+        return;
+    }
+
+    struct journal_head_t * h = (struct journal_head_t *)map;
+    uint64_t end = h->used < (uint64_t)st.st_size ? h->used : (uint64_t)st.st_size;
+    uint64_t off = (sizeof(*h) + JOURNAL_ALIGN - 1) & ~(uint64_t)(JOURNAL_ALIGN - 1);
+
+    while(off + sizeof(struct journal_rec_t) <= end) {
+        struct journal_rec_t * rec = (struct journal_rec_t *)(map + off);
+        if(rec->size == 0 || off + rec->size > end)
+            break;      // the shell died while reserving it
+        off += rec->size;
+
+        char * strs = (char *)(rec + 1);
+        char * strs_end = (char *)rec + rec->size;
+        int * slot = jids[rec->pgid & 4095];
+
+        if(rec->type == JOURNAL_EXEC) {
+            struct proc_t * p = new_proc();
+            snprintf(p->user, sizeof(p->user), "%s", h->user);
+            p->pid = rec->pid;
+            p->pgid = rec->pgid;
+            p->start = rec->time;
+            p->jid = slot[0] == rec->pgid ? slot[1] : 0;
+            p->argv = malloc(strs_end - strs + 1);
+            char * q = p->argv;
+            for(int i = 0; i < rec->argc && strs < strs_end; i++) {
+                int len = strnlen(strs, strs_end - strs);
+                if(i > 0)
+                    *q++ = ' ';
+                memcpy(q, strs, len);
+                q += len;
+                strs += len + 1;
+            }
+            *q = '\0';
+        } else if(rec->type == JOURNAL_JOB) {
+            // the job is added after its processes are started
+            slot[0] = rec->pgid;
+            slot[1] = rec->jid;
+            for(int i = proc_num - 1; i >= first; i--) {
+                if(procs[i].pgid == rec->pgid && procs[i].jid == 0)
+                    procs[i].jid = rec->jid;
+            }
+        } else if(rec->type == JOURNAL_EXIT) {
+            // a group's child may have exec'd its last command: the pid has two records
+            for(int i = proc_num - 1; i >= first; i--) {
+                struct proc_t * p = &procs[i];
+                if(p->pid != rec->pid || p->ended)
+                    continue;
+                p->ended = true;
+                p->end = rec->time;
+                p->status = rec->status;
+                if(p->jid == 0)
+                    p->jid = rec->jid;
+            }
+        }
+        // type 0: torn, its writer was killed or the shell crashed
+    }
+    munmap(map, st.st_size);
+}
+
+static void format_time(int64_t usec, char * buf, size_t size) {
+    time_t sec = usec / 1000000;
+    struct tm tm;
+    localtime_r(&sec, &tm);
+    size_t n = strftime(buf, size, "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(buf + n, size - n, ".%03d", (int)(usec % 1000000 / 1000));
+}
+
+static void print_proc(struct proc_t * p) {
+    char start[40], end[40], status[16];
+
+    if(opt_user != NULL && strcmp(opt_user, p->user) != 0)
+        return;
+    if(opt_jid != 0 && opt_jid != p->jid)
+        return;
+    if(opt_pid != 0 && opt_pid != p->pid)
+        return;
+    if(opt_failed && (!p->ended || p->status == 0))
+        return;
+    if(opt_text != NULL && strstr(p->argv, opt_text) == NULL)
+        return;
+
+    format_time(p->start, start, sizeof(start));
+    if(p->ended) {
+        format_time(p->end, end, sizeof(end));
+        snprintf(status, sizeof(status), "%d", p->status);
+    } else {
+        strcpy(end, "-");
+        strcpy(status, "-");
+    }
+    printf("%-10s %s  %-23s %7d %7d %4d %6s  %s\n", p->user, start, end, p->pid, p->pgid, p->jid, status, p->argv);
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: tsh-journal [-u user] [-j jid] [-p pid] [-f] [-c text] [file | dir]...\n");
+    exit(1);
+}
+
+int main(int argc, char ** argv) {
+    int c;
+    while((c = getopt(argc, argv, "u:j:p:fc:h")) != -1) {
+        switch(c) {
+        case 'u': opt_user = optarg; break;
+        case 'j': opt_jid = atoi(optarg); break;
+        case 'p': opt_pid = atoi(optarg); break;
+        case 'f': opt_failed = true; break;
+        case 'c': opt_text = optarg; break;
+        default: usage();
+        }
+    }
+
+    if(optind == argc)
+        add_homes();
+    for(int i = optind; i < argc; i++) {
+        struct stat st;
+        if(stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode))
+            add_dir(argv[i]);
+        else
+            add_file(argv[i]);
+    }
+    qsort(files, file_num, sizeof(struct file_t), by_session);
+
+    printf("%-10s %-23s  %-23s %7s %7s %4s %6s  %s\n", "USER", "START", "END", "PID", "PGID", "JID", "STATUS", "ARGV");
+    static int jids[4096][2];
+    for(int i = 0; i < file_num; ) {
+        int first = proc_num;
+        memset(jids, 0, sizeof(jids));
+        int j = i;
+        for(; j < file_num && files[j].start == files[i].start && files[j].shell_pid == files[i].shell_pid; j++)
+            read_file(files[j].path, first, jids);
+        for(int k = first; k < proc_num; k++)
+            print_proc(&procs[k]);
+        i = j;
+    }
+    return 0;
+}
@@ -5,7 +5,7 @@
  *  username: root
  *  password: pass
  */
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 
 #include "job.h"
 #include "tsh.h"
@@ -13,6 +13,25 @@
 #include "history.h"
 #include "helper.h"
 #include "auth.h"
+#include "var.h"
+#include "script.h"
+#include "fastpath.h"
+#include "joblog.h"
+#include "feed.h"
+#include "memo.h"
+#include "after.h"
+#include "coproc.h"
+#include "procsub.h"
+#include "parallel.h"
+#include "buffer.h"
+#include "zygote.h"
+#include "builtin.h"
+#include "record.h"
+#include "startup.h"
+#include "warm.h"
+#include "prefetch.h"
+#include "journal.h"
+#include "group.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -25,27 +44,53 @@
 #include <sys/stat.h>
 #include <stdbool.h>
 #include <fcntl.h>
+#include <getopt.h>
 
 extern char ** environ;     /* defined in libc */
 int verbose = 0;            /* if true, print additional output */  
 char sbuf[MAXLINE];         /* for composing sprintf messages */ 
 char * username;            /* The name of the user currently logged into the shell */
 int shell_pid;
+int last_status = 0;         /* exit status of the last pipeline, $? */
+pid_t last_job_pgid = 0;     /* of the last job started */
+static int next_gate[2] = {-1, -1}; /* the gate the next pipeline waits at (after) */
+static int next_io[2] = {-1, -1};   /* the stdin and stdout of the next pipeline (coproc) */
+static int * fg_pipestatus;         /* exit status of each process of the last foreground job */
+static int fg_pipestatus_cap = 0;   /* >= proc_num of every job, grown before a job is added */
+volatile sig_atomic_t sigint_received = 0;  /* ctrl-c was typed, stops running scripts */
 
 /*
  * main - The shell's main routine 
  */
 int main(int argc, char ** argv) {
     char c;
-    char cmdline[MAXLINE];
+    char * cmdline = NULL;      /* a line of any length */
+    size_t cmdline_cap = 0;
     int emit_prompt = 1; /* emit prompt (default) */
 
+    startup_begin();
+
     /* Redirect stderr to stdout (so that driver will get all output
      * on the pipe connected to stdout) */
     dup2(1, 2); 
 
     /* Parse the command line */
-    while ((c = getopt(argc, argv, "hvp")) != EOF) {
+    int use_zygote = 0;
+    char * record_path = NULL;  /* --record FILE */
+    char * replay_path = NULL;  /* --replay FILE */
+    double replay_speed = 1;    /* --speed Nx, 0 for --max */
+    int startup_profile = 0;    /* --startup-profile */
+    int no_prefetch = 0;        /* --no-prefetch */
+    static struct option long_options[] = {
+        {"startup-profile", no_argument, NULL, 'T'},
+        {"record", required_argument, NULL, 'R'},
+        {"replay", required_argument, NULL, 'P'},
+        {"speed",  required_argument, NULL, 'S'},
+        {"max",    no_argument,       NULL, 'M'},
+        {"no-prefetch", no_argument,  NULL, 'N'},
+        {NULL, 0, NULL, 0}
+    };
+    while ((c = getopt_long(argc, argv, "hvpz", long_options, NULL)) != EOF) {
         switch (c) {
         case 'h':             /* print help message */
             usage();
@@ -56,46 +101,122 @@ int main(int argc, char ** argv) {
         case 'p':             /* don't print a prompt */
             emit_prompt = 0;  /* handy for automatic testing */
 	    break;
+        case 'z':             /* spawn commands through a fork-server */
+            use_zygote = 1;
+	    break;
+        case 'R':             /* record the session */
+            record_path = optarg;
+            break;
+        case 'P':             /* replay a recorded session */
+            replay_path = optarg;
+            break;
+        case 'S':             /* replay N times faster: 2x, 0.5x */
+            replay_speed = strtod(optarg, NULL);
+            if (replay_speed <= 0)
+                usage();
+            break;
+        case 'M':             /* replay without waiting */
+            replay_speed = 0;
+            break;
+        case 'T':             /* print the time to the first prompt, by phase */
+            startup_profile = 1;
+            break;
+        case 'N':             /* don't read the user's usual commands ahead */
+            no_prefetch = 1;
+            break;
 	    default:
             usage();
 	    }
     }
 
+    startup_phase("options");
+
+    /* Fork the spawning helper while the shell is still small */
+    if (use_zygote) {
+        start_zygote();
+        startup_phase("zygote");
+    }
+
     /* Install the signal handlers */
     Signal(SIGINT,  sigint_handler);   /* ctrl-c */
     Signal(SIGTSTP, sigtstp_handler);  /* ctrl-z */
     Signal(SIGCHLD, sigchld_handler);  /* Terminated or stopped child */
+    Signal(SIGIO, sigio_handler);      /* Output of a background job (TSH_JOBLOG=1) */
 
     /* This one provides a clean way to kill the shell */
     Signal(SIGQUIT, sigquit_handler);  
 
     /* Initialize the job list */
     initjobs(jobs);
+    startup_phase("signals");
+
+    /* Import the environment into the shell variables */
+    init_vars(environ);
+    startup_phase("vars");
 
     /* Have a user log into the shell */
     username = login();
+    startup_phase("login");
 
+    /* Its ./proc entry and history are made and read on first use */
     shell_pid = getpid();
-    add_proc("tsh", shell_pid, getppid(), "Rs+");
-    
-    /* Init history for the user that has logged in */
-    init_history();
+    add_shell_proc(getppid());
+
+    /* Map the caches the last session left warm */
+    open_warm();
+    startup_phase("snapshot");
+
+    /* Warm the page cache with what the user runs most, in the background */
+    init_prefetch(!no_prefetch);
+    start_prefetch();
+    startup_phase("prefetch");
+
+    /* Publish job state changes if TSH_FEED names a socket */
+    init_feed();
+    startup_phase("feed");
+
+    if (record_path != NULL && open_record(record_path) < 0) {
+        exit(1);
+    }
+    startup_phase("record");
+    if (startup_profile) {
+        startup_report();
+    }
+    if (replay_path != NULL) {
+        int status = replay_session(replay_path, replay_speed);
+        close_feed();
+        close_record();
+        fflush(stdout);
+        exit(status);
+    }
     
     /* Execute the shell's read/eval loop */
     while (1) {
         /* Read command line */
+        idle_prefetch();
         if (emit_prompt) {
             print_prompt(prompt);
         }
-        if ((fgets(cmdline, MAXLINE, stdin) == NULL) && ferror(stdin)) 
-            app_error("fgets error");
+        if ((getline(&cmdline, &cmdline_cap, stdin) < 0) && ferror(stdin)) 
+            app_error("getline error");
         if (feof(stdin)) { /* End of file (ctrl-d) */
+            save_warm();
+            close_feed();
+            close_record();
             fflush(stdout);
             exit(0);
         }
 
+        /* A compound command may continue on the next lines */
+        char * script = read_script(cmdline, emit_prompt);
+
         /* Evaluate the command line */
-        eval(cmdline);
+        sigint_received = 0;
+        record_input(script != NULL ? script : cmdline);
+        eval(script != NULL ? script : cmdline);
+        finish_history();
+        record_status(last_status);
+        free(script);
         fflush(stdout);
         fflush(stdout);
     } 
@@ -113,44 +234,146 @@ int main(int argc, char ** argv) {
  * each child process must have a unique process group ID so that our
  * background children don't receive SIGINT (SIGTSTP) from the kernel
  * when we type ctrl-c (ctrl-z) at the keyboard.  
+ *
+ * Command lines with control flow (if, while, for, functions, ;, &&, ||)
+ * are compiled and run by the script interpreter instead.
 */
 void eval(char * cmdline) {   
-    // char * argv[MAXARGS];
     int bg;
-    pid_t pid;
-
     int cmd_num, process_num;
     bool should_add_history;
-    struct cmd_t cmd[MAXPIPES];
-    memset(cmd, 0, sizeof(cmd));
+
+    if(is_script(cmdline)) {
+        eval_script(cmdline);
+        return;
+    }
+
+    int pool_size = MAXLINE * 4 + strlen(cmdline) * 4;
+    struct cmd_t * cmd = calloc(max_stages(cmdline), sizeof(struct cmd_t));
+    char * pool = malloc(pool_size);    /* holds words after variable expansion */
+    if(cmd == NULL || pool == NULL) {
+        unix_error("malloc");
+    }
 
     bg = parseline(cmdline, cmd, &cmd_num, &process_num, &should_add_history);
     if(cmd_num == 0){
+        free(cmd);
+        free(pool);
         return;
     }
 
-    bool all_builtin = (process_num == 0);
-
     // if any command in the pipeline contains '!', we don't add this command line to history
     if(should_add_history)
         add_history(cmdline);
 
-    
-    // create pipes
-    int pipes[MAXPIPES][2];
-    for(int i = 0; i < cmd_num - 1; i++) {
-        if(pipe(pipes[i])) {
-            unix_error("creating pipes failed");
+    if(!expand_cmds(cmd, cmd_num, &process_num, pool, pool_size)) {
+        print_error("expansion failed\n");
+        last_status = 1;
+    } else {
+        run_pipeline(cmd, cmd_num, process_num, bg, cmdline);
+    }
+    free(cmd);
+    free(pool);
+}
+
+/* gate_next_pipeline - Make the next pipeline run a waiting job, see after.h */
+void gate_next_pipeline(int gate[2]) {
+    next_gate[0] = gate[0];
+    next_gate[1] = gate[1];
+}
+
+/* connect_next_pipeline - Make the next pipeline read in_fd and write out_fd, and close them */
+void connect_next_pipeline(int in_fd, int out_fd) {
+    next_io[0] = in_fd;
+    next_io[1] = out_fd;
+}
+
+/*
+ * needs_real_fds - Does a builtin run something that uses fds 0-2 itself:
+ *     a function, a command from the history, a plugin. Those get their
+ *     redirections applied to the shell's fds, and undone afterwards.
+ */
+static bool needs_real_fds(struct cmd_t * cmd) {
+    char * name = cmd->argv[0];
+    return name != NULL && (name[0] == '!' || get_function(name) != NULL || is_plugin_builtin(name));
+}
+
+/*
+ * run_pipeline - Run a parsed and expanded pipeline, and set last_status
+ *     to the exit status of its last command (0 for a background job).
+ */
+int run_pipeline(struct cmd_t * cmd, int cmd_num, int process_num, int bg, char * cmdline) {
+    int builtin_status = 0;
+
+    if(cmd[0].argv[0] != NULL && strcmp(cmd[0].argv[0], "memo") == 0) {
+        return run_memo(cmd, cmd_num, bg, cmdline);
+    }
+    if(cmd[0].argv[0] != NULL && (strcmp(cmd[0].argv[0], "after") == 0 || strcmp(cmd[0].argv[0], "after-ok") == 0)) {
+        return run_after(cmd, cmd_num, cmdline);
+    }
+    if(cmd[0].argv[0] != NULL && strcmp(cmd[0].argv[0], "coproc") == 0) {
+        return run_coproc(cmd, cmd_num, cmdline);
+    }
+
+    // set by run_after: every process waits at the gate, the job is added as waiting
+    int gate[2] = {next_gate[0], next_gate[1]};
+    next_gate[0] = next_gate[1] = -1;
+    // set by run_coproc: the shell's socket instead of stdin and stdout
+    int io[2] = {next_io[0], next_io[1]};
+    next_io[0] = next_io[1] = -1;
+
+    // utilities run by the shell (and pure plugin builtins) still get a child of their own
+    // (without exec) in a pipeline, in the background or next to process substitutions,
+    // so that they run concurrently with the other processes
+    for(int i = 0; i < cmd_num; i++) {
+        if((cmd_num > 1 || bg || has_procsub(&cmd[i])) && cmd[i].is_builtin && (is_fastpath(&cmd[i]) || is_pure_builtin(&cmd[i]))) {
+            cmd[i].is_builtin = false;
+            process_num++;
         }
     }
 
-    pid_t pgid = 0;
-    pid_t child_pid[MAXPIPES] = {0};
+    // <(cmd) and >(cmd): their processes are part of the job
+    struct procsub_t * subs = NULL;
+    int sub_num = parse_procsubs(cmd, cmd_num, &subs);
+    if(sub_num < 0) {
+        close_pipe_ends(&io[0], &io[1]);
+        last_status = 1;
+        return last_status;
+    }
+    process_num += sub_num;
+    bool all_builtin = (process_num == 0);
+
+    // a lone builtin without redirection doesn't need to touch any fd
+    if(cmd_num == 1 && cmd[0].is_builtin && cmd[0].redirection_str[0] == NULL && subs == NULL) {
+        last_status = exec_builtin_cmd(cmd[0].argv);
+        fflush(stdout);
+        note_history_status(&last_status, 1);
+        return last_status;
+    }
+
+    // a pipe is created right before the stage that writes to it: the shell holds the read
+    // end for the next stage (prev_in) and the write end until the writer has been started
+    int prev_in = io[0];
+
+    pid_t pgid = in_group && !bg ? getpgrp() : 0;    /* a group's foreground jobs are in the group's job */
+    pid_t * child_pid = malloc(sizeof(pid_t) * (process_num + 1));
     int child_idx = 0;
+    int * stage_status = calloc(cmd_num, sizeof(int));  /* for the history */
+    int * stage_proc = malloc(sizeof(int) * cmd_num);   /* index in child_pid of each stage, -1 for builtins */
+    if(child_pid == NULL || stage_status == NULL || stage_proc == NULL) {
+        unix_error("malloc");
+    }
 
     sigset_t mask_all, prev;
     int state;
     char stat[3];
+    char ** envp = var_envp();
+    struct joblog_t * log = NULL;   /* captures the output of a background job */
+    int log_fd = -1;
+    struct parallel_t * pars = NULL;    /* stats of the parallel stages */
+    struct parallel_t ** par_tail = &pars;
+    struct buffer_t * bufs = NULL;      /* stats of the buffer stages */
+    struct buffer_t ** buf_tail = &bufs;
 
     if(!all_builtin) {
         // block all signals  
@@ -158,48 +381,174 @@ void eval(char * cmdline) {
         sigfillset(&mask_all);
         sigprocmask(SIG_BLOCK, &mask_all, &prev); 
 
+        // the SIGCHLD handler copies the statuses of any job that ends in the foreground here
+        if(process_num > fg_pipestatus_cap) {
+            int * grown = realloc(fg_pipestatus, sizeof(int) * process_num);
+            if(grown == NULL) {
+                unix_error("realloc");
+            }
+            fg_pipestatus = grown;
+            fg_pipestatus_cap = process_num;
+        }
+
+        if(bg && joblog_enabled()) {
+            log = open_joblog(&log_fd);
+        }
+
         if(!bg) {
             state = FG;
             strcpy(stat, "R+");
-            change_proc_stat(shell_pid, "Ss");
+            if(!in_group) {
+                change_proc_stat(shell_pid, "Ss");
+            }
         } else {
-            state = BG;
-            strcpy(stat, "R");
+            state = gate[0] >= 0 ? WT : BG;
+            strcpy(stat, gate[0] >= 0 ? "S" : "R");
         }
     }
+    struct spawn_t sp = {&pgid, child_pid, &child_idx, stat, &prev, gate, log_fd};
 
     for(int i = 0; i < cmd_num; i++) {
-        if(cmd[i].is_builtin) {
-            save_fd();
-            setup_pipe_and_redir(cmd_num, i, &cmd[i], pipes);
+        int next[2] = {-1, -1};     /* the pipe to stage i + 1 */
+        bool subbed = subs != NULL && has_procsub(&cmd[i]);    /* its argv gets /dev/fd/N */
+        if(subbed) {
+            start_procsubs(subs, cmd, i, &sp);
+        }
+        if(i < cmd_num - 1 && pipe2(next, O_CLOEXEC)) {
+            unix_error("creating pipes failed");
+        }
+        if(i == cmd_num - 1) {
+            next[1] = io[1];
+        }
 
-            exec_builtin_cmd(cmd[i].argv);
+        if(cmd[i].is_builtin) {
+            struct bio_t io;
+            if(open_bio(&cmd[i], prev_in, next[1], needs_real_fds(&cmd[i]), &io) == 0) {
+                builtin_status = exec_builtin_cmd(cmd[i].argv);
+                fflush(stdout);
+            } else {
+                builtin_status = 1;
+            }
+            close_bio(&io);
+            close_procsubs(subs, cmd, i);
+            stage_status[i] = builtin_status;
+            stage_proc[i] = -1;
 
-            restore_fd();
+            close_pipe_ends(&prev_in, &next[1]);
+            prev_in = next[0];
             continue;
         } 
 
-        pid_t pid = fork();
+        struct parallel_t * par = NULL;
+        if(is_parallel(&cmd[i])) {
+            par = open_parallel();
+            *par_tail = par;
+            par_tail = &par->next;
+        }
+        struct buffer_t * buf = NULL;
+        if(is_buffer(&cmd[i])) {
+            buf = open_buffer();
+            *buf_tail = buf;
+            buf_tail = &buf->next;
+        }
+
+        // a group's child starts processes of its own, they go to the journal too
+        bool group = is_group(&cmd[i]);
+        if(group) {
+            prepare_journal();
+        } else {
+            note_exec(cmd[i].argv[0]);
+        }
+
+        stage_proc[i] = child_idx;
+        pid_t pid = -1;
+        if(zygote_enabled() && !in_group && gate[0] < 0 && par == NULL && buf == NULL && !is_fastpath(&cmd[i]) && !is_pure_builtin(&cmd[i]) && !subbed && !group) {
+            int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+            if(log != NULL) {
+                fds[1] = fds[2] = log_fd;
+            }
+            if(prev_in >= 0) {
+                fds[0] = prev_in;
+            }
+            if(next[1] >= 0) {
+                fds[1] = next[1];
+            }
+            char ** child_envp = cmd[i].assign_str[0] == NULL ? envp : var_envp_with(cmd[i].assign_str);
+            pid = zygote_spawn(&cmd[i], child_envp, fds, pgid);
+            if(child_envp != envp) {
+                free(child_envp);
+            }
+        }
+        if(pid < 0) {
+            pid = fork();
+        }
         if(pid > 0) {
             if(pgid == 0) {
                 pgid = pid;
             }
+            // also set the process group here, so that it exists before we may signal it (the child does the same)
+            setpgid(pid, pgid);
             child_pid[child_idx++] = pid;
             add_proc(cmd[i].argv[0], pid, shell_pid, stat); 
+            journal_exec(pid, pgid, cmd[i].argv);
+
+            // the child has its ends, the shell keeps only the read end for the next stage
+            close_procsubs(subs, cmd, i);
+            close_pipe_ends(&prev_in, &next[1]);
+            prev_in = next[0];
         }
 
         if(pid == 0) {
             // unblock in child. Otherwise, child could not deal with blocked signals
             sigprocmask(SIG_SETMASK, &prev, NULL);  
 
-            setup_pipe_and_redir(cmd_num, i, &cmd[i], pipes);
+            // an after job: nothing, not even its redirections, happens before the jobs it waits for are done
+            if(gate[0] >= 0) {
+                wait_gate(gate);
+            }
+
+            if(log != NULL) {
+                // what would go to the terminal goes to the job's log; redirections still apply
+                if(i == cmd_num - 1) {
+                    dup2(log_fd, STDOUT_FILENO);
+                }
+                dup2(log_fd, STDERR_FILENO);
+                close(log_fd);
+            }
 
-            // child close all pipes
-            close_all_pipes(pipes, cmd_num - 1);
+            // the read end of the next pipe is for the next stage; close-on-exec only helps those that exec
+            if(next[0] >= 0) {
+                close(next[0]);
+            }
+            if(apply_redir(&cmd[i], prev_in, next[1]) < 0) {
+                exit(1);
+            }
+            keep_procsubs(subs, i);
 
             setpgid(0, pgid);
 
-            if(execve(cmd[i].argv[0], cmd[i].argv, environ) < 0){
+            if(group) {
+                exit(run_group(cmd[i].argv[0]));
+            }
+
+            if(par != NULL || buf != NULL || is_fastpath(&cmd[i]) || is_pure_builtin(&cmd[i])) {
+                Signal(SIGINT, SIG_DFL);
+                Signal(SIGTSTP, SIG_DFL);
+                Signal(SIGQUIT, SIG_DFL);
+                Signal(SIGCHLD, SIG_DFL);
+                if(par != NULL)
+                    exit(exec_parallel(&cmd[i], par));
+                if(buf != NULL)
+                    exit(exec_buffer(&cmd[i], buf));
+                if(is_fastpath(&cmd[i]))
+                    exit(exec_fastpath(cmd[i].argv));
+                int status = exec_builtin_cmd(cmd[i].argv);
+                fflush(stdout);
+                exit(status);
+            }
+
+            char ** child_envp = cmd[i].assign_str[0] == NULL ? envp : var_envp_with(cmd[i].assign_str);
+            if(execve(cmd[i].argv[0], cmd[i].argv, child_envp) < 0){
                 char msg[MAXLINE + 30];
                 sprintf(msg, "%s: Command not found.\n", cmd[i].argv[0]);
                 print_error(msg);
@@ -208,42 +557,137 @@ void eval(char * cmdline) {
         }
     } 
 
-    // shell process close all pipes
-    close_all_pipes(pipes, cmd_num - 1);
-
-
     if(!all_builtin) {
         addjob(jobs, pgid, process_num, state, cmdline, child_pid);
+        last_job_pgid = pgid;
+
+        if(log != NULL) {
+            close(log_fd);
+            attach_joblog(getjobpgid(jobs, pgid), log);
+        }
+        if(pars != NULL) {
+            attach_parallel(getjobpgid(jobs, pgid), pars);
+        }
+        if(bufs != NULL) {
+            attach_buffer(getjobpgid(jobs, pgid), bufs);
+        }
 
         sigprocmask(SIG_SETMASK, &prev, NULL);  // unblock
 
         if(!bg) {
-            waitfg(pgid); 
-            change_proc_stat(shell_pid, "Rs+");
+            waitfg(pgid);   // sets last_status when the job terminates or stops
+            if(!in_group) {
+                change_proc_stat(shell_pid, "Rs+");
+            }
+
+            bool done = getjobpgid(jobs, pgid) == NULL;
+            for(int i = 0; i < cmd_num; i++) {
+                if(stage_proc[i] >= 0) {
+                    stage_status[i] = done ? fg_pipestatus[stage_proc[i]] : last_status;
+                }
+            }
+        } else {
+            last_status = 0;
         }
     }
 
-    return;
+    if(cmd[cmd_num - 1].is_builtin) {
+        last_status = builtin_status;
+    }
+    note_history_status(stage_status, cmd_num);
+
+    free_procsubs(subs);
+    free(child_pid);
+    free(stage_status);
+    free(stage_proc);
+    return last_status;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 /* parsing-related functions start */ 
 
+/* max_stages - How many commands parseline may find in cmdline, at most */
+int max_stages(const char * cmdline) {
+    int n = 1;
+    for(const char * c = cmdline; (c = strchr(c, '|')) != NULL; c++) {
+        n++;
+    }
+    return n;
+}
+
+/*
+ * word_end - The space after the unquoted word at buf; a process substitution,
+ *     a group that starts a command, or a $((expr)) in the word may have spaces
+ */
+static char * word_end(char * buf, bool command) {
+    const char * end = command && group_end(buf) != NULL ? group_end(buf) : procsub_end(buf);
+    if(end != NULL && *end == ' ') {
+        return (char *)end;
+    }
+    for(char * p = buf; *p != '\0'; p++) {
+        const char * past = arith_skip(p);
+        if(past != NULL) {
+            p = (char *)past - 1;
+        } else if(*p == ' ') {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/* redir_op - The first '<' or '>' of word, NULL if none; those in a $((expr)) are operators */
+static const char * redir_op(const char * word) {
+    for(const char * p = word; *p != '\0'; p++) {
+        const char * past = arith_skip(p);
+        if(past != NULL) {
+            p = past - 1;
+        } else if(*p == '<' || *p == '>') {
+            return p;
+        }
+    }
+    return NULL;
+}
+
 /* 
  * parseline - Parse the command line and build the argv array.
  * 
  * Characters enclosed in single quotes are treated as a single
  * argument.  Return true if the user has requested a BG job, false if
- * the user has requested a FG job.  
+ * the user has requested a FG job.  cmd must have room for
+ * max_stages(cmdline) commands.
  */
 int parseline(const char * cmdline, struct cmd_t * cmd, int * cmd_num, int * process_num, bool * should_add_history) {
-    static char array[MAXLINE];  /* holds local copy of command line */
-    char * buf = array;          /* ptr that traverses command line */
+    static char * array;         /* holds local copy of command line */
+    static char * marked;        /* holds single-quoted words with marked '$' */
+    static int array_cap = 0;    /* both grow with the longest line so far */
+
+    int len = strlen(cmdline);
+    if(len + 1 > array_cap) {
+        int cap = len + 1 > MAXLINE ? len + 1 : MAXLINE;
+        array = realloc(array, cap);
+        marked = realloc(marked, cap * 2);
+        if(array == NULL || marked == NULL) {
+            unix_error("realloc");
+        }
+        array_cap = cap;
+    }
+
+    strcpy(array, cmdline);
+    return parse_words(array, marked, cmd, cmd_num, process_num, should_add_history);
+}
+
+/*
+ * parse_words - parseline on a copy of the command line that the caller
+ *     owns: the words point into buf, which is modified, and into marked,
+ *     which must have room for twice its length.
+ */
+int parse_words(char * buf, char * marked, struct cmd_t * cmd, int * cmd_num, int * process_num, bool * should_add_history) {
+    int marked_len = 0;
+    char quote = '\0';           /* quote that encloses the current word, if any */
     char * delim;                /* points to first space delimiter */
     int argc;                    /* number of args */
 
-    strcpy(buf, cmdline);
     buf[strlen(buf)-1] = ' ';  /* replace trailing '\n' with space, so that the last argv can be added to argv list just like other argvs */
     
     *cmd_num = 0;   
@@ -257,6 +701,7 @@ int parseline(const char * cmdline, struct cmd_t * cmd, int * cmd_num, int * pro
     while (*buf && (*buf == ' ')) /* ignore leading spaces */
         buf++;
         
+    quote = *buf;
     if (*buf == '\'') {
         buf++;
         delim = strchr(buf, '\'');
@@ -264,7 +709,7 @@ int parseline(const char * cmdline, struct cmd_t * cmd, int * cmd_num, int * pro
         buf++;
         delim = strchr(buf, '"');
     } else {
-        delim = strchr(buf, ' ');
+        delim = word_end(buf, argc == 0);
     }    
 
     while (delim) {
@@ -277,13 +722,26 @@ int parseline(const char * cmdline, struct cmd_t * cmd, int * cmd_num, int * pro
             argc = 0;
             (*cmd_num)++;
         } else {
-            cmd[*cmd_num].argv[argc++] = buf;
+            char * word = buf;
+
+            // variables are expanded later by expand_cmds, but not in single-quoted words
+            if(quote == '\'' && strchr(buf, '$') != NULL) {
+                word = marked + marked_len;
+                for(char * c = buf; *c; c++) {
+                    if(*c == '$')
+                        marked[marked_len++] = LITERAL_MARK;
+                    marked[marked_len++] = *c;
+                }
+                marked[marked_len++] = '\0';
+            }
+            cmd[*cmd_num].argv[argc++] = word;
         }
 
 	    buf = delim + 1;
 	    while (*buf && (*buf == ' ')) /* ignore spaces */
 	       buf++;
 
+        quote = *buf;
 	    if (*buf == '\'') {
             buf++;
             delim = strchr(buf, '\'');
@@ -291,7 +749,7 @@ int parseline(const char * cmdline, struct cmd_t * cmd, int * cmd_num, int * pro
             buf++;
             delim = strchr(buf, '"');
         } else {
-            delim = strchr(buf, ' ');
+            delim = word_end(buf, argc == 0);
         }
     }
     cmd[*cmd_num].argv[argc] = NULL;
@@ -321,10 +779,16 @@ int parseline(const char * cmdline, struct cmd_t * cmd, int * cmd_num, int * pro
     }
 
     // collect redirection string (set argv and redirection_str properties of cmd_t),
+    // collect name=value prefixes (assign_str property of cmd_t),
     // and set is_builtin property of cmd_t
     // count process_num, set should_add_history
     for(int i = 0; i < (*cmd_num); i++) {
         collect_redir_str(&cmd[i]);
+        if(!plan_redir(&cmd[i], false)) {
+            *cmd_num = 0;
+            return 0;
+        }
+        collect_assign_str(&cmd[i]);
         set_is_builtin(&cmd[i]);
         if(!cmd[i].is_builtin) {
             (*process_num)++;
@@ -345,8 +809,9 @@ redirection operation general format (based on POSIX shell standards):
 [n]redir-op file
 
 n is an optional fd. If n is provided, no space allowed between n and redir-op.
-redir-op is '>' or '<'
-file can be filename or &<fd> 
+redir-op is '<', '>', '>>' or '<>', and file can be &<fd> or &- to copy or close an fd;
+'>&', '<&' followed by an fd or '-', '&>' and '&>>' (stdout and stderr) are also accepted
+(see redir.h, plan_redir compiles them).
 
 0 or more spaces between redir-op and file is allowed
 
@@ -373,13 +838,15 @@ void collect_redir_str(struct cmd_t * cmd) {
     char ** redirection_str = cmd->redirection_str;
 
     for(; argv[argv_idx] != NULL; ) {
-        char * op_ptr = strchr(argv[argv_idx], '>');
-        if(op_ptr == NULL) {
-            op_ptr = strchr(argv[argv_idx], '<');
-        } 
+        // <(cmd) and >(cmd) are words, see procsub.h, and so are groups
+        if(is_procsub(argv[argv_idx]) || (argv_idx == 0 && is_group(cmd))) {
+            argv[new_argv_idx++] = argv[argv_idx];
+            argv_idx++;
+            continue;
+        }
 
         // doesn't contain '<' or '>' 
-        if(op_ptr == NULL) {
+        if(redir_op(argv[argv_idx]) == NULL) {
             argv[new_argv_idx++] = argv[argv_idx];
             argv_idx++;
             continue;
@@ -389,7 +856,7 @@ void collect_redir_str(struct cmd_t * cmd) {
         redirection_str[redir_idx++] = argv[argv_idx];
         int len = strlen(argv[argv_idx]);
 
-        if(argv[argv_idx][len-1] == '>' || argv[argv_idx][len-1] == '<' ) { // there exist spaces between op and file
+        if((argv[argv_idx][len-1] == '>' || argv[argv_idx][len-1] == '<') && argv[argv_idx + 1] != NULL) { // there exist spaces between op and file
             argv_idx++;
             redirection_str[redir_idx++] = argv[argv_idx];
         }
@@ -401,134 +868,130 @@ void collect_redir_str(struct cmd_t * cmd) {
     redirection_str[redir_idx] = NULL;
 }
 
+// strip leading name=value words off a command, and collect them into the assign_str field in struct cmd_t.
+// a command that only consists of assignments keeps them in argv, and sets shell variables as a builtin command.
+void collect_assign_str(struct cmd_t * cmd) {
+    char ** argv = cmd->argv;
+    int assign_num = 0;
+
+    while(argv[assign_num] != NULL && is_assignment(argv[assign_num]))
+        assign_num++;
+
+    if(argv[assign_num] == NULL) {
+        cmd->assign_str[0] = NULL;
+        return;
+    }
+
+    for(int i = 0; i < assign_num; i++) {
+        cmd->assign_str[i] = argv[i];
+    }
+    cmd->assign_str[assign_num] = NULL;
+
+    int i = 0;
+    for(; argv[i + assign_num] != NULL; i++) {
+        argv[i] = argv[i + assign_num];
+    }
+    argv[i] = NULL;
+}
+
 // set the is_builtin property of cmd
 void set_is_builtin(struct cmd_t * cmd) {
     char ** argv = cmd->argv;
 
     bool is_builtin = false;
     
-    if(strcmp(argv[0], "bg") == 0 || strcmp(argv[0], "fg")==0 ){
-       is_builtin = true;
-    }else if(strcmp(argv[0], "jobs") == 0){
-       is_builtin = true;
-    }else if(strcmp(argv[0], "adduser") == 0){ 
+    if(argv[0] == NULL){    // only redirections, e.g. '> file'
         is_builtin = true;
-    }else if (strcmp(argv[0], "history") == 0){
+    }else if(find_builtin(argv[0]) != NULL){
         is_builtin = true;
     }else if (argv[0][0] == '!'){
         is_builtin = true;
-    }else if (strcmp(argv[0], "logout") == 0){
+    }else if(is_assignment(argv[0])){
+        is_builtin = true;
+    }else if(get_function(argv[0]) != NULL){
         is_builtin = true;
-    }else if(strcmp(argv[0], "quit") == 0){
+    }else if(is_fastpath(cmd)){
         is_builtin = true;
     }
 
     cmd->is_builtin = is_builtin;
 }
-/* parsing-related functions end */ 
-
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-/* fd operations start */ 
-
-// | < >
-void setup_pipe_and_redir(int cmd_num, int cmd_idx, struct cmd_t * cmd, int pipes[][2]) {
-
-    // set up pipe redir |
-    if(cmd_idx < cmd_num - 1) { // not the last command in the line, output to pipe
-        dup2(pipes[cmd_idx][1], STDOUT_FILENO);
-    }
-
-    if(cmd_idx - 1 >= 0) {
-        dup2(pipes[cmd_idx-1][0], STDIN_FILENO);
-    }   
-
-    // < >
-    setup_redir(cmd); 
-}
 
-// < >
-void setup_redir(struct cmd_t * cmd) {
-    char ** redir_str = cmd -> redirection_str;
+/*
+ * expand_cmds - Expand variables in the words of a parsed pipeline. Words
+ *     that change are written to pool, and the builtin property and
+ *     process_num are updated, since a command name may be expanded too.
+ *     Return false if pool is too small.
+ */
+bool expand_cmds(struct cmd_t * cmd, int cmd_num, int * process_num, char * pool, int size) {
+    int used = 0;
 
-    for(int i = 0; redir_str[i] != NULL; i++) {
-        int old_fd, new_fd;
-        char * old_fd_str;
-        char * op_pos = redir_str[i];
-        
-        // determine new fd
-        if(redir_str[i][0] == '>' ) {
-            new_fd = STDOUT_FILENO;
-        } else if(redir_str[i][0] == '<') {
-            new_fd = STDIN_FILENO;
-        } else {
-            op_pos = strchr(redir_str[i], '<');
-            if(op_pos == NULL) {
-                op_pos = strchr(redir_str[i], '>');
+    *process_num = 0;
+    for(int i = 0; i < cmd_num; i++) {
+        char ** words[3] = {cmd[i].argv, cmd[i].redirection_str, cmd[i].assign_str};
+
+        for(int j = 0; j < 3; j++) {
+            for(char ** w = words[j]; *w != NULL; w++) {
+                if(strchr(*w, '$') == NULL && strchr(*w, LITERAL_MARK) == NULL)
+                    continue;
+                if(is_procsub(*w) || (w == cmd[i].argv && is_group(&cmd[i])))
+                    continue;   // expanded with its own pipeline, or by the group's child
+
+                int len = expand_word(*w, pool + used, size - used);
+                if(len < 0)
+                    return false;
+                *w = pool + used;
+                used += len + 1;
             }
-
-            new_fd = number_from_string(redir_str[i], op_pos);
-        }
-
-        if( *(op_pos + 1) == '\0') {    // old fd is in the next entry
-            old_fd_str = redir_str[i + 1];
-            i++;
-        } else { // old fd is in this entry
-            old_fd_str = op_pos + 1;
         }
 
-        // determine old fd: &[fd] or <filename>
-        if((*old_fd_str) == '&') {
-            // the number after & should represent an already open file 
-            old_fd = number_from_string(old_fd_str + 1, old_fd_str + 1 + strlen(old_fd_str + 1));
-        } else {
-            // open file
-            if((*op_pos) == '>') {
-                // if the file already exists, discard its content and treat it as an empty file
-                old_fd = open(old_fd_str, O_WRONLY | O_CREAT | O_TRUNC, 0777);     
-            } else {
-                old_fd = open(old_fd_str, O_RDONLY, 0777);
-            }
-
-            if(old_fd == -1) {
-                unix_error("fopen");
-            }
+        // the paths of a plan follow their words; what couldn't be compiled before can be now
+        if(cmd[i].redir_num < 0) {
+            plan_redir(&cmd[i], true);
         }
 
-        // set up redirection
-        dup2(old_fd, new_fd);
-
-        // we can close the newly opened file after its descriptor entry has been copied to new_fd
-        if((*old_fd_str) != '&') {
-            close(old_fd);
+        set_is_builtin(&cmd[i]);
+        if(!cmd[i].is_builtin) {
+            (*process_num)++;
         }
     }
+
+    return true;
 }
 
-void save_fd() {
-    // save copies of original stdin, stdout, stderr 
-    // (currently, our shell doesn't support other fds in the shell execution environment, only these 3 fds are in the shell execution environment.)
-    // because bulit-in commands execute in the shell process, we need to restore fds later.
-    dup2(STDIN_FILENO, UNUSEDFD);
-    dup2(STDOUT_FILENO, UNUSEDFD + 1);
-    dup2(STDERR_FILENO, UNUSEDFD + 2);
+// copy the words (not the strings) of cmd_num commands from src to dst
+void copy_cmds(struct cmd_t * dst, const struct cmd_t * src, int cmd_num) {
+    for(int i = 0; i < cmd_num; i++) {
+        int j;
+        for(j = 0; src[i].argv[j] != NULL; j++)
+            dst[i].argv[j] = src[i].argv[j];
+        dst[i].argv[j] = NULL;
+        for(j = 0; src[i].redirection_str[j] != NULL; j++)
+            dst[i].redirection_str[j] = src[i].redirection_str[j];
+        dst[i].redirection_str[j] = NULL;
+        for(j = 0; src[i].assign_str[j] != NULL; j++)
+            dst[i].assign_str[j] = src[i].assign_str[j];
+        dst[i].assign_str[j] = NULL;
+        memcpy(dst[i].redir, src[i].redir, sizeof(struct redir_t) * (src[i].redir_num > 0 ? src[i].redir_num : 0));
+        dst[i].redir_num = src[i].redir_num;
+        dst[i].is_builtin = src[i].is_builtin;
+    }
 }
+/* parsing-related functions end */ 
 
-void restore_fd() {
-    // restore stdin, stdout, stderr, and delete backup copies
-    dup2(UNUSEDFD, STDIN_FILENO);
-    dup2(UNUSEDFD + 1, STDOUT_FILENO);
-    dup2(UNUSEDFD + 2, STDERR_FILENO);
-    close(UNUSEDFD);
-    close(UNUSEDFD + 1);
-    close(UNUSEDFD + 2);
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-}
+/* fd operations start */ 
 
-void close_all_pipes(int pipes[][2], int num) {
-    for(int pipe_idx = 0; pipe_idx < num; pipe_idx++) {
-        close(pipes[pipe_idx][0]);                
-        close(pipes[pipe_idx][1]);
+// close the pipe ends that a stage has been given, and forget them
+void close_pipe_ends(int * in_fd, int * out_fd) {
+    if(*in_fd >= 0) {
+        close(*in_fd);
+        *in_fd = -1;
+    }
+    if(*out_fd >= 0) {
+        close(*out_fd);
+        *out_fd = -1;
     }
 }
 /* fd operations end */ 
@@ -540,36 +1003,36 @@ void close_all_pipes(int pipes[][2], int num) {
 /* 
  * builtin_cmd - If the user has typed a built-in command then execute
  *    it immediately in the shell process itself.  
+ *    Return its exit status.
  */
-void exec_builtin_cmd(char ** argv) {
-    if(strcmp(argv[0], "bg") == 0 || strcmp(argv[0], "fg")==0 ){
-        do_bgfg(argv);
-    }else if(strcmp(argv[0], "jobs") == 0){
-        if(argv[1] == NULL)
-            listjobs(jobs);
-        else
-            print_error("too many arguments\n");
-    }else if(strcmp(argv[0], "adduser")==0){ 
-        add_user(argv);
-    }else if (strcmp(argv[0], "history") == 0){
-        if(argv[1] != NULL){
-            print_error("too many arguments\n");   
-        }
-        list_history();
+int exec_builtin_cmd(char ** argv) {
+    int status = 0;
+    const struct builtin_t * builtin;
+
+    if(argv[0] == NULL){
+        return 0;
+    }else if((builtin = find_builtin(argv[0])) != NULL){
+        status = builtin->run(argv);
     }else if (argv[0][0] == '!' ){
         exec_nth_cmd(argv);
-    }else if (strcmp(argv[0], "logout") ==0 ){
-        if(check_suspend()){
-            print_error("There are suspended jobs.\n");
-        }else{
-            do_quit();
-        }
-    }else if(strcmp(argv[0], "quit") == 0){
-        do_quit();
+        status = last_status;
+    }else if(is_assignment(argv[0])){
+        do_assign(argv);
+    }else if(get_function(argv[0]) != NULL){
+        status = call_function(argv);
+    }else if(fastpath_name(argv[0]) != NULL){
+        status = exec_fastpath(argv);
     }
+
+    return status;
 }
 
 void do_quit() {
+    if(in_group) {  // the group's child, nothing of the shell's to save
+        fflush(stdout);
+        exit(0);
+    }
+    save_warm();
     free(username);
 
     sigset_t mask, prev;
@@ -592,6 +1055,7 @@ void do_quit() {
     sigprocmask(SIG_SETMASK, &prev, NULL);
 
     remove_proc(shell_pid);
+    close_feed();
 
     printf("tsh quit :)\n");
     exit(0);
@@ -616,11 +1080,13 @@ void do_bgfg(char ** argv) {
     struct job_t * job = pgidjid_str2job(argv[1]);
     if(job == NULL || job->state == UNDEF){
         print_error("no such job or process group\n");
+        sigprocmask(SIG_SETMASK, &prev, NULL);
         return;
     }
 
     char child_stat[3];
     bool need_change_child_stat = true;
+    int old_state = job->state;
 
     if(strcmp(argv[0], "fg") == 0){
         strcpy(child_stat, "R+");
@@ -631,6 +1097,9 @@ void do_bgfg(char ** argv) {
         }
         job->state = FG;  // ST -> FG, BG -> FG
 
+        // show the output captured so far, what follows goes to the terminal
+        replay_joblog(job);
+
     }else if(strcmp(argv[0], "bg") == 0){  // ST -> BG, BG -> BG
         strcpy(child_stat, "R");
         if(job -> state != BG){
@@ -638,9 +1107,12 @@ void do_bgfg(char ** argv) {
         } else {
             need_change_child_stat = false;
         }
-        job->state = BG;
+        job->state = is_waiting(job) ? WT : BG;   // an after job still waits
        
     }
+    if(old_state != job->state) {
+        publish_job(job, old_state, job->state);
+    }
 
     if(need_change_child_stat) {
         for(int i = 0; i < job->proc_num; i++) {
@@ -717,8 +1189,21 @@ void sigchld_handler(int sig) {
     while((pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0){
         // NOTE we can't use getpgid(pid) to get pgid, 'cause process pid might have terminated
         struct job_t * job = getjobpid(jobs, pid);
+        if(job == NULL) {   // not started by the job machinery
+            continue;
+        }
+
+        if(WIFSTOPPED(status) && in_group) {
+            continue;   // the whole group was stopped, and is waited for again once continued
+        }
 
         if(WIFSTOPPED(status)){
+            if(job->state == FG) {
+                last_status = 128 + WSTOPSIG(status);
+            }
+            if(job->state != ST) {
+                publish_job(job, job->state, ST);
+            }
             job -> state = ST;
         } else if(WIFSIGNALED(status)){ // WIFSIGNALED() returns true if the child process was terminated by a signal.
             int signal_num = WTERMSIG(status);
@@ -730,7 +1215,22 @@ void sigchld_handler(int sig) {
         }
 
 
+        // the exit status of a pipeline is the one of its last process, the others are kept for the history
+        if(!WIFSTOPPED(status)) {
+            for(int i = 0; i < job->proc_num; i++) {
+                if(job->pids[i] == pid)
+                    job->pipestatus[i] = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+            }
+            if(pid == job->pids[job->proc_num - 1])
+                job->status = job->pipestatus[job->proc_num - 1];
+            journal_exit(pid, job, WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status));
+        }
+
         if(job->terminated_proc_num == job->proc_num) {
+            if(job->state == FG) {
+                last_status = job->status;
+                memcpy(fg_pipestatus, job->pipestatus, sizeof(int) * job->proc_num);
+            }
             deletejob(jobs, job->pgid);
         }
 
@@ -758,6 +1258,8 @@ void sigint_handler(int sig) {
     sigfillset(&mask_all);
     sigprocmask(SIG_BLOCK, &mask_all, &prev);
 
+    sigint_received = 1;
+
     pid_t fg_pgid = fgpgid(jobs);
 
     if(fg_pgid != 0)
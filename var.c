@@ -0,0 +1,649 @@
+#include "var.h"
+#include "tsh.h"
+#include "helper.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+/* the symbol table: a hash table of shell variables, chained on collision */
+static struct var_t ** buckets = NULL;
+static int bucket_num = 0;
+static int var_num = 0;
+
+/* envp handed to execve, rebuilt only after an exported variable has changed */
+static char ** envp_cache = NULL;
+static int exported_num = 0;
+static bool env_dirty = true;
+
+/***********************************************
+ * Helper routines that manipulate the symbol table
+ **********************************************/
+
+/* hash_name - FNV-1a hash of the first len characters of name */
+static unsigned int hash_name(const char * name, int len) {
+    unsigned int h = 2166136261u;
+    for(int i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static struct var_t * find_var(const char * name, int len, unsigned int hash) {
+    struct var_t * var = buckets[hash & (bucket_num - 1)];
+    for(; var != NULL; var = var->next) {
+        if(var->hash == hash && strncmp(var->name, name, len) == 0 && var->name[len] == '\0')
+            return var;
+    }
+    return NULL;
+}
+
+/* grow - double the number of buckets once the table gets crowded */
+static void grow() {
+    int new_num = bucket_num * 2;
+    struct var_t ** new_buckets = calloc(new_num, sizeof(struct var_t *));
+    if(new_buckets == NULL) {
+        unix_error("calloc");
+    }
+
+    for(int i = 0; i < bucket_num; i++) {
+        struct var_t * var = buckets[i];
+        while(var != NULL) {
+            struct var_t * next = var->next;
+            int idx = var->hash & (new_num - 1);
+            var->next = new_buckets[idx];
+            new_buckets[idx] = var;
+            var = next;
+        }
+    }
+
+    free(buckets);
+    buckets = new_buckets;
+    bucket_num = new_num;
+}
+
+/* set_env_str - keep the "name=value" string of an exported variable up to date */
+static void set_env_str(struct var_t * var) {
+    free(var->env_str);
+    var->env_str = NULL;
+
+    if(var->exported) {
+        int len = strlen(var->name) + strlen(var->value) + 2;
+        var->env_str = malloc(len);
+        if(var->env_str == NULL) {
+            unix_error("malloc");
+        }
+        sprintf(var->env_str, "%s=%s", var->name, var->value);
+    }
+}
+
+/* init_vars - Initialize the symbol table, importing envp as exported variables */
+void init_vars(char ** envp) {
+    bucket_num = VAR_BUCKETS;
+    buckets = calloc(bucket_num, sizeof(struct var_t *));
+    if(buckets == NULL) {
+        unix_error("calloc");
+    }
+
+    for(int i = 0; envp != NULL && envp[i] != NULL; i++) {
+        if(strchr(envp[i], '=') != NULL) {
+            assign_var(envp[i], true);
+        }
+    }
+}
+
+char * get_var_n(const char * name, int len) {
+    struct var_t * var = find_var(name, len, hash_name(name, len));
+    return var == NULL ? NULL : var->value;
+}
+
+/* get_var - Return the value of variable name, NULL if it is not set */
+char * get_var(const char * name) {
+    return get_var_n(name, strlen(name));
+}
+
+/*
+ * set_var - Set variable name to value. A variable that has been exported
+ *     once stays exported.
+ */
+void set_var(const char * name, const char * value, bool exported) {
+    int len = strlen(name);
+    unsigned int hash = hash_name(name, len);
+    struct var_t * var = find_var(name, len, hash);
+
+    if(var == NULL) {
+        if(var_num + 1 > bucket_num) {
+            grow();
+        }
+
+        var = calloc(1, sizeof(struct var_t));
+        if(var == NULL) {
+            unix_error("calloc");
+        }
+        var->name = strdup(name);
+        var->hash = hash;
+        var->next = buckets[hash & (bucket_num - 1)];
+        buckets[hash & (bucket_num - 1)] = var;
+        var_num++;
+    } else if(value == var->value) {
+        value = NULL;   // re-exporting a variable keeps its value
+    } else {
+        free(var->value);
+        var->value = NULL;
+    }
+
+    if(value != NULL || var->value == NULL) {
+        var->value = strdup(value == NULL ? "" : value);
+    }
+
+    if(exported && !var->exported) {
+        var->exported = true;
+        exported_num++;
+    }
+
+    if(var->exported) {
+        set_env_str(var);
+        env_dirty = true;
+    }
+}
+
+/* unset_var - Remove variable name from the symbol table */
+void unset_var(const char * name) {
+    int len = strlen(name);
+    unsigned int hash = hash_name(name, len);
+    struct var_t ** link = &buckets[hash & (bucket_num - 1)];
+
+    for(; *link != NULL; link = &(*link)->next) {
+        struct var_t * var = *link;
+        if(var->hash == hash && strcmp(var->name, name) == 0) {
+            *link = var->next;
+            if(var->exported) {
+                exported_num--;
+                env_dirty = true;
+            }
+            free(var->name);
+            free(var->value);
+            free(var->env_str);
+            free(var);
+            var_num--;
+            return;
+        }
+    }
+}
+
+/* is_valid_name - [st, end) is a valid variable name: [A-Za-z_][A-Za-z0-9_]* */
+bool is_valid_name(const char * st, const char * end) {
+    if(st == end || !(isalpha((unsigned char)*st) || *st == '_'))
+        return false;
+    for(const char * p = st + 1; p != end; p++) {
+        if(!(isalnum((unsigned char)*p) || *p == '_'))
+            return false;
+    }
+    return true;
+}
+
+/* is_assignment - word has the form name=value */
+bool is_assignment(const char * word) {
+    char * eq = strchr(word, '=');
+    return eq != NULL && is_valid_name(word, eq);
+}
+
+/* assign_var - Set a variable from a "name=value" word */
+void assign_var(const char * word, bool exported) {
+    char name[MAXLINE];
+    const char * eq = strchr(word, '=');
+    int len = eq - word;
+
+    if(len >= MAXLINE) {
+        print_error("variable name too long\n");
+        return;
+    }
+    memcpy(name, word, len);
+    name[len] = '\0';
+    set_var(name, eq + 1, exported);
+}
+
+/*
+ * var_envp - Return the environment of executed commands. The array is
+ *     cached and only rebuilt after an exported variable has changed, so
+ *     spawning a command doesn't touch the symbol table at all.
+ */
+char ** var_envp() {
+    if(!env_dirty) {
+        return envp_cache;
+    }
+
+    free(envp_cache);
+    envp_cache = malloc(sizeof(char *) * (exported_num + 1));
+    if(envp_cache == NULL) {
+        unix_error("malloc");
+    }
+
+    int n = 0;
+    for(int i = 0; i < bucket_num; i++) {
+        for(struct var_t * var = buckets[i]; var != NULL; var = var->next) {
+            if(var->exported) {
+                envp_cache[n++] = var->env_str;
+            }
+        }
+    }
+    envp_cache[n] = NULL;
+    env_dirty = false;
+
+    return envp_cache;
+}
+
+/*
+ * var_envp_with - Return the environment of a command that has per-command
+ *     assignments (name=value cmd). The cached envp is not modified: a new
+ *     array shares its strings and only the overridden entries are replaced.
+ *     Called in the forked child, so the layer never reaches the shell itself.
+ */
+char ** var_envp_with(char ** assign_str) {
+    char ** base = var_envp();
+    int base_num = 0, assign_num = 0;
+
+    while(base[base_num] != NULL)
+        base_num++;
+    while(assign_str[assign_num] != NULL)
+        assign_num++;
+
+    char ** envp = malloc(sizeof(char *) * (base_num + assign_num + 1));
+    if(envp == NULL) {
+        return base;
+    }
+    memcpy(envp, base, sizeof(char *) * base_num);
+
+    int n = base_num;
+    for(int i = 0; i < assign_num; i++) {
+        int len = strchr(assign_str[i], '=') - assign_str[i] + 1;  // including '='
+        int j;
+        for(j = 0; j < n; j++) {
+            if(strncmp(envp[j], assign_str[i], len) == 0)
+                break;
+        }
+        envp[j] = assign_str[i];
+        if(j == n)
+            n++;
+    }
+    envp[n] = NULL;
+
+    return envp;
+}
+
+/* positional parameters $0 $1 ... of the running function, NULL-terminated */
+static char ** positional = NULL;
+
+/* swap_positional - Make argv the positional parameters, return the previous ones */
+char ** swap_positional(char ** argv) {
+    char ** old = positional;
+    positional = argv;
+    return old;
+}
+
+/* positional_num - Number of positional parameters, $# */
+int positional_num() {
+    int n = 0;
+    while(positional != NULL && positional[n] != NULL)
+        n++;
+    return n > 0 ? n - 1 : 0;
+}
+
+char ** get_positional() {
+    return positional;
+}
+
+/*
+ * Arithmetic expansion $((expr)): integers and variables combined with
+ * ( ) ! unary - * / % + - < <= > >= == != && ||, C precedence
+ */
+struct arith_t {
+    const char * p;
+    bool error;
+};
+
+static long arith_or(struct arith_t * a);
+
+static void arith_space(struct arith_t * a) {
+    while(*a->p == ' ' || *a->p == '\t')
+        a->p++;
+}
+
+static long arith_primary(struct arith_t * a) {
+    arith_space(a);
+
+    if(*a->p == '(') {
+        a->p++;
+        long v = arith_or(a);
+        arith_space(a);
+        if(*a->p != ')') {
+            a->error = true;
+            return 0;
+        }
+        a->p++;
+        return v;
+    } else if(*a->p == '-') {
+        a->p++;
+        return -arith_primary(a);
+    } else if(*a->p == '+') {
+        a->p++;
+        return arith_primary(a);
+    } else if(*a->p == '!') {
+        a->p++;
+        return !arith_primary(a);
+    } else if(isdigit((unsigned char)*a->p)) {
+        char * end;
+        long v = strtol(a->p, &end, 0);
+        a->p = end;
+        return v;
+    }
+
+    if(*a->p == '$') {
+        a->p++;
+        if(isdigit((unsigned char)*a->p)) {  // $1 ... $9
+            int n = *a->p++ - '0';
+            char * value = positional != NULL && n <= positional_num() ? positional[n] : NULL;
+            return value == NULL ? 0 : atol(value);
+        } else if(*a->p == '#') {
+            a->p++;
+            return positional_num();
+        }
+    }
+    const char * st = a->p;
+    while(isalnum((unsigned char)*a->p) || *a->p == '_')
+        a->p++;
+    if(!is_valid_name(st, a->p)) {
+        a->error = true;
+        return 0;
+    }
+    char * value = get_var_n(st, a->p - st);
+    return value == NULL ? 0 : atol(value);
+}
+
+static long arith_mul(struct arith_t * a) {
+    long v = arith_primary(a);
+    while(!a->error) {
+        arith_space(a);
+        char op = *a->p;
+        if(op != '*' && op != '/' && op != '%')
+            break;
+        a->p++;
+        long r = arith_primary(a);
+        if(op == '*') {
+            v *= r;
+        } else if(r == 0) {
+            a->error = true;    // division by zero
+        } else {
+            v = op == '/' ? v / r : v % r;
+        }
+    }
+    return v;
+}
+
+static long arith_add(struct arith_t * a) {
+    long v = arith_mul(a);
+    while(!a->error) {
+        arith_space(a);
+        char op = *a->p;
+        if(op != '+' && op != '-')
+            break;
+        a->p++;
+        long r = arith_mul(a);
+        v = op == '+' ? v + r : v - r;
+    }
+    return v;
+}
+
+static long arith_rel(struct arith_t * a) {
+    long v = arith_add(a);
+    while(!a->error) {
+        arith_space(a);
+        const char * p = a->p;
+        if(p[0] == '<' && p[1] == '=') {
+            a->p += 2;
+            v = v <= arith_add(a);
+        } else if(p[0] == '>' && p[1] == '=') {
+            a->p += 2;
+            v = v >= arith_add(a);
+        } else if(p[0] == '<') {
+            a->p++;
+            v = v < arith_add(a);
+        } else if(p[0] == '>') {
+            a->p++;
+            v = v > arith_add(a);
+        } else {
+            break;
+        }
+    }
+    return v;
+}
+
+static long arith_eq(struct arith_t * a) {
+    long v = arith_rel(a);
+    while(!a->error) {
+        arith_space(a);
+        if(a->p[0] == '=' && a->p[1] == '=') {
+            a->p += 2;
+            v = v == arith_rel(a);
+        } else if(a->p[0] == '!' && a->p[1] == '=') {
+            a->p += 2;
+            v = v != arith_rel(a);
+        } else {
+            break;
+        }
+    }
+    return v;
+}
+
+static long arith_and(struct arith_t * a) {
+    long v = arith_eq(a);
+    while(!a->error) {
+        arith_space(a);
+        if(a->p[0] != '&' || a->p[1] != '&')
+            break;
+        a->p += 2;
+        long r = arith_eq(a);
+        v = v && r;
+    }
+    return v;
+}
+
+static long arith_or(struct arith_t * a) {
+    long v = arith_and(a);
+    while(!a->error) {
+        arith_space(a);
+        if(a->p[0] != '|' || a->p[1] != '|')
+            break;
+        a->p += 2;
+        long r = arith_and(a);
+        v = v || r;
+    }
+    return v;
+}
+
+/* arith_end - Return the first ')' of the "))" that closes $(( at p */
+static const char * arith_end(const char * p) {
+    int depth = 0;
+    for(p += 3; *p; p++) {
+        if(*p == '(') {
+            depth++;
+        } else if(*p == ')') {
+            if(depth == 0 && p[1] == ')')
+                return p;
+            depth--;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * arith_skip - Past the "))" that closes the $(( at p: an arithmetic
+ *     expansion is one word, whatever spaces or '<' and '>' it holds.
+ *     NULL if p doesn't start one or it isn't closed.
+ */
+const char * arith_skip(const char * p) {
+    const char * end;
+    if(strncmp(p, "$((", 3) != 0 || (end = arith_end(p)) == NULL)
+        return NULL;
+    return end + 2;
+}
+
+/* append - Append len bytes to dst, return false if they don't fit into size */
+static bool append(char * dst, int * len, int size, const char * src, int src_len) {
+    if(*len + src_len >= size)
+        return false;
+    memcpy(dst + *len, src, src_len);
+    *len += src_len;
+    return true;
+}
+
+/*
+ * expand_word - Copy word into dst (at most size bytes including '\0'),
+ *     replacing $name, ${name}, $$, $?, $#, $0..$9, $@, $* and $((expr))
+ *     by their values. Unset variables expand to the empty string, and a
+ *     '$' preceded by LITERAL_MARK (single-quoted by the user) is kept.
+ *     Return the length of the result, or -1 if it doesn't fit into dst
+ *     or an arithmetic expression is invalid.
+ */
+int expand_word(const char * word, char * dst, int size) {
+    int len = 0;
+    const char * p = word;
+
+    while(*p) {
+        const char * value = NULL;
+        char num_str[24];
+
+        if(*p == LITERAL_MARK && p[1] != '\0') {
+            p++;
+            if(!append(dst, &len, size, p++, 1))
+                return -1;
+            continue;
+        } else if(*p != '$') {
+            if(!append(dst, &len, size, p++, 1))
+                return -1;
+            continue;
+        }
+
+        if(p[1] == '(' && p[2] == '(' && arith_end(p) != NULL) {
+            struct arith_t a;
+            char expr[MAXLINE];
+            const char * end = arith_end(p);
+            int expr_len = end - p - 3;
+
+            if(expr_len >= MAXLINE)
+                return -1;
+            memcpy(expr, p + 3, expr_len);
+            expr[expr_len] = '\0';
+
+            a.p = expr;
+            a.error = false;
+            long v = arith_or(&a);
+            arith_space(&a);
+            if(a.error || *a.p != '\0') {
+                print_error("invalid arithmetic expression\n");
+                return -1;
+            }
+            sprintf(num_str, "%ld", v);
+            value = num_str;
+            p = end + 2;
+        } else if(p[1] == '$') {
+            sprintf(num_str, "%d", shell_pid);
+            value = num_str;
+            p += 2;
+        } else if(p[1] == '?') {
+            sprintf(num_str, "%d", last_status);
+            value = num_str;
+            p += 2;
+        } else if(p[1] == '#') {
+            sprintf(num_str, "%d", positional_num());
+            value = num_str;
+            p += 2;
+        } else if(isdigit((unsigned char)p[1])) {
+            int n = p[1] - '0';
+            value = positional != NULL && n <= positional_num() ? positional[n] : NULL;
+            p += 2;
+        } else if(p[1] == '@' || p[1] == '*') {
+            for(int i = 1; i <= positional_num(); i++) {
+                if((i > 1 && !append(dst, &len, size, " ", 1)) || !append(dst, &len, size, positional[i], strlen(positional[i])))
+                    return -1;
+            }
+            p += 2;
+        } else if(p[1] == '{' && strchr(p, '}') != NULL) {
+            const char * end = strchr(p, '}');
+            value = get_var_n(p + 2, end - p - 2);
+            p = end + 1;
+        } else if(isalpha((unsigned char)p[1]) || p[1] == '_') {
+            const char * end = p + 1;
+            while(isalnum((unsigned char)*end) || *end == '_')
+                end++;
+            value = get_var_n(p + 1, end - p - 1);
+            p = end;
+        } else {
+            if(!append(dst, &len, size, p++, 1))
+                return -1;
+            continue;
+        }
+
+        if(value != NULL && !append(dst, &len, size, value, strlen(value))) {
+            return -1;
+        }
+    }
+    dst[len] = '\0';
+
+    return len;
+}
+
+/* builtin commands */
+
+/* do_assign - name=value [name=value ...] without a command sets shell variables */
+void do_assign(char ** argv) {
+    for(int i = 0; argv[i] != NULL; i++) {
+        assign_var(argv[i], false);
+    }
+}
+
+/* do_export - export [name[=value] ...], without arguments list exported variables */
+void do_export(char ** argv) {
+    if(argv[1] == NULL) {
+        list_vars(true);
+        return;
+    }
+
+    for(int i = 1; argv[i] != NULL; i++) {
+        if(is_assignment(argv[i])) {
+            assign_var(argv[i], true);
+        } else if(is_valid_name(argv[i], argv[i] + strlen(argv[i]))) {
+            set_var(argv[i], get_var(argv[i]), true);
+        } else {
+            char msg[MAXLINE + 40];
+            sprintf(msg, "export: %s: not a valid identifier\n", argv[i]);
+            print_error(msg);
+        }
+    }
+}
+
+/* do_unset - unset name [name ...] */
+void do_unset(char ** argv) {
+    if(argv[1] == NULL) {
+        print_error("need more arguments\n");
+        return;
+    }
+
+    for(int i = 1; argv[i] != NULL; i++) {
+        unset_var(argv[i]);
+    }
+}
+
+/* list_vars - Print all (or only exported) variables */
+void list_vars(bool exported_only) {
+    for(int i = 0; i < bucket_num; i++) {
+        for(struct var_t * var = buckets[i]; var != NULL; var = var->next) {
+            if(exported_only && !var->exported)
+                continue;
+            printf("%s%s=%s\n", exported_only ? "export " : "", var->name, var->value);
+        }
+    }
+}
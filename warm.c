@@ -0,0 +1,114 @@
+#include "warm.h"
+#include "tsh.h"
+#include "history.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ALIGN8(n)   (((n) + 7) & ~(uint64_t)7)
+
+static const char * map = NULL;     /* the snapshot of the previous session, NULL if none */
+static uint64_t map_size = 0;
+
+/* the caches written at exit: each puts at most cap bytes in buf, and returns how many */
+static const struct {
+    uint32_t id;
+    int (*save)(void * buf, int cap);
+} caches[] = {
+    {WARM_HISTORY, save_history_warm},
+};
+
+static void warm_path(char * path) {
+    sprintf(path, "./home/%s/.tsh_warm", username);
+}
+
+/* open_warm - Map the snapshot, if there is one of this version */
+void open_warm() {
+    char path[MAXLINE];
+    struct stat st;
+
+    warm_path(path);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return;
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct warm_head_t) || st.st_size > WARM_MAXSIZE) {
+        close(fd);
+        return;
+    }
+
+    void * p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED)
+        return;
+
+    const struct warm_head_t * head = p;
+    if(head->magic != WARM_MAGIC || head->version != WARM_VERSION || head->size != (uint64_t)st.st_size) {
+        munmap(p, st.st_size);
+        return;
+    }
+    map = p;
+    map_size = st.st_size;
+}
+
+/* warm_section - The data of section id in the snapshot, NULL if it has none */
+const void * warm_section(uint32_t id, uint32_t * len) {
+    if(map == NULL)
+        return NULL;
+
+    for(uint64_t off = sizeof(struct warm_head_t); off + sizeof(struct warm_sect_t) <= map_size; ) {
+        const struct warm_sect_t * sect = (const void *)(map + off);
+        off += sizeof(struct warm_sect_t);
+        if(sect->len > map_size - off)
+            return NULL;
+        if(sect->id == id) {
+            *len = sect->len;
+            return map + off;
+        }
+        off += ALIGN8(sect->len);
+    }
+    return NULL;
+}
+
+/* save_warm - Write the caches for the next session */
+void save_warm() {
+    char path[MAXLINE], tmp[MAXLINE + 32];
+    int cap = 64 * 1024;
+    char * buf = malloc(cap);
+
+    if(buf == NULL || username == NULL) {
+        free(buf);
+        return;
+    }
+
+    struct warm_head_t * head = (void *)buf;
+    uint64_t size = sizeof(*head);
+    for(int i = 0; i < (int)(sizeof(caches) / sizeof(caches[0])); i++) {
+        struct warm_sect_t * sect = (void *)(buf + size);
+        int len = caches[i].save(buf + size + sizeof(*sect), cap - size - sizeof(*sect) - 8);
+        if(len <= 0)
+            continue;
+        sect->id = caches[i].id;
+        sect->len = len;
+        memset(buf + size + sizeof(*sect) + len, 0, ALIGN8(len) - len);
+        size += sizeof(*sect) + ALIGN8(len);
+    }
+    head->magic = WARM_MAGIC;
+    head->version = WARM_VERSION;
+    head->size = size;
+
+    warm_path(path);
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd >= 0) {
+        bool ok = write(fd, buf, size) == (ssize_t)size;
+        close(fd);
+        if(!ok || rename(tmp, path) != 0)
+            unlink(tmp);
+    }
+    free(buf);
+}
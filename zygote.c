@@ -0,0 +1,229 @@
+#define _GNU_SOURCE
+
+#include "zygote.h"
+#include "tsh.h"
+#include "helper.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/prctl.h>
+
+static int zygote_fd = -1;      /* the shell's end of the socketpair, -1 if off */
+
+/***********************************************
+ * The helper
+ **********************************************/
+
+/* unpack - Point words at the next count strings of buf, return the end of the last one */
+static char * unpack(char * p, char * end, char ** words, int count) {
+    for(int i = 0; i < count; i++) {
+        char * nul = memchr(p, '\0', end - p);
+        if(nul == NULL)
+            return NULL;
+        words[i] = p;
+        p = nul + 1;
+    }
+    words[count] = NULL;
+    return p;
+}
+
+/* zygote_child - Become the command of a request: fds, redirections, signals, then exec */
+static void zygote_child(int sock, int fds[3], pid_t pgid, char ** argv, char ** envp, char ** redir) {
+    struct cmd_t cmd;
+    sigset_t empty;
+
+    close(sock);
+    setpgid(0, pgid);
+
+    for(int i = 0; i < 3; i++) {
+        dup2(fds[i], i);
+    }
+    for(int i = 0; i < 3; i++) {
+        if(fds[i] > STDERR_FILENO)
+            close(fds[i]);
+    }
+
+    // what the helper ignores would stay ignored across exec
+    Signal(SIGINT, SIG_DFL);
+    Signal(SIGTSTP, SIG_DFL);
+    Signal(SIGQUIT, SIG_DFL);
+    Signal(SIGTTIN, SIG_DFL);
+    Signal(SIGTTOU, SIG_DFL);
+    sigemptyset(&empty);
+    sigprocmask(SIG_SETMASK, &empty, NULL);
+
+    memset(&cmd, 0, sizeof(cmd));
+    for(int i = 0; redir[i] != NULL; i++) {
+        cmd.redirection_str[i] = redir[i];
+    }
+    if(!plan_redir(&cmd, true) || apply_redir(&cmd, -1, -1) < 0)
+        exit(1);
+
+    execve(argv[0], argv, envp);
+    char msg[MAXLINE + 30];
+    snprintf(msg, sizeof(msg), "%s: Command not found.\n", argv[0]);
+    print_error(msg);
+    exit(1);
+}
+
+/* zygote_main - Serve spawn requests until the shell goes away */
+static void zygote_main(int sock) {
+    static char buf[ZYGOTE_MSG];
+    char ctrl[CMSG_SPACE(sizeof(int) * 3)];
+
+    // the helper is in the shell's process group: keyboard signals are not for it
+    Signal(SIGINT, SIG_IGN);
+    Signal(SIGTSTP, SIG_IGN);
+    Signal(SIGQUIT, SIG_IGN);
+    Signal(SIGTTIN, SIG_IGN);
+    Signal(SIGTTOU, SIG_IGN);
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+    for(;;) {
+        struct iovec iov = {buf, sizeof(buf)};
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctrl;
+        msg.msg_controllen = sizeof(ctrl);
+
+        ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            _exit(0);
+
+        struct cmsghdr * c = CMSG_FIRSTHDR(&msg);
+        if(c == NULL || c->cmsg_type != SCM_RIGHTS || c->cmsg_len != CMSG_LEN(sizeof(int) * 3)) {
+            pid_t reply = -EINVAL;
+            send(sock, &reply, sizeof(reply), 0);
+            continue;
+        }
+        int fds[3];
+        memcpy(fds, CMSG_DATA(c), sizeof(fds));
+
+        struct zreq_t req;
+        pid_t reply = -EINVAL;
+        char * p = buf + sizeof(req);
+        memcpy(&req, buf, sizeof(req));
+        if(n >= (ssize_t)sizeof(req) && req.argc > 0 && req.argc < MAXARGS && req.redirc < MAXARGS && req.envc >= 0) {
+            char * argv[MAXARGS], * redir[MAXARGS];
+            char ** envp = malloc(sizeof(char *) * (req.envc + 1));
+
+            if(envp != NULL && (p = unpack(p, buf + n, argv, req.argc)) != NULL
+               && (p = unpack(p, buf + n, envp, req.envc)) != NULL
+               && (p = unpack(p, buf + n, redir, req.redirc)) != NULL) {
+                // the child's parent is the shell, not us
+                pid_t pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, NULL, NULL, 0);
+                if(pid == 0) {
+                    zygote_child(sock, fds, req.pgid, argv, envp, redir);
+                }
+                reply = pid < 0 ? -errno : pid;
+            }
+            free(envp);
+        }
+
+        for(int i = 0; i < 3; i++) {
+            close(fds[i]);
+        }
+        send(sock, &reply, sizeof(reply), 0);
+    }
+}
+
+/***********************************************
+ * The shell side
+ **********************************************/
+
+/* start_zygote - Fork the helper. Called first thing, while the shell is small. */
+void start_zygote() {
+    int sv[2];
+
+    if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+        unix_error("zygote: socketpair");
+    }
+
+    pid_t pid = fork();
+    if(pid < 0) {
+        unix_error("zygote: fork");
+    }
+    if(pid == 0) {
+        close(sv[0]);
+        zygote_main(sv[1]);
+    }
+
+    close(sv[1]);
+    zygote_fd = sv[0];
+}
+
+bool zygote_enabled() {
+    return zygote_fd >= 0;
+}
+
+/* pack - Append words to the request, counting them. Return the new length, -1 if it doesn't fit. */
+static int pack(char * buf, int len, char ** words, int * count) {
+    *count = 0;
+    for(; *words != NULL; words++) {
+        int n = strlen(*words) + 1;
+        if(len + n > ZYGOTE_MSG)
+            return -1;
+        memcpy(buf + len, *words, n);
+        len += n;
+        (*count)++;
+    }
+    return len;
+}
+
+/*
+ * zygote_spawn - Have the helper start cmd with fds as its stdin, stdout
+ *     and stderr, in process group pgid (0 for a new one). Return the pid
+ *     of the child, -1 if the shell should fork it itself.
+ */
+pid_t zygote_spawn(struct cmd_t * cmd, char ** envp, int fds[3], pid_t pgid) {
+    static char buf[ZYGOTE_MSG];
+    char ctrl[CMSG_SPACE(sizeof(int) * 3)];
+    struct zreq_t req;
+    int len = sizeof(req);
+
+    if(zygote_fd < 0)
+        return -1;
+
+    req.pgid = pgid;
+    if((len = pack(buf, len, cmd->argv, &req.argc)) < 0
+       || (len = pack(buf, len, envp, &req.envc)) < 0
+       || (len = pack(buf, len, cmd->redirection_str, &req.redirc)) < 0) {
+        return -1;
+    }
+    memcpy(buf, &req, sizeof(req));
+
+    struct iovec iov = {buf, len};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(ctrl, 0, sizeof(ctrl));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+
+    struct cmsghdr * c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int) * 3);
+    memcpy(CMSG_DATA(c), fds, sizeof(int) * 3);
+
+    pid_t reply;
+    if(sendmsg(zygote_fd, &msg, MSG_NOSIGNAL) != len || recv(zygote_fd, &reply, sizeof(reply), 0) != sizeof(reply)) {
+        print_error("zygote: helper lost, forking from the shell\n");
+        close(zygote_fd);
+        zygote_fd = -1;
+        return -1;
+    }
+    return reply > 0 ? reply : -1;
+}